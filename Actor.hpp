@@ -0,0 +1,246 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+#include "CoroutineScheduler.hpp"
+#include "Task.hpp"
+
+namespace CoroutineScheduler
+{
+	struct ActorConfig {
+		// messages handled per activation before the actor goes behind the other runnable tasks
+		size_t batch = 64;
+		const char* name = "actor";
+		// handled envelopes kept for later messages, past it they are freed
+		size_t spareEnvelopes = 256;
+	};
+
+	// The link a type carries to be queued in an MpscQueue.
+	struct MpscLink {
+		std::atomic<MpscLink*> next{ nullptr };
+	};
+
+	// Vyukov's intrusive multi-producer single-consumer queue of T deriving from MpscLink: Push is one
+	// exchange, allocates nothing and never waits for the consumer or other producers. A node whose
+	// producer swapped it in but has not linked it yet stays invisible to Pop until it has. The queue
+	// owns none of its nodes.
+	template<typename T>
+	class MpscQueue {
+		// queued whenever the queue would run empty, so the last node can be handed out
+		MpscLink stub;
+		// the node pushed last, swapped by the producers
+		std::atomic<MpscLink*> head{ &stub };
+		// the node to pop next, owned by the consumer
+		MpscLink* tail = &stub;
+
+		void PushLink(MpscLink* node) {
+			node->next.store(nullptr, std::memory_order_relaxed);
+			MpscLink* prev = this->head.exchange(node, std::memory_order_acq_rel);
+			prev->next.store(node, std::memory_order_release);
+		}
+
+	public:
+		MpscQueue() = default;
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		void Push(T* node) {
+			PushLink(node);
+		}
+
+		// Consumer only.
+		T* Pop() {
+			MpscLink* node = this->tail;
+			MpscLink* next = node->next.load(std::memory_order_acquire);
+			if (node == &this->stub) {
+				if (next == nullptr)
+					return nullptr;
+				this->tail = next;
+				node = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+			if (next == nullptr) {
+				// a producer is between its exchange and its link
+				if (node != this->head.load(std::memory_order_acquire))
+					return nullptr;
+				PushLink(&this->stub);
+				next = node->next.load(std::memory_order_acquire);
+				if (next == nullptr)
+					return nullptr;
+			}
+			this->tail = next;
+			return static_cast<T*>(node);
+		}
+	};
+
+	// A single-owner state machine fed by messages, without a coroutine of its own: the actor is
+	// scheduled onto a Proc only while its mailbox has messages, handles up to ActorConfig::batch of
+	// them per activation and then gives the Proc up. Each activation runs on a fiber created for it
+	// and freed when the mailbox is drained, so an idle actor costs its state and mailbox but no stack.
+	//
+	// The handler runs for one message at a time, never concurrently with itself, and may block like
+	// any coroutine, though the actor's later messages wait for it then. Send never blocks.
+	template<typename Msg>
+	class Actor {
+		// Reused for every activation: the runtime starts it like a new task each time and hands it
+		// back through MarkForDeletion once its fiber finished.
+		class Activation : public ITask {
+			Actor* const actor;
+
+		public:
+			explicit Activation(Actor* actor) : actor(actor) {}
+
+			~Activation() {
+				if (this->registry != nullptr) this->registry->Remove(this);
+				Fiber::DeleteFiber(this->fiberHandle);
+				this->fiberHandle = nullptr;
+			}
+
+			const char* GetTaskName() const override { return this->actor->config.name; }
+
+			void Execute() override {
+				this->actor->Drain();
+				this->locals.Clear();
+			}
+
+			// Activations are not awaited, the owner only waits for the mailbox to drain.
+			void Await() override {}
+			bool AwaitUntil(std::chrono::steady_clock::time_point) override { return true; }
+			bool SetDependentTask(ITask*) override { return false; }
+
+			// Called by the runtime once it no longer touches the activation: frees the stack and makes
+			// the task startable again before the actor decides whether another activation is due.
+			bool MarkForDeletion() override {
+				// unlink before the fiber goes away, the registry may be walking its stack
+				if (this->registry != nullptr) this->registry->Remove(this);
+				Fiber::DeleteFiber(this->fiberHandle);
+				this->fiberHandle = nullptr;
+				this->state.store(TaskState::TaskNotStarted, std::memory_order_release);
+				this->started.store(false, std::memory_order_relaxed);
+				this->actor->Deactivate();
+				return true;
+			}
+		};
+
+		// A queued message, linked into the mailbox through the envelope itself.
+		struct Envelope : MpscLink {
+			std::optional<Msg> message;
+		};
+
+		Runtime& runtime;
+		const ActorConfig config;
+		std::function<void(Msg&)> handler;
+		MpscQueue<Envelope> mailbox;
+		// handled envelopes, pushed by the activation only; one sender at a time pops, a sender
+		// finding another one at it allocates instead of waiting
+		std::atomic<Envelope*> spare{ nullptr };
+		std::atomic<size_t> spareCount{ 0 };
+		std::atomic<bool> takingSpare{ false };
+		Activation activation{ this };
+		// messages sent and not handled yet; the Send that raises it from 0 schedules the activation
+		// and the activation that brings it back to 0 ends it, so at most one runs at a time
+		std::atomic<size_t> pending{ 0 };
+		// messages the running activation popped
+		size_t popped = 0;
+		// activations between popping their last message and letting go of the actor
+		std::atomic<unsigned int> finishing{ 0 };
+		std::atomic<bool> closed{ false };
+
+		// Each activation is spawned anew, the last one left the registry in MarkForDeletion.
+		void Activate() {
+			this->runtime.AddTask(&this->activation);
+		}
+
+		Envelope* TakeEnvelope() {
+			Envelope* envelope = nullptr;
+			// with a single popper an envelope on the stack cannot be popped and pushed back meanwhile
+			if (!this->takingSpare.exchange(true, std::memory_order_acquire)) {
+				envelope = this->spare.load(std::memory_order_acquire);
+				while (envelope != nullptr && !this->spare.compare_exchange_weak(envelope, static_cast<Envelope*>(envelope->next.load(std::memory_order_relaxed)),
+					std::memory_order_acquire, std::memory_order_acquire)) {}
+				this->takingSpare.store(false, std::memory_order_release);
+			}
+			if (envelope == nullptr)
+				return new Envelope();
+			this->spareCount.fetch_sub(1, std::memory_order_relaxed);
+			return envelope;
+		}
+
+		void RecycleEnvelope(Envelope* envelope) {
+			envelope->message.reset();
+			if (this->spareCount.load(std::memory_order_relaxed) >= this->config.spareEnvelopes) {
+				delete envelope;
+				return;
+			}
+			this->spareCount.fetch_add(1, std::memory_order_relaxed);
+			Envelope* top = this->spare.load(std::memory_order_relaxed);
+			do {
+				envelope->next.store(top, std::memory_order_relaxed);
+			} while (!this->spare.compare_exchange_weak(top, envelope, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		void Drain() {
+			size_t count = 0;
+			while (count < this->config.batch) {
+				Envelope* envelope = this->mailbox.Pop();
+				// counted by a Send that has not linked it yet, the next activation picks it up
+				if (envelope == nullptr) break;
+				count++;
+				if (!this->closed.load(std::memory_order_relaxed)) this->handler(*envelope->message);
+				RecycleEnvelope(envelope);
+			}
+			this->popped = count;
+		}
+
+		void Deactivate() {
+			this->finishing.fetch_add(1, std::memory_order_seq_cst);
+			// nothing of the actor may be touched past this point unless it is still ours
+			if (this->pending.fetch_sub(this->popped, std::memory_order_seq_cst) != this->popped)
+				Activate();
+			this->finishing.fetch_sub(1, std::memory_order_seq_cst);
+		}
+
+	public:
+		explicit Actor(std::function<void(Msg&)> handler, const ActorConfig& config = {}, Runtime& runtime = Runtime::Current())
+			: runtime(runtime), config(config), handler(std::move(handler)) {
+			if (this->config.batch == 0) throw std::invalid_argument("actor batch must be at least 1");
+		}
+		Actor(const Actor&) = delete;
+		Actor& operator=(const Actor&) = delete;
+
+		// Drops the messages not handled yet and waits for a running activation to let go, yielding
+		// when called from a coroutine. Must not race with Send, nor be called from the handler.
+		~Actor() {
+			this->closed.store(true, std::memory_order_seq_cst);
+			while (this->pending.load(std::memory_order_seq_cst) != 0 || this->finishing.load(std::memory_order_seq_cst) != 0)
+				this->runtime.YieldCurrentTask();
+			for (Envelope* envelope = this->spare.load(std::memory_order_acquire); envelope != nullptr; ) {
+				Envelope* next = static_cast<Envelope*>(envelope->next.load(std::memory_order_relaxed));
+				delete envelope;
+				envelope = next;
+			}
+		}
+
+		// Queues the message and schedules the actor if it was idle. False once the actor is being destroyed.
+		bool Send(Msg message) {
+			if (this->closed.load(std::memory_order_acquire))
+				return false;
+			Envelope* envelope = TakeEnvelope();
+			envelope->message.emplace(std::move(message));
+			// counted before it is pushed, so the activation ending now cannot miss it
+			bool idle = this->pending.fetch_add(1, std::memory_order_seq_cst) == 0;
+			this->mailbox.Push(envelope);
+			if (idle) Activate();
+			return true;
+		}
+
+		// messages sent and not handled yet
+		size_t Pending() const { return this->pending.load(std::memory_order_relaxed); }
+	};
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+namespace CoroutineScheduler
+{
+	// Header of every arena page, the usable bytes follow it.
+	struct ArenaPage {
+		ArenaPage* next;
+		// bytes including this header
+		size_t size;
+	};
+
+	// Free arena pages of one Proc, only touched by its thread. Blocks of another size (oversized
+	// allocations, pages of another runtime) and pages beyond the bound go back to the heap.
+	class ArenaPageCache {
+		const size_t pageSize;
+		const size_t maxPages;
+		ArenaPage* free = nullptr;
+		size_t count = 0;
+
+	public:
+		ArenaPageCache(size_t pageSize, size_t maxPages) : pageSize(std::max(pageSize, sizeof(ArenaPage) * 2)), maxPages(maxPages) {}
+		ArenaPageCache(const ArenaPageCache&) = delete;
+		ArenaPageCache& operator=(const ArenaPageCache&) = delete;
+		~ArenaPageCache() {
+			while (this->free != nullptr) {
+				ArenaPage* page = this->free;
+				this->free = page->next;
+				::operator delete(page);
+			}
+		}
+
+		size_t PageSize() const { return this->pageSize; }
+
+		// A cached page when 'bytes' fits one, a new block of max(bytes, page size) otherwise.
+		ArenaPage* Acquire(size_t bytes) {
+			if (bytes <= this->pageSize && this->free != nullptr) {
+				ArenaPage* page = this->free;
+				this->free = page->next;
+				this->count--;
+				return page;
+			}
+			size_t size = std::max(bytes, this->pageSize);
+			ArenaPage* page = static_cast<ArenaPage*>(::operator new(size));
+			page->size = size;
+			return page;
+		}
+
+		// Takes back a whole list of pages.
+		void Release(ArenaPage* pages) {
+			while (pages != nullptr) {
+				ArenaPage* next = pages->next;
+				if (pages->size == this->pageSize && this->count < this->maxPages) {
+					pages->next = this->free;
+					this->free = pages;
+					this->count++;
+				}
+				else ::operator delete(pages);
+				pages = next;
+			}
+		}
+	};
+
+	// The calling Proc's page cache, or the calling thread's outside the runtime.
+	ArenaPageCache& CurrentArenaPageCache();
+
+	// Bump-pointer memory owned by one task: an allocation moves a pointer, deallocate does nothing,
+	// and every page goes back to the Proc's cache at once when the task completes. Objects allocated
+	// from it must not outlive the coroutine. Pages are taken on first use, so a task that never
+	// allocates from its arena costs nothing.
+	class TaskArena : public std::pmr::memory_resource {
+		// most recent first, 'cursor' and 'end' bound the free part of the first one
+		ArenaPage* pages = nullptr;
+		uintptr_t cursor = 0;
+		uintptr_t end = 0;
+
+		static uintptr_t AlignUp(uintptr_t address, size_t alignment) {
+			return (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+		}
+
+		void* AllocateSlow(size_t bytes, size_t alignment) {
+			ArenaPageCache& cache = CurrentArenaPageCache();
+			size_t needed = sizeof(ArenaPage) + bytes + alignment - 1;
+			ArenaPage* page = cache.Acquire(needed);
+			uintptr_t result = AlignUp(reinterpret_cast<uintptr_t>(page + 1), alignment);
+			if (needed > cache.PageSize() && this->pages != nullptr) {
+				// a block of its own, the current page keeps serving the small allocations
+				page->next = this->pages->next;
+				this->pages->next = page;
+				return reinterpret_cast<void*>(result);
+			}
+			page->next = this->pages;
+			this->pages = page;
+			this->cursor = result + bytes;
+			this->end = reinterpret_cast<uintptr_t>(page) + page->size;
+			return reinterpret_cast<void*>(result);
+		}
+
+	protected:
+		void* do_allocate(size_t bytes, size_t alignment) override {
+			uintptr_t result = AlignUp(this->cursor, alignment);
+			if (this->pages != nullptr && result + bytes <= this->end) {
+				this->cursor = result + bytes;
+				return reinterpret_cast<void*>(result);
+			}
+			return AllocateSlow(bytes, alignment);
+		}
+
+		void do_deallocate(void*, size_t, size_t) override {}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+	public:
+		TaskArena() = default;
+		TaskArena(const TaskArena&) = delete;
+		TaskArena& operator=(const TaskArena&) = delete;
+		~TaskArena() {
+			while (this->pages != nullptr) {
+				ArenaPage* page = this->pages;
+				this->pages = page->next;
+				::operator delete(page);
+			}
+		}
+
+		bool Empty() const { return this->pages == nullptr; }
+
+		// Hands every page to 'cache', whatever was allocated from the arena is gone.
+		void Release(ArenaPageCache& cache) {
+			cache.Release(this->pages);
+			this->pages = nullptr;
+			this->cursor = this->end = 0;
+		}
+	};
+
+	// The calling coroutine's arena, std::pmr::get_default_resource() outside coroutines. Defined out
+	// of line, see CurrentFiberLocals.
+	std::pmr::memory_resource* CurrentArena();
+}
@@ -0,0 +1,671 @@
+// Microbenchmarks for the coroutine scheduler.
+//
+// Every benchmark runs for a fixed time budget and reports the cost of one operation.
+// The whole run is written as a single JSON document (stdout or --out <file>) so results can
+// be diffed between releases. Blog_Codes/measuring_iterations_per_sec_go.go is the baseline
+// reference for "channel_pingpong": it exchanges the same message over a Go unbuffered channel.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory_resource>
+#include <ranges>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../includes/Coroutine.h"
+
+using Clock = std::chrono::steady_clock;
+using CoroutineScheduler::Stats::LatencyHistogram;
+using CoroutineScheduler::Stats::HistogramSnapshot;
+
+constexpr auto BenchBudget = std::chrono::milliseconds(300);
+
+struct BenchResult {
+	std::string name;
+	uint64_t iterations = 0;
+	double nsPerOp = 0;
+	std::vector<std::pair<std::string, double>> extra;
+
+	std::string ToJson() const {
+		std::string json = std::format(R"({{"name":"{}","iterations":{},"ns_per_op":{:.2f},"ops_per_sec":{:.2f})",
+			name, iterations, nsPerOp, nsPerOp > 0 ? 1e9 / nsPerOp : 0.0);
+		for (auto& [key, value] : extra)
+			json += std::format(R"(,"{}":{:.2f})", key, value);
+		return json + "}";
+	}
+};
+
+static BenchResult MakeResult(const char* name, uint64_t iterations, Clock::duration elapsed) {
+	BenchResult r;
+	r.name = name;
+	r.iterations = iterations;
+	r.nsPerOp = iterations == 0 ? 0 : static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / iterations;
+	return r;
+}
+
+//----------------------- Fiber switch -----------------------
+static Fiber::FiberHandle benchThreadFiber = nullptr;
+static Fiber::FiberHandle benchPeerFiber = nullptr;
+
+static void SwitchPeer(void*) {
+	while (true) Fiber::SwitchToFiber(benchPeerFiber, benchThreadFiber);
+}
+
+// One iteration is a switch into the peer fiber and one back, reported per switch.
+static BenchResult BenchFiberSwitch() {
+	benchThreadFiber = Fiber::CreateFiberFromThread();
+	benchPeerFiber = Fiber::CreateFiber(64 * 1024, SwitchPeer);
+	uint64_t iterations = 0;
+	auto start = Clock::now();
+	auto deadline = start + BenchBudget;
+	while (Clock::now() < deadline) {
+		for (int i = 0; i < 1024; i++)
+			Fiber::SwitchToFiber(benchThreadFiber, benchPeerFiber);
+		iterations += 1024;
+	}
+	auto elapsed = Clock::now() - start;
+	Fiber::DeleteFiber(benchPeerFiber);
+	Fiber::DeleteFiber(benchThreadFiber);
+	return MakeResult("fiber_switch", iterations * 2, elapsed);
+}
+//------------------------------------------------------------
+
+//----------------------- Yield -----------------------
+static uint64_t YieldLoop() {
+	uint64_t iterations = 0;
+	auto deadline = Clock::now() + BenchBudget;
+	while (Clock::now() < deadline) {
+		Coroutine::Yield();
+		iterations++;
+	}
+	return iterations;
+}
+
+// Give up the Proc and get requeued behind the rest of the run queue.
+static BenchResult BenchYield() {
+	auto start = Clock::now();
+	auto res = Coroutine::Run("YieldLoop", YieldLoop);
+	res->Await();
+	return MakeResult("yield_roundtrip", res->GetReturnValue(), Clock::now() - start);
+}
+//-----------------------------------------------------
+
+// One iteration is a yield among 'count' runnable coroutines on one Proc, each switch landing on
+// another stack: the TLB cost of scattered stacks against stacks packed into huge-page regions.
+static BenchResult BenchYieldMany(const char* name, size_t count, bool stackArena) {
+	Coroutine::RuntimeConfig config;
+	config.singleThreaded = true;
+	config.stackArena = stackArena;
+	Coroutine::Runtime runtime(config);
+	// one Proc runs them all, so plain counters would do; atomics keep the main thread's reads defined
+	std::atomic<size_t> ready{ 0 };
+	std::atomic<uint64_t> yields{ 0 };
+	std::atomic<bool> stop{ false };
+	auto body = [&] {
+		ready.fetch_add(1, std::memory_order_relaxed);
+		while (!stop.load(std::memory_order_relaxed)) {
+			Coroutine::Yield();
+			yields.store(yields.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		};
+	std::vector<decltype(Coroutine::Run(runtime, "YieldMany", body))> tasks;
+	tasks.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		tasks.push_back(Coroutine::Run(runtime, "YieldMany", body));
+	while (ready.load(std::memory_order_relaxed) < count)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	uint64_t before = yields.load(std::memory_order_relaxed);
+	auto start = Clock::now();
+	std::this_thread::sleep_for(BenchBudget);
+	uint64_t after = yields.load(std::memory_order_relaxed);
+	auto elapsed = Clock::now() - start;
+	stop.store(true, std::memory_order_relaxed);
+	for (auto& task : tasks)
+		task->Await();
+	BenchResult r = MakeResult(name, after - before, elapsed);
+	r.extra.emplace_back("coroutines", static_cast<double>(count));
+	return r;
+}
+//-----------------------------------------------------
+
+//----------------------- Generator -----------------------
+static uint64_t GeneratorLoop() {
+	Coroutine::Generator<uint64_t> counter([](Coroutine::Generator<uint64_t>::Yielder& yield) {
+		for (uint64_t i = 0;; i++)
+			yield.Yield(i);
+		});
+	uint64_t iterations = 0;
+	auto deadline = Clock::now() + BenchBudget;
+	for (uint64_t v : counter) {
+		iterations++;
+		// checking the clock every element would cost more than the element
+		if ((v & 1023) == 0 && Clock::now() >= deadline) break;
+	}
+	return iterations;
+}
+
+// One iteration is one value pulled from a generator: a switch into the producer and one back.
+static BenchResult BenchGenerator() {
+	auto start = Clock::now();
+	auto res = Coroutine::Run("GeneratorLoop", GeneratorLoop);
+	res->Await();
+	return MakeResult("generator_next", res->GetReturnValue(), Clock::now() - start);
+}
+//---------------------------------------------------------
+
+//----------------------- Pipeline -----------------------
+// One iteration is one item through a parse, filter, sum pipeline of trivial stages, so what is
+// measured is the batching and handoff between them.
+static BenchResult BenchPipeline() {
+	std::atomic<uint64_t> sum{ 0 };
+	auto start = Clock::now();
+	auto res = Coroutine::Run("PipelineSource", [&sum] {
+		auto pipeline = Coroutine::PipelineBuilder<uint64_t>("bench")
+			.Stage("parse", [](uint64_t v) { return v * 3; }, { .parallelism = 2 })
+			.Stage("filter", [](uint64_t v) -> std::optional<uint64_t> { if (v & 1) return std::nullopt; return v; }, { .parallelism = 2 })
+			.Sink("sum", [&sum](uint64_t v) { sum.fetch_add(v, std::memory_order_relaxed); });
+		uint64_t iterations = 0;
+		auto deadline = Clock::now() + BenchBudget;
+		while ((iterations & 1023) != 0 || Clock::now() < deadline)
+			pipeline->Push(iterations++);
+		pipeline->Close();
+		return iterations;
+		});
+	res->Await();
+	return MakeResult("pipeline_3stage", res->GetReturnValue(), Clock::now() - start);
+}
+//---------------------------------------------------------
+
+//----------------------- Spawn + join -----------------------
+static void EmptyTask() {}
+
+static BenchResult BenchSpawnJoin() {
+	constexpr int Batch = 256;
+	uint64_t iterations = 0;
+	auto start = Clock::now();
+	auto deadline = start + BenchBudget;
+	while (Clock::now() < deadline) {
+		std::vector<decltype(Coroutine::Run("EmptyTask", EmptyTask))> handles;
+		handles.reserve(Batch);
+		for (int i = 0; i < Batch; i++)
+			handles.emplace_back(Coroutine::Run("EmptyTask", EmptyTask));
+		handles.clear(); // ResultState joins in its destructor
+		iterations += Batch;
+	}
+	return MakeResult("spawn_join", iterations, Clock::now() - start);
+}
+
+// The same batches through RunMany: one allocation, one queue lock and one join per batch.
+static BenchResult BenchSpawnManyJoin() {
+	constexpr int Batch = 256;
+	uint64_t iterations = 0;
+	auto start = Clock::now();
+	auto deadline = start + BenchBudget;
+	while (Clock::now() < deadline) {
+		Coroutine::RunMany("EmptyTask", [](int) {}, std::views::iota(0, Batch))->Await();
+		iterations += Batch;
+	}
+	return MakeResult("spawn_many_join", iterations, Clock::now() - start);
+}
+
+// Run followed straight by Await from a coroutine, which runs the child inline on the caller's fiber.
+static BenchResult BenchSpawnAwait() {
+	auto start = Clock::now();
+	auto res = Coroutine::Run("SpawnAwait", [] {
+		uint64_t iterations = 0;
+		auto deadline = Clock::now() + BenchBudget;
+		while ((iterations & 255) != 0 || Clock::now() < deadline) {
+			Coroutine::Run("EmptyTask", EmptyTask)->Await();
+			iterations++;
+		}
+		return iterations;
+		});
+	res->Await();
+	return MakeResult("spawn_await", res->GetReturnValue(), Clock::now() - start);
+}
+//------------------------------------------------------------
+
+//----------------------- Allocation -----------------------
+// One iteration is a 64 byte allocation and its free inside a short-lived coroutine, from the
+// coroutine's arena or from the global heap.
+static BenchResult BenchAlloc(const char* name, bool arena) {
+	constexpr int Tasks = 256, Allocs = 256;
+	uint64_t iterations = 0;
+	auto start = Clock::now();
+	auto deadline = start + BenchBudget;
+	while (Clock::now() < deadline) {
+		Coroutine::RunMany("Alloc", [arena](int) {
+			std::pmr::memory_resource* resource = arena ? Coroutine::Arena() : std::pmr::new_delete_resource();
+			void* blocks[Allocs];
+			for (int i = 0; i < Allocs; i++) {
+				blocks[i] = resource->allocate(64, 8);
+				*static_cast<volatile char*>(blocks[i]) = 1;
+			}
+			for (int i = 0; i < Allocs; i++)
+				resource->deallocate(blocks[i], 64, 8);
+			}, std::views::iota(0, Tasks))->Await();
+		iterations += Tasks * Allocs;
+	}
+	return MakeResult(name, iterations, Clock::now() - start);
+}
+//---------------------------------------------------------
+
+//----------------------- Actors -----------------------
+// One iteration is a message to an idle actor: the activation is spawned, handles it and frees its
+// fiber again, so this is the cost of an actor waking up rather than of its mailbox.
+static BenchResult BenchActorActivate() {
+	constexpr int Actors = 256;
+	std::atomic<uint64_t> handled{ 0 };
+	std::vector<std::unique_ptr<Coroutine::Actor<int>>> actors;
+	for (int i = 0; i < Actors; i++)
+		actors.push_back(std::make_unique<Coroutine::Actor<int>>([&handled](int&) { handled.fetch_add(1, std::memory_order_relaxed); }));
+	uint64_t iterations = 0;
+	auto start = Clock::now();
+	auto deadline = start + BenchBudget;
+	while (Clock::now() < deadline) {
+		for (auto& actor : actors) actor->Send(1);
+		iterations += Actors;
+		while (handled.load(std::memory_order_relaxed) != iterations) std::this_thread::yield();
+	}
+	return MakeResult("actor_activate", iterations, Clock::now() - start);
+}
+//---------------------------------------------------------
+
+//----------------------- Channels -----------------------
+static void Ponger(Coroutine::Channel<int>::Receiver* in, Coroutine::Channel<int>::Sender* out) {
+	while (true) {
+		int v = in->Receive();
+		out->Send(v);
+		if (v < 0) break;
+	}
+	delete in;
+	delete out;
+}
+
+static uint64_t Pinger(Coroutine::Channel<int>::Sender* out, Coroutine::Channel<int>::Receiver* in) {
+	uint64_t iterations = 0;
+	auto deadline = Clock::now() + BenchBudget;
+	while (Clock::now() < deadline) {
+		out->Send(1);
+		in->Receive();
+		iterations++;
+	}
+	out->Send(-1);
+	in->Receive();
+	delete out;
+	delete in;
+	return iterations;
+}
+
+// One iteration is a message to the peer and its reply, as in the Go baseline.
+static BenchResult BenchChannelPingPong() {
+	Coroutine::Channel<int> ping, pong;
+	auto start = Clock::now();
+	auto ponger = Coroutine::Run("Ponger", Ponger, ping.GetReceiver(), pong.GetSender());
+	auto pinger = Coroutine::Run("Pinger", Pinger, ping.GetSender(), pong.GetReceiver());
+	pinger->Await();
+	auto elapsed = Clock::now() - start;
+	ponger->Await();
+	return MakeResult("channel_pingpong", pinger->GetReturnValue(), elapsed);
+}
+
+// The same ping-pong on a single-threaded runtime over channels without a lock.
+static BenchResult BenchLocalChannelPingPong() {
+	Coroutine::RuntimeConfig config;
+	config.singleThreaded = true;
+	Coroutine::Runtime runtime(config);
+	auto ping = std::make_shared<Coroutine::LocalChannel<int>>(1);
+	auto pong = std::make_shared<Coroutine::LocalChannel<int>>(1);
+	auto start = Clock::now();
+	auto ponger = Coroutine::Run(runtime, "Ponger", [ping, pong] {
+		while (true) {
+			int v = ping->Receive();
+			pong->Send(v);
+			if (v < 0) break;
+		}
+		});
+	auto pinger = Coroutine::Run(runtime, "Pinger", [ping, pong] {
+		uint64_t iterations = 0;
+		auto deadline = Clock::now() + BenchBudget;
+		while (Clock::now() < deadline) {
+			ping->Send(1);
+			pong->Receive();
+			iterations++;
+		}
+		ping->Send(-1);
+		pong->Receive();
+		return iterations;
+		});
+	pinger->Await();
+	ponger->Await();
+	return MakeResult("channel_pingpong_single_threaded", pinger->GetReturnValue(), Clock::now() - start);
+}
+
+// Same exchange through ReceiveFor/SendFor with a timeout that never fires, the price of arming and
+// cancelling the timer on every park.
+static void TimedPonger(Coroutine::Channel<int>::Receiver* in, Coroutine::Channel<int>::Sender* out) {
+	while (true) {
+		int v = in->ReceiveFor(std::chrono::seconds(10)).value_or(-1);
+		out->SendFor(v, std::chrono::seconds(10));
+		if (v < 0) break;
+	}
+	delete in;
+	delete out;
+}
+
+static uint64_t TimedPinger(Coroutine::Channel<int>::Sender* out, Coroutine::Channel<int>::Receiver* in) {
+	uint64_t iterations = 0;
+	auto deadline = Clock::now() + BenchBudget;
+	while (Clock::now() < deadline) {
+		out->SendFor(1, std::chrono::seconds(10));
+		in->ReceiveFor(std::chrono::seconds(10));
+		iterations++;
+	}
+	out->Send(-1);
+	in->Receive();
+	delete out;
+	delete in;
+	return iterations;
+}
+
+static BenchResult BenchChannelPingPongTimeout() {
+	Coroutine::Channel<int> ping, pong;
+	auto start = Clock::now();
+	auto ponger = Coroutine::Run("TimedPonger", TimedPonger, ping.GetReceiver(), pong.GetSender());
+	auto pinger = Coroutine::Run("TimedPinger", TimedPinger, ping.GetSender(), pong.GetReceiver());
+	pinger->Await();
+	auto elapsed = Clock::now() - start;
+	ponger->Await();
+	return MakeResult("channel_pingpong_timeout", pinger->GetReturnValue(), elapsed);
+}
+
+template<typename C>
+static void BulkProducer(typename C::Sender* out) {
+	auto deadline = Clock::now() + BenchBudget;
+	while (Clock::now() < deadline) {
+		for (int i = 0; i < 64; i++)
+			out->Send(i);
+	}
+	out->Send(-1);
+	delete out;
+}
+
+template<typename C>
+static uint64_t BulkConsumer(typename C::Receiver* in) {
+	uint64_t received = 0;
+	while (in->Receive() >= 0)
+		received++;
+	delete in;
+	return received;
+}
+
+// Messages per second from one producer to one consumer, both running flat out.
+template<typename C>
+static BenchResult BenchChannelBulk(const char* name, C& chan) {
+	auto start = Clock::now();
+	auto consumer = Coroutine::Run("BulkConsumer", BulkConsumer<C>, chan.GetReceiver());
+	auto producer = Coroutine::Run("BulkProducer", BulkProducer<C>, chan.GetSender());
+	consumer->Await();
+	auto elapsed = Clock::now() - start;
+	producer->Await();
+	return MakeResult(name, consumer->GetReturnValue(), elapsed);
+}
+//--------------------------------------------------------
+
+//----------------------- Sleep jitter -----------------------
+static void SleepJitterLoop(LatencyHistogram* histogram, std::chrono::nanoseconds sleep) {
+	auto deadline = Clock::now() + BenchBudget;
+	while (Clock::now() < deadline) {
+		auto before = Clock::now();
+		Coroutine::Syscall::SleepFor(sleep);
+		auto late = Clock::now() - before - sleep;
+		histogram->Record(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(late).count()));
+	}
+}
+
+// Reports how late a sleep wakes up: the mean and tail of (actual - requested).
+static BenchResult BenchSleepJitter(const std::string& name, Coroutine::Runtime& runtime, std::chrono::nanoseconds sleep) {
+	auto histogram = std::make_unique<LatencyHistogram>();
+	Coroutine::Run(runtime, "SleepJitterLoop", SleepJitterLoop, histogram.get(), sleep)->Await();
+	HistogramSnapshot snapshot;
+	snapshot.Merge(*histogram);
+	BenchResult r;
+	r.name = name;
+	r.iterations = snapshot.total;
+	r.nsPerOp = snapshot.total == 0 ? 0 : static_cast<double>(snapshot.sum) / snapshot.total;
+	r.extra = {
+		{ "p50_us", snapshot.Percentile(0.5) / 1000.0 },
+		{ "p99_us", snapshot.Percentile(0.99) / 1000.0 },
+		{ "p999_us", snapshot.Percentile(0.999) / 1000.0 },
+	};
+	return r;
+}
+
+// Parked sleeps on the default runtime, then the same with the last 20us spun out.
+static void BenchSleepJitterSet(std::vector<BenchResult>& results) {
+	auto& runtime = Coroutine::Runtime::GetInstance();
+	results.push_back(BenchSleepJitter("sleep_10us_wake_error", runtime, std::chrono::microseconds(10)));
+	results.push_back(BenchSleepJitter("sleep_100us_wake_error", runtime, std::chrono::microseconds(100)));
+	results.push_back(BenchSleepJitter("sleep_1ms_wake_error", runtime, std::chrono::milliseconds(1)));
+	auto config = Coroutine::RuntimeConfig::FromEnvironment();
+	config.timerSpin = std::chrono::microseconds(20);
+	Coroutine::Runtime spinning(config);
+	results.push_back(BenchSleepJitter("sleep_10us_spin_wake_error", spinning, std::chrono::microseconds(10)));
+	results.push_back(BenchSleepJitter("sleep_100us_spin_wake_error", spinning, std::chrono::microseconds(100)));
+}
+//------------------------------------------------------------
+
+static std::vector<BenchResult> RunScalingSet() {
+	std::vector<BenchResult> results;
+	results.push_back(BenchSpawnJoin());
+	results.push_back(BenchSpawnManyJoin());
+	Coroutine::BufferedChannel<int> chan(1024);
+	results.push_back(BenchChannelBulk("channel_bulk_buffered", chan));
+	return results;
+}
+
+#if defined(__linux__)
+#include <unistd.h>
+
+// One iteration is one message to a child process and back over a pair of ShmChannels.
+static void ShmEchoChild(const std::string& prefix) {
+	Coroutine::Run("ShmEcho", [&prefix] {
+		Coroutine::ShmChannel<int64_t> ping(prefix + "_ping"), pong(prefix + "_pong");
+		while (true) {
+			int64_t v = ping.Receive();
+			pong.Send(v);
+			if (v < 0) break;
+		}
+		})->Await();
+}
+
+// A newline-delimited log of a million records, written on first use and removed by main.
+static const std::string& BenchLogFile() {
+	static const std::string path = [] {
+		std::string file = (std::filesystem::temp_directory_path() / std::format("CoroutineSchedulerBench_{}.log", getpid())).string();
+		std::ofstream out(file, std::ios::out | std::ios::trunc | std::ios::binary);
+		for (int i = 0; i < 1'000'000; i++)
+			out << std::format("2024-01-01T00:00:00.{:06}Z INFO request {} served in {}us\n", i, i * 7919LL % 100'003, i % 977);
+		return file;
+		}();
+	return path;
+}
+
+// One iteration is one record of the log, already in the page cache, read by a coroutine through
+// std::ifstream and std::getline, or through MappedFileReader without a copy.
+static BenchResult BenchFileRecords(const char* name, bool mapped) {
+	const std::string& path = BenchLogFile();
+	uint64_t records = 0, bytes = 0;
+	auto start = Clock::now();
+	auto deadline = start + BenchBudget;
+	Coroutine::Run("FileRecords", [&] {
+		while (Clock::now() < deadline) {
+			if (mapped) {
+				Coroutine::MappedFileReader reader(path);
+				for (std::string_view record : reader) {
+					bytes += record.size() + 1;
+					records++;
+				}
+			}
+			else {
+				std::ifstream in(path, std::ios::in | std::ios::binary);
+				std::string record;
+				while (std::getline(in, record)) {
+					bytes += record.size() + 1;
+					records++;
+				}
+			}
+		}
+		})->Await();
+	auto elapsed = Clock::now() - start;
+	BenchResult r = MakeResult(name, records, elapsed);
+	r.extra.emplace_back("mb_per_sec", bytes / 1e6 / std::chrono::duration<double>(elapsed).count());
+	return r;
+}
+
+static BenchResult BenchShmPingPong() {
+	char self[4096] = {};
+	if (readlink("/proc/self/exe", self, sizeof(self) - 1) <= 0)
+		return MakeResult("shm_channel_pingpong", 0, Clock::duration(1));
+	std::string prefix = std::format("CoroutineSchedulerBench_{}", getpid());
+	Coroutine::ShmChannel<int64_t>::Unlink(prefix + "_ping");
+	Coroutine::ShmChannel<int64_t>::Unlink(prefix + "_pong");
+	auto ping = std::make_unique<Coroutine::ShmChannel<int64_t>>(prefix + "_ping", 64);
+	auto pong = std::make_unique<Coroutine::ShmChannel<int64_t>>(prefix + "_pong", 64);
+	FILE* child = popen(std::format("'{}' --shm-echo-child {}", self, prefix).c_str(), "r");
+	if (child == nullptr) {
+		// nobody would ever echo, the pinger would park for good
+		Coroutine::ShmChannel<int64_t>::Unlink(prefix + "_ping");
+		Coroutine::ShmChannel<int64_t>::Unlink(prefix + "_pong");
+		return MakeResult("shm_channel_pingpong", 0, Clock::duration(1));
+	}
+	uint64_t iterations = 0;
+	auto start = Clock::now();
+	auto res = Coroutine::Run("ShmPinger", [&] {
+		auto deadline = Clock::now() + BenchBudget;
+		while (Clock::now() < deadline) {
+			ping->Send(static_cast<int64_t>(iterations));
+			pong->Receive();
+			iterations++;
+		}
+		ping->Send(-1);
+		pong->Receive();
+		});
+	res->Await();
+	auto elapsed = Clock::now() - start;
+	pclose(child);
+	Coroutine::ShmChannel<int64_t>::Unlink(prefix + "_ping");
+	Coroutine::ShmChannel<int64_t>::Unlink(prefix + "_pong");
+	return MakeResult("shm_channel_pingpong", iterations, elapsed);
+}
+
+// The worker count is read from COMAXPROCS when the runtime starts, so each point of the
+// scaling curve runs in a child process of this binary.
+static std::string RunScaling() {
+	unsigned int maxProcs = std::max(1u, std::thread::hardware_concurrency());
+	char self[4096] = {};
+	if (readlink("/proc/self/exe", self, sizeof(self) - 1) <= 0)
+		return "[]";
+	std::string json = "[";
+	for (unsigned int procs = 1; ; procs = std::min(procs * 2, maxProcs)) {
+		std::string cmd = std::format("COMAXPROCS={} '{}' --scaling-child", procs, self);
+		FILE* child = popen(cmd.c_str(), "r");
+		if (child == nullptr) break;
+		std::string output;
+		char buf[512];
+		while (fgets(buf, sizeof(buf), child) != nullptr) output += buf;
+		pclose(child);
+		while (!output.empty() && (output.back() == '\n' || output.back() == ',')) output.pop_back();
+		json += std::format(R"({}{{"procs":{},"results":[{}]}})", json.size() > 1 ? "," : "", procs, output);
+		if (procs == maxProcs) break;
+	}
+	return json + "]";
+}
+#endif
+
+int main(int argc, char** argv) {
+	std::string outPath;
+	bool scaling = true;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--scaling-child") == 0) {
+			for (auto& r : RunScalingSet())
+				std::cout << r.ToJson() << ",\n";
+			return 0;
+		}
+#if defined(__linux__)
+		else if (std::strcmp(argv[i], "--shm-echo-child") == 0 && i + 1 < argc) {
+			ShmEchoChild(argv[i + 1]);
+			return 0;
+		}
+#endif
+		else if (std::strcmp(argv[i], "--no-scaling") == 0) scaling = false;
+		else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) outPath = argv[++i];
+		else {
+			std::cerr << "usage: CoroutineSchedulerBench [--out <file>] [--no-scaling]\n";
+			return 1;
+		}
+	}
+
+	std::vector<BenchResult> results;
+	results.push_back(BenchFiberSwitch());
+	results.push_back(BenchYield());
+	results.push_back(BenchYieldMany("yield_1k_heap_stacks", 1'000, false));
+	results.push_back(BenchYieldMany("yield_1k_stack_arena", 1'000, true));
+	results.push_back(BenchYieldMany("yield_10k_heap_stacks", 10'000, false));
+	results.push_back(BenchYieldMany("yield_10k_stack_arena", 10'000, true));
+	results.push_back(BenchYieldMany("yield_100k_heap_stacks", 100'000, false));
+	results.push_back(BenchYieldMany("yield_100k_stack_arena", 100'000, true));
+	results.push_back(BenchGenerator());
+	results.push_back(BenchPipeline());
+	results.push_back(BenchSpawnJoin());
+	results.push_back(BenchSpawnManyJoin());
+	results.push_back(BenchSpawnAwait());
+	results.push_back(BenchAlloc("alloc_64b_heap", false));
+	results.push_back(BenchAlloc("alloc_64b_arena", true));
+	results.push_back(BenchActorActivate());
+	results.push_back(BenchChannelPingPong());
+	results.push_back(BenchLocalChannelPingPong());
+	results.push_back(BenchChannelPingPongTimeout());
+	{
+		Coroutine::Channel<int> unbuffered;
+		results.push_back(BenchChannelBulk("channel_bulk_unbuffered", unbuffered));
+		Coroutine::BufferedChannel<int> buffered(1024);
+		results.push_back(BenchChannelBulk("channel_bulk_buffered", buffered));
+	}
+#if defined(__linux__)
+	results.push_back(BenchShmPingPong());
+	results.push_back(BenchFileRecords("file_records_ifstream", false));
+	results.push_back(BenchFileRecords("file_records_mapped", true));
+	std::filesystem::remove(BenchLogFile());
+#endif
+	BenchSleepJitterSet(results);
+
+	std::string json = std::format(R"({{"suite":"CoroutineSchedulerBench","hardware_concurrency":{},"baseline":"Blog_Codes/measuring_iterations_per_sec_go.go","results":[)",
+		std::thread::hardware_concurrency());
+	for (size_t i = 0; i < results.size(); i++)
+		json += (i == 0 ? "\n  " : ",\n  ") + results[i].ToJson();
+	json += "\n]";
+#if defined(__linux__)
+	if (scaling)
+		json += ",\n\"scaling\":" + RunScaling();
+#endif
+	json += "}\n";
+
+	if (outPath.empty()) std::cout << json;
+	else {
+		std::ofstream out(outPath, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) {
+			std::cerr << std::format("Failed to open {}\n", outPath);
+			return 1;
+		}
+		out << json;
+	}
+	return 0;
+}
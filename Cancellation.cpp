@@ -0,0 +1,26 @@
+#include "CoroutineScheduler.hpp"
+#include "Cancellation.hpp"
+
+namespace CoroutineScheduler
+{
+	//----------------------- CancellationState -----------------------
+	void CancellationState::Cancel() {
+		if (this->cancelled.exchange(true, std::memory_order_acq_rel))
+			return;
+		// tasks unregister under the same lock before they are deleted, so every one here is still alive
+		std::lock_guard lock(this->mtx);
+		for (ITask* task : this->tasks)
+			Runtime::Wake(task);
+	}
+
+	void CancellationState::Register(ITask* task) {
+		std::lock_guard lock(this->mtx);
+		this->tasks.insert(task);
+	}
+
+	void CancellationState::Unregister(ITask* task) {
+		std::lock_guard lock(this->mtx);
+		this->tasks.erase(task);
+	}
+	//-----------------------------------------------------------------
+}
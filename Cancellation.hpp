@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace CoroutineScheduler
+{
+	class ITask;
+
+	// Thrown out of a blocking operation (channel, sleep, await, yield) when the calling task was cancelled.
+	// Task::Execute catches it, so a cancelled task simply completes early.
+	class CancelledError : public std::runtime_error {
+	public:
+		CancelledError() : std::runtime_error("coroutine cancelled") {}
+	};
+
+	// Shared by every task spawned with the same cancellation token. Cancel wakes the ones that are
+	// parked, each then unlinks itself from whatever it was waiting on and throws CancelledError.
+	class CancellationState {
+		std::atomic<bool> cancelled{ false };
+		std::mutex mtx;
+		std::unordered_set<ITask*> tasks;
+	public:
+		bool IsCancelled() const { return this->cancelled.load(std::memory_order_acquire); }
+		void Cancel();
+		void Register(ITask* task);
+		void Unregister(ITask* task);
+	};
+}
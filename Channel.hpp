@@ -1,11 +1,16 @@
-#include <queue>
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
 #include <mutex>
 #include <condition_variable>
+#include <stdexcept>
+#include <type_traits>
 
 #include "Task.hpp"
-
-#define SIMPLE_CHANNEL_COMPLEX
-// #define SIMPLE_CHANNEL_SIMPLE
+#include "RingQueue.hpp"
+#include "CoroutineScheduler.hpp"
 
 namespace CoroutineScheduler
 {
@@ -13,165 +18,160 @@ namespace Channel
 {
 	constexpr std::chrono::milliseconds ChannelStdWait = std::chrono::milliseconds(500);
 
-#ifdef SIMPLE_CHANNEL_COMPLEX
+	// Lock policy for a channel whose every user runs on the one Proc of a single-threaded runtime
+	// (RuntimeConfig::singleThreaded): nothing else can interleave, so there is nothing to lock.
+	// Threads outside the runtime cannot block on such a channel.
+	struct NoLock {
+		void lock() {}
+		void unlock() {}
+		bool try_lock() { return true; }
+	};
 
-	template<typename T>
+	// Lock-and-park channel: a task that cannot proceed queues itself and parks, the other side wakes it.
+	// Threads outside the runtime block on a condition variable instead. The buffer starts small and
+	// doubles up to the capacity, from then on sending and receiving never allocate; T only has to be
+	// move constructible. 'Lock' is std::mutex, or NoLock for channels local to a single-threaded runtime.
+	template<typename T, typename Lock = std::mutex>
 	class SimpleChannel {
-		std::queue<T> _value;
+		RingQueue<T> _value;
 		unsigned int size;
-		std::queue<ITask*> senderPreemptedTask, receiverPreemptedTask;
-
-		bool receiverNotified = false;
-		std::mutex value_mtx, receiver_mtx;
-		std::condition_variable value_cv, receiver_cv;
-	public:
-
-		SimpleChannel() : size(1) {}
-		SimpleChannel(unsigned int sz) : size(sz) {}
-
-		void Send(T value) {
-			auto& runtime = Runtime::GetInstance();
-			while (true) {
-				std::unique_lock lock(this->value_mtx);
-				if (this->value_cv.wait_for(lock, ChannelStdWait, [this] { return this->_value.size() < this->size; })) {
-					this->_value.push(value);
-					break;
-				}
-				else {
-					this->senderPreemptedTask.push(runtime.GetCurrentContextTask());
-					lock.unlock();
-					this->notifyReceiver();
-					runtime.PreemptCurrentTask();
-				}
-			}
-			this->notifyReceiver();
+		WaitQueue senderWaitQueue;
+		WaitQueue receiverWaitQueue;
+		unsigned int externalWaiters = 0;
+		std::condition_variable externalCv;
+		Lock mtx; // Single mutex for state protection
+
+		// slots reserved up front, a large capacity is only allocated once the channel fills that far
+		static constexpr unsigned int InitialBuffer = 64;
+
+		// Called with mtx held.
+		void WakeOne(WaitQueue& waitQueue) {
+			if (ITask* t = waitQueue.PopFront())
+				Runtime::Wake(t);
+			if (this->externalWaiters != 0)
+				this->externalCv.notify_all();
 		}
 
-		T Receive() {
-			auto& runtime = Runtime::GetInstance();
-			while (true) {
-				bool preempt = false;
-				{
-					std::unique_lock lock(this->receiver_mtx);
-					preempt = !this->receiver_cv.wait_for(lock, ChannelStdWait, [this] { return this->receiverNotified; });
-					if (preempt) this->receiverPreemptedTask.push(runtime.GetCurrentContextTask());
-				}
-				if (preempt) runtime.PreemptCurrentTask();
-				{
-					std::lock_guard lock1(this->value_mtx);
-					if (this->_value.empty()) {
-						std::lock_guard lock2(this->receiver_mtx);
-						this->receiverNotified = false;
-						this->notifySender();
-						continue;
-					}
-					if (!this->_value.empty()) {
-						T value = this->_value.front();
-						this->_value.pop();
-						this->notifyReceiver();
-						return value;
-					}
+		// Parks the caller until the other side makes progress. Every return re-checks the condition, a
+		// wake can be spurious. A cancelled task unlinks itself and, if it had already been picked, passes
+		// the wake on so the slot or value it was woken for is not lost. Returns false once deadlineNs
+		// (0 for none) has passed; the caller checks its condition one last time before giving up.
+		bool Wait(std::unique_lock<Lock>& lock, WaitQueue& waitQueue, uint64_t deadlineNs = 0) {
+			auto& runtime = Runtime::Current();
+			ITask* current = runtime.GetCurrentContextTask();
+			if (current == nullptr) {
+				if constexpr (std::is_same_v<Lock, std::mutex>) {
+					this->externalWaiters++;
+					bool notified = true;
+					if (deadlineNs == 0) this->externalCv.wait(lock);
+					else notified = this->externalCv.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadlineNs))) == std::cv_status::no_timeout;
+					this->externalWaiters--;
+					return notified;
 				}
+				else throw std::logic_error("only coroutines can block on a channel without a lock");
 			}
-		}
-
-		void notifySender() {
-			//std::lock_guard lock(this->value_mtx); // **Note:** already locked in receiver
-			this->value_cv.notify_one();
-			if (!this->senderPreemptedTask.empty()) {
-				auto senderTask = this->senderPreemptedTask.front();
-				this->senderPreemptedTask.pop();
-				Runtime::GetInstance().AddTask(senderTask);
-			}
-		}
-
-		void notifyReceiver() {
-			std::lock_guard lock(this->receiver_mtx);
-			this->receiverNotified = true;
-			this->receiver_cv.notify_one();
-			if (!this->receiverPreemptedTask.empty()) {
-				auto receiverTask = this->receiverPreemptedTask.front();
-				this->receiverPreemptedTask.pop();
-				Runtime::GetInstance().AddTask(receiverTask);
+			if (current->IsCancelled())
+				throw CancelledError();
+			if (deadlineNs != 0 && Stats::NowNs() >= deadlineNs)
+				return false;
+			waitQueue.PushBack(current);
+			lock.unlock();
+			// the task's own timer entry, armed per wait and cancelled on every wake-up
+			if (deadlineNs != 0) runtime.GetSleepSyscall().ScheduleWake(current, deadlineNs);
+			runtime.PreemptCurrentTask(ParkReason::ParkChannel);
+			bool timedOut = deadlineNs != 0 && !runtime.GetSleepSyscall().Cancel(current->timer);
+			lock.lock();
+			bool picked = !waitQueue.Remove(current);
+			if (current->IsCancelled()) {
+				if (picked) WakeOne(waitQueue);
+				throw CancelledError();
 			}
+			return !timedOut;
 		}
-	};
-#elif defined(SIMPLE_CHANNEL_SIMPLE)
-	template<typename T>
-	class SimpleChannel {
-		std::queue<T> _value;
-		unsigned int size;
-		std::queue<ITask*> senderWaitQueue;
-		std::queue<ITask*> receiverWaitQueue;
-		std::mutex mtx; // Single mutex for state protection
 
 	public:
-		SimpleChannel() : size(1) {}
-		SimpleChannel(unsigned int sz) : size(sz) {}
+		SimpleChannel() : _value(1), size(1) {}
+		SimpleChannel(unsigned int sz) : _value(std::clamp(sz, 1u, InitialBuffer)), size(sz) {}
 
 		void Send(T value) {
-			auto& runtime = Runtime::GetInstance();
-
-			while (true) {
-				std::unique_lock lock(this->mtx);
-
-				// 1. Check Condition
-				if (this->_value.size() < this->size) {
-					// Success path
-					this->_value.push(value);
-
-					// Wake up a blocked receiver if any
-					if (!this->receiverWaitQueue.empty()) {
-						auto t = this->receiverWaitQueue.front();
-						this->receiverWaitQueue.pop();
-						runtime.AddTask(t);
-					}
-					return; // Lock releases here
-				}
+			Send(std::move(value), [](T&) {});
+		}
 
-				// 2. Fail path: Must Wait
-				ITask* current = runtime.GetCurrentContextTask();
-				this->senderWaitQueue.push(current);
+		// Calls stamp(value) under the channel's lock just before queueing the value, so that whatever
+		// it numbers follows the queue order even with several senders.
+		template<typename Stamp>
+		void Send(T value, Stamp&& stamp) {
+			std::unique_lock lock(this->mtx);
+			while (this->_value.Size() >= this->size)
+				Wait(lock, this->senderWaitQueue);
+			stamp(value);
+			this->_value.PushBack(std::move(value));
+			WakeOne(this->receiverWaitQueue);
+		}
 
-				// CRITICAL: We must ensure we don't race with the waker.
-				// Ideally, 'PreemptCurrentTask' should handle the unlocking to be atomic, 
-				// but assuming standard implementation, we unlock then yield.
-				lock.unlock();
+		// false, dropping the value, when the channel stayed full until the deadline
+		bool SendUntil(T value, std::chrono::steady_clock::time_point deadline) {
+			uint64_t deadlineNs = Stats::ToNs(deadline);
+			std::unique_lock lock(this->mtx);
+			while (this->_value.Size() >= this->size) {
+				if (!Wait(lock, this->senderWaitQueue, deadlineNs) && this->_value.Size() >= this->size)
+					return false;
+			}
+			this->_value.PushBack(std::move(value));
+			WakeOne(this->receiverWaitQueue);
+			return true;
+		}
 
-				// 3. Suspend (Yield)
-				// Do NOT sleep/wait. Yield control to the scheduler immediately.
-				runtime.PreemptCurrentTask();
+		// Never blocks, so it is safe from timer callbacks. false, dropping the value, when the channel is full.
+		bool TrySend(T value) {
+			std::lock_guard lock(this->mtx);
+			if (this->_value.Size() >= this->size)
+				return false;
+			this->_value.PushBack(std::move(value));
+			WakeOne(this->receiverWaitQueue);
+			return true;
+		}
 
-				// Loop restarts when we are woken up
-			}
+		template<typename Rep, typename Period>
+		bool SendFor(T value, std::chrono::duration<Rep, Period> timeout) {
+			return SendUntil(std::move(value), std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
 		}
 
 		T Receive() {
-			auto& runtime = Runtime::GetInstance();
-
-			while (true) {
-				std::unique_lock lock(this->mtx);
-
-				if (!this->_value.empty()) {
-					T val = this->_value.front();
-					this->_value.pop();
-
-					// Wake up a blocked sender if any
-					if (!this->senderWaitQueue.empty()) {
-						auto t = this->senderWaitQueue.front();
-						this->senderWaitQueue.pop();
-						runtime.AddTask(t);
-					}
-					return val;
-				}
+			std::unique_lock lock(this->mtx);
+			while (this->_value.Empty())
+				Wait(lock, this->receiverWaitQueue);
+			T val = this->_value.PopFront();
+			WakeOne(this->senderWaitQueue);
+			return val;
+		}
 
-				// Queue empty, we must wait
-				this->receiverWaitQueue.push(runtime.GetCurrentContextTask());
-				lock.unlock();
-				runtime.PreemptCurrentTask();
+		// nullopt when nothing arrived before the deadline
+		std::optional<T> ReceiveUntil(std::chrono::steady_clock::time_point deadline) {
+			uint64_t deadlineNs = Stats::ToNs(deadline);
+			std::unique_lock lock(this->mtx);
+			while (this->_value.Empty()) {
+				if (!Wait(lock, this->receiverWaitQueue, deadlineNs) && this->_value.Empty())
+					return std::nullopt;
 			}
+			std::optional<T> val(this->_value.PopFront());
+			WakeOne(this->senderWaitQueue);
+			return val;
+		}
+
+		std::optional<T> TryReceive() {
+			std::lock_guard lock(this->mtx);
+			if (this->_value.Empty())
+				return std::nullopt;
+			std::optional<T> val(this->_value.PopFront());
+			WakeOne(this->senderWaitQueue);
+			return val;
+		}
+
+		template<typename Rep, typename Period>
+		std::optional<T> ReceiveFor(std::chrono::duration<Rep, Period> timeout) {
+			return ReceiveUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
 		}
 	};
-#endif
 }
 }
\ No newline at end of file
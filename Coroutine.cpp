@@ -43,9 +43,10 @@ void CoMain(Coroutine::Channel<int>::Sender* sender, Coroutine::Channel<bool>::R
 }
 
 void PrintLoop() {
+	Coroutine::Ticker ticker(std::chrono::milliseconds(700));
 	for (int i = 0; i < 20; i++) {
 		std::cout << std::format("PrintLoop iteration {}\n", i);
-		Coroutine::Syscall::Sleep(700);
+		ticker.Wait();
 	}
 }
 
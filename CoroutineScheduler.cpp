@@ -1,58 +1,107 @@
+#include <cassert>
 #include <charconv>
 #include <format>
 #include <sstream>
 #include <unordered_set>
 #include <cstring>
 #include "CoroutineScheduler.hpp"
+#include "Trace.hpp"
+#include "Topology.hpp"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__linux__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <sys/prctl.h>
+#endif
 
 using namespace CoroutineScheduler;
 
-std::unique_ptr<Runtime> Runtime::instance = std::make_unique<Runtime>();
 thread_local CoroutineContext* const coroutineContext = new CoroutineContext();
 
-Runtime::Runtime() {
-	this->threadCount = std::thread::hardware_concurrency();
+static CoroutineContext* CurrentContext();
+static void RunInline(ITask& task, ITask& host) noexcept;
+
+RuntimeConfig CoroutineScheduler::RuntimeConfig::FromEnvironment() {
+	RuntimeConfig config;
 	const char* env = std::getenv("COMAXPROCS");
 	if (env != nullptr) {
-		auto [ptr, ec] = std::from_chars(env, env + std::strlen(env), this->threadCount);
+		auto [ptr, ec] = std::from_chars(env, env + std::strlen(env), config.workers);
 		if (ec != std::errc{}) {
 			throw std::runtime_error("Failed to parse COMAXPROCS environment variable");
 		}
 	}
+	return config;
+}
+
+Runtime::Runtime(const RuntimeConfig& config)
+	: config(config), id(nextRuntimeId.fetch_add(1, std::memory_order_relaxed)) {
+	this->groups.push_back(std::make_unique<TaskGroup>("default", TaskGroupConfig{}, this->id, config.runQueueCapacity, config.priorityWeights));
+	this->defaultGroup = this->groups.back().get();
+	if (config.singleThreaded) this->threadCount = 1;
+	else this->threadCount = config.workers != 0 ? config.workers : std::max(1u, std::thread::hardware_concurrency());
+	if (config.pinWorkers)
+		this->placement = Topology::CpuTopology::Get().PlaceWorkers(this->threadCount, config.cpus);
+	this->maxSpinning = config.maxSpinningProcs != 0 ? config.maxSpinningProcs : std::max(1u, this->threadCount / 2);
 	this->workerThreads.reserve(this->threadCount);
-	auto proc = std::make_unique<Proc>();
-	this->workerThreads.emplace_back(
-		std::make_pair(
-			std::move(std::thread(&Proc::ThreadMainLoop, proc.get())),
-			std::move(proc)
-		)
-	);
+	this->sleepSyscall = std::make_unique<Syscall::Sleep>(*this, config.timerResolution, config.timerQueueCapacity);
 }
 
-Runtime::~Runtime() {
-	for (auto& t : this->workerThreads) {
-		t.second->ForceExitProc();
+// Victims are ordered SMT sibling, shared last level cache, same NUMA node, then remote, and
+// by distance in the Proc ring within each class so that Procs don't all pick the same victim first.
+std::unique_ptr<Proc> CoroutineScheduler::Runtime::MakeProc(unsigned int procId) {
+	auto& topology = Topology::CpuTopology::Get();
+	int cpu = procId < this->placement.size() ? this->placement[procId] : -1;
+	const Topology::Cpu* info = topology.Find(cpu);
+	std::vector<unsigned int> stealOrder;
+	for (unsigned int i = 1; i < this->threadCount; i++)
+		stealOrder.push_back((procId + i) % this->threadCount);
+	if (cpu >= 0) {
+		std::stable_sort(stealOrder.begin(), stealOrder.end(), [&](unsigned int a, unsigned int b) {
+			return topology.DistanceBetween(cpu, this->placement[a]) < topology.DistanceBetween(cpu, this->placement[b]);
+			});
 	}
+	return std::make_unique<Proc>(procId, this, this->config, cpu, info != nullptr ? info->node : -1, std::move(stealOrder));
+}
+
+Runtime::~Runtime() {
 	{
 		std::lock_guard lock(this->queueMutex);
-		for (int i = 0; i < this->workerThreads.size(); i++) {
-			this->globalQueue.push_back(nullptr);
-		}
+		this->exiting = true;
 	}
-	for (auto& t : this->workerThreads) {
-		cv.notify_one();
+	cv.notify_all();
+	this->timerCv.notify_all();
+	{
+		std::lock_guard lock(this->workersMutex);
+		for (auto& t : this->workerThreads) {
+			t.second->ForceExitProc();
+		}
 	}
+	// StartWorker no longer touches workerThreads once exiting is set, and a Proc may still need
+	// workersMutex on its way out, so join without holding it
 	for (auto& t : this->workerThreads) {
-		t.first.join();
+		if (t.first.joinable()) t.first.join();
 	}
 }
 
-void CoroutineScheduler::Runtime::EnsureThreadCount()
+// Starts a Proc thread when there are fewer than the configured count, restarting a retired Proc
+// before adding a new one so its counters and steal order carry over.
+void CoroutineScheduler::Runtime::StartWorker()
 {
-	std::lock_guard lock(this->queueMutex);
-	if (this->workerThreads.size() >= this->threadCount)
+	std::lock_guard lock(this->workersMutex);
+	if (this->exiting || this->liveWorkers.load() >= this->threadCount)
 		return;
-	auto proc = std::make_unique<Proc>();
+	for (auto& t : this->workerThreads) {
+		if (!t.second->retired) continue;
+		t.first.join();
+		t.second->retired = false;
+		this->liveWorkers.fetch_add(1);
+		t.first = std::thread(&Proc::ThreadMainLoop, t.second.get());
+		return;
+	}
+	auto proc = MakeProc(static_cast<unsigned int>(this->workerThreads.size()));
+	this->liveWorkers.fetch_add(1);
 	this->workerThreads.emplace_back(
 		std::make_pair(
 			std::move(std::thread(&Proc::ThreadMainLoop, proc.get())),
@@ -61,28 +110,446 @@ void CoroutineScheduler::Runtime::EnsureThreadCount()
 	);
 }
 
+bool CoroutineScheduler::Runtime::TryRetire(Proc& proc)
+{
+	std::lock_guard lock(this->workersMutex);
+	// checked under workersMutex, an Enqueue that raced past the idle wait either sees this Proc
+	// retired in StartWorker or is seen here
+	if (this->exiting || this->liveWorkers.load() <= 1 || this->queuedTasks.load() != 0)
+		return false;
+	this->liveWorkers.fetch_sub(1);
+	proc.retired = true;
+	return true;
+}
+
 void CoroutineScheduler::Runtime::AddTask(ITask* const task) {
-	if (task == nullptr || task->state == TaskState::TaskRunning)
+	if (task == nullptr)
+		return;
+	else if (task->state != TaskState::TaskNotStarted) {
+		ResumeTask(task);
+		return;
+	}
+	task->runtime = this;
+	if (task->group == nullptr) task->group = this->defaultGroup;
+	if (task->cancellation != nullptr) task->cancellation->Register(task);
+	this->registry.Add(task);
+	CurrentCounters().spawned.fetch_add(1, std::memory_order_relaxed);
+	Trace::Record(Trace::EventType::EventSpawn, task, coroutineContext->task != nullptr ? coroutineContext->task->id : 0);
+	Enqueue(task);
+}
+
+void CoroutineScheduler::Runtime::AddTasks(ITask* const* tasks, size_t count) {
+	if (count == 0)
+		return;
+	uint64_t spawner = coroutineContext->task != nullptr ? coroutineContext->task->id : 0;
+	for (size_t i = 0; i < count; i++) {
+		ITask* task = tasks[i];
+		task->runtime = this;
+		if (task->group == nullptr) task->group = this->defaultGroup;
+		if (task->cancellation != nullptr) task->cancellation->Register(task);
+		Trace::Record(Trace::EventType::EventSpawn, task, spawner);
+	}
+	this->registry.Add(tasks, count);
+	CurrentCounters().spawned.fetch_add(count, std::memory_order_relaxed);
+
+	uint64_t now = Stats::NowNs();
+	if (this->config.singleThreaded) {
+		for (size_t i = 0; i < count; i++)
+			tasks[i]->enqueuedAt = now;
+		EnqueueSingleThreaded(tasks, count);
+		return;
+	}
+	unsigned int notify = 0;
+	bool notifyWatcher = false;
+	unsigned int start = 0;
+	{
+		std::lock_guard lock(this->queueMutex);
+		for (size_t i = 0; i < count; i++) {
+			tasks[i]->enqueuedAt = now;
+			this->globalQueue.PushBack(tasks[i]);
+		}
+		this->queuedTasks.fetch_add(count);
+		// spinning Procs pick up their share without being woken
+		size_t wanted = std::min<size_t>(count, this->threadCount);
+		size_t spinning = this->spinningProcs.load();
+		wanted = wanted > spinning ? wanted - spinning : 0;
+		for (; wanted != 0 && this->idleProcs > this->pendingWakeups; wanted--, notify++)
+			this->pendingWakeups++;
+		if (wanted != 0 && this->timerWatcher && !this->timerWatcherNotified) {
+			this->timerWatcherNotified = true;
+			notifyWatcher = true;
+			wanted--;
+		}
+		if (this->idleProcs == 0) start = static_cast<unsigned int>(wanted);
+	}
+	CurrentCounters().procWakeups.fetch_add(notify + (notifyWatcher ? 1 : 0), std::memory_order_relaxed);
+	for (unsigned int i = 0; i < notify; i++)
+		this->cv.notify_one();
+	if (notifyWatcher) this->timerCv.notify_one();
+	for (unsigned int i = 0; i < start; i++)
+		StartWorker();
+}
+
+void CoroutineScheduler::Runtime::ResumeTask(ITask* const task) {
+	Trace::Record(Trace::EventType::EventRunnable, task, coroutineContext->task != nullptr ? coroutineContext->task->id : 0);
+	if (MarkRunnable(task))
+		Enqueue(task);
+}
+
+void CoroutineScheduler::Runtime::Enqueue(ITask* const task) {
+	task->enqueuedAt = Stats::NowNs();
+	if (this->config.singleThreaded) {
+		EnqueueSingleThreaded(&task, 1);
+		return;
+	}
+	WakeAction wake;
+	{
+		std::lock_guard lock(this->queueMutex);
+		this->globalQueue.PushBack(task);
+		this->queuedTasks.fetch_add(1);
+		wake = ClaimIdleProcLocked();
+	}
+	ApplyWake(wake);
+}
+
+// The only Proc owns globalQueue outright: its own spawns, wake-ups and yields are queued without a
+// lock. Other threads append to the inbox, which the Proc drains between tasks, and wake it if asleep.
+void CoroutineScheduler::Runtime::EnqueueSingleThreaded(ITask* const* tasks, size_t count) {
+	this->queuedTasks.fetch_add(count, std::memory_order_relaxed);
+	if (coroutineContext->currentProc != nullptr && coroutineContext->currentProc->runtime == this) {
+		for (size_t i = 0; i < count; i++)
+			this->globalQueue.PushBack(tasks[i]);
+		return;
+	}
+	bool notify, start;
+	{
+		std::lock_guard lock(this->queueMutex);
+		this->inbox.insert(this->inbox.end(), tasks, tasks + count);
+		this->inboxed.store(this->inbox.size(), std::memory_order_release);
+		notify = this->idleProcs > this->pendingWakeups;
+		if (notify) this->pendingWakeups++;
+		start = this->liveWorkers.load() == 0;
+	}
+	if (notify) {
+		CurrentCounters().procWakeups.fetch_add(1, std::memory_order_relaxed);
+		this->cv.notify_one();
+	}
+	else if (start) StartWorker();
+}
+
+// Decides, under queueMutex, whether queued work needs another Proc. A spinning Proc will find it on its
+// own, and an idle Proc that was already notified is not notified again, so a burst of Enqueues costs at
+// most one wake-up per sleeping Proc.
+CoroutineScheduler::Runtime::WakeAction CoroutineScheduler::Runtime::ClaimIdleProcLocked() {
+	if (this->spinningProcs.load() != 0)
+		return WakeAction::WakeNone;
+	if (this->idleProcs > this->pendingWakeups) {
+		this->pendingWakeups++;
+		return WakeAction::WakeNotify;
+	}
+	if (this->timerWatcher) {
+		if (this->timerWatcherNotified) return WakeAction::WakeNone;
+		this->timerWatcherNotified = true;
+		return WakeAction::WakeTimerWatcher;
+	}
+	// with every Proc already running there is no one to start, the task waits for the next free one
+	return this->idleProcs == 0 && this->liveWorkers.load() < this->threadCount ? WakeAction::WakeStartWorker : WakeAction::WakeNone;
+}
+
+void CoroutineScheduler::Runtime::ApplyWake(WakeAction action) {
+	if (action == WakeAction::WakeNotify) {
+		CurrentCounters().procWakeups.fetch_add(1, std::memory_order_relaxed);
+		this->cv.notify_one();
+	}
+	else if (action == WakeAction::WakeTimerWatcher) {
+		CurrentCounters().procWakeups.fetch_add(1, std::memory_order_relaxed);
+		this->timerCv.notify_one();
+	}
+	else if (action == WakeAction::WakeStartWorker)
+		StartWorker();
+}
+
+// Only the watcher waits for timers. It is woken early when the new timer is due before the one it
+// waits for; without a watcher an idle Proc is claimed to become one, and busy Procs check between tasks.
+void CoroutineScheduler::Runtime::TimerScheduled(uint64_t wakeAtNs) {
+	if (this->config.singleThreaded) {
+		// the Proc looks at the timers before it sleeps, so only another thread can catch it asleep
+		if (coroutineContext->currentProc != nullptr && coroutineContext->currentProc->runtime == this)
+			return;
+		bool notify = false, start = false;
+		{
+			std::lock_guard lock(this->queueMutex);
+			if (this->exiting)
+				return;
+			if (this->idleProcs != 0 && wakeAtNs < this->timerWatchUntil) {
+				this->timerWatchUntil = wakeAtNs;
+				notify = true;
+			}
+			start = this->liveWorkers.load() == 0;
+		}
+		if (notify) this->cv.notify_one();
+		else if (start) StartWorker();
 		return;
-	else if (task->state == TaskState::TaskNotStarted)
-		EnsureThreadCount();
-	else if (task->state == TaskState::TaskPaused)
-		task->state = TaskState::TaskRunning;
+	}
+	WakeAction wake = WakeAction::WakeNone;
+	{
+		std::lock_guard lock(this->queueMutex);
+		if (this->exiting)
+			return;
+		if (this->timerWatcher) {
+			if (wakeAtNs < this->timerWatchUntil) {
+				this->timerWatchUntil = wakeAtNs;
+				wake = WakeAction::WakeTimerWatcher;
+			}
+		}
+		else wake = ClaimIdleProcLocked();
+	}
+	if (wake == WakeAction::WakeTimerWatcher) this->timerCv.notify_one();
+	else ApplyWake(wake);
+}
 
+void CoroutineScheduler::Runtime::ChargeSlice(ITask* const task, uint64_t sliceNs, uint64_t now) {
+	task->cpuTime += sliceNs;
+	// the quota state is read by whoever pops the queue, only the Proc itself in single-threaded mode
+	if (task->group->HasQuota() && !this->config.singleThreaded) {
+		std::lock_guard lock(this->queueMutex);
+		this->globalQueue.Charge(task->group, sliceNs, now);
+	}
+	else this->globalQueue.Charge(task->group, sliceNs, now);
+}
+
+TaskGroup& CoroutineScheduler::Runtime::CreateTaskGroup(std::string name, const TaskGroupConfig& config) {
 	std::lock_guard lock(this->queueMutex);
-	this->globalQueue.emplace_back(task);
-	cv.notify_one();
+	this->groups.push_back(std::make_unique<TaskGroup>(std::move(name), config, this->id, 16, this->config.priorityWeights));
+	return *this->groups.back();
 }
 
-ITask* CoroutineScheduler::Runtime::FetchTaskFromGlobalQueue()
+// A waker can find a task in a wait queue before the task has actually left its fiber. Such a
+// task only gets a pending wake, which its next park (or its Proc, once the switch is done) consumes.
+// Returns true when the task was parked and the caller must get it running again.
+bool CoroutineScheduler::Runtime::MarkRunnable(ITask* const task) {
+	std::lock_guard lock(task->parkMtx);
+	// a compare-exchange, DumpCoroutines claims parked tasks without the lock
+	TaskState paused = TaskState::TaskPaused;
+	if (task->state.compare_exchange_strong(paused, TaskState::TaskRunning, std::memory_order_acq_rel))
+		return true;
+	switch (paused) {
+	case TaskState::TaskRunning:
+	case TaskState::TaskParking:
+	case TaskState::TaskDumping:
+		task->wakePending = true;
+		return false;
+	default:
+		return false;
+	}
+}
+
+void CoroutineScheduler::Runtime::ParkCurrentTask(ParkReason reason) {
+	ITask* task = coroutineContext->task;
+	assert(task->noPark == 0 && "a coroutine must not block inside ProcLocal::With");
+	{
+		std::lock_guard lock(task->parkMtx);
+		if (task->wakePending) {
+			task->wakePending = false;
+			return;
+		}
+		task->parkReason = reason;
+		task->state.store(TaskState::TaskParking, std::memory_order_release);
+	}
+	//COROUTINE_LOG("[INFO] Preempting task {}\n", task->GetTaskName());
+	Fiber::SwitchToFiber(task->fiberHandle, coroutineContext->currentProc->threadHandle);
+}
+
+// Pops under queueMutex and, when work is left behind and no Proc is spinning, claims another Proc
+// for it, so a burst fans out one wake-up at a time.
+ITask* CoroutineScheduler::Runtime::TryPopGlobalQueue(bool& spinning)
 {
-	std::unique_lock lock(this->queueMutex);
-	this->cv.wait(lock, [this]() { return !this->globalQueue.empty(); });
-	ITask* task = this->globalQueue.front();
-	this->globalQueue.pop_front();
+	if (this->queuedTasks.load(std::memory_order_relaxed) == 0)
+		return nullptr;
+	ITask* task;
+	WakeAction wake = WakeAction::WakeNone;
+	{
+		std::lock_guard lock(this->queueMutex);
+		uint64_t now = Stats::NowNs();
+		task = this->globalQueue.PopFront(now);
+		if (task == nullptr)
+			return nullptr;
+		this->queuedTasks.fetch_sub(1);
+		if (spinning) {
+			spinning = false;
+			this->spinningProcs.fetch_sub(1);
+		}
+		if (this->globalQueue.HasRunnable(now))
+			wake = ClaimIdleProcLocked();
+	}
+	ApplyWake(wake);
 	return task;
 }
 
+static inline void CpuRelax() {
+#if defined(_MSC_VER)
+	_mm_pause();
+#else
+	__builtin_ia32_pause();
+#endif
+}
+
+static std::chrono::steady_clock::time_point SteadyTime(uint64_t ns) {
+	return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns));
+}
+
+// Go-style idle loop: up to maxSpinning Procs poll the queue for spinDuration before parking, and
+// nothing is woken while a Proc spins. A Proc that leaves work behind in the queue claims the next one.
+// Due timers are fired on every pass, and of the parked Procs one waits for the next timer.
+ITask* CoroutineScheduler::Runtime::FetchTask(Proc& proc)
+{
+	if (this->config.singleThreaded)
+		return FetchTaskSingleThreaded(proc);
+	bool spinning = false;
+	uint64_t spinUntil = 0;
+	Syscall::Sleep& timers = *this->sleepSyscall;
+	while (!this->exiting.load(std::memory_order_relaxed)) {
+		if (size_t fired = timers.RunDue(Stats::NowNs()))
+			proc.counters.timersFired.fetch_add(fired, std::memory_order_relaxed);
+		if (ITask* task = TryPopGlobalQueue(spinning))
+			return task;
+		if (!spinning && this->spinningProcs.load(std::memory_order_relaxed) < this->maxSpinning) {
+			spinning = true;
+			this->spinningProcs.fetch_add(1);
+			spinUntil = Stats::NowNs() + this->config.spinDuration.count();
+		}
+		if (spinning) {
+			uint64_t now;
+			// tasks of throttled groups do not count, a Proc spinning on them would burn its whole spinDuration
+			while (this->globalQueue.Runnable() == 0 && (now = Stats::NowNs()) < spinUntil
+				&& now < timers.NextDeadline() && !this->exiting.load(std::memory_order_relaxed))
+				CpuRelax();
+			now = Stats::NowNs();
+			if (now < spinUntil || now >= timers.NextDeadline()) continue;
+			spinning = false;
+			// the queue is checked again under the lock below, so an Enqueue that saw this Proc spinning is not lost
+			this->spinningProcs.fetch_sub(1);
+		}
+
+		std::unique_lock lock(this->queueMutex);
+		auto ready = [this]() { return this->globalQueue.HasRunnable(Stats::NowNs()) || this->exiting; };
+		if (!ready()) {
+			proc.counters.procParks.fetch_add(1, std::memory_order_relaxed);
+			bool watching = false, timersDue = false, timedOut = false;
+			auto deadline = std::chrono::steady_clock::now() + this->config.workerIdleTimeout;
+			while (!ready()) {
+				uint64_t timerAt = timers.NextWake();
+				if (!watching && !this->timerWatcher && timerAt != Syscall::Sleep::NoTimer)
+					watching = this->timerWatcher = true;
+				else if (watching && timerAt == Syscall::Sleep::NoTimer)
+					watching = this->timerWatcher = false;
+				// only throttled groups have work, sleep until the first gets its quota back
+				uint64_t wakeAt = watching ? timerAt : 0;
+				uint64_t refill = this->globalQueue.NextRefill();
+				if (refill != 0 && (wakeAt == 0 || refill < wakeAt)) wakeAt = refill;
+				if (watching) {
+					if (Stats::NowNs() >= timerAt) {
+						timersDue = true;
+						break;
+					}
+					this->timerWatchUntil = timerAt;
+					this->timerWatcherNotified = false;
+					this->timerCv.wait_until(lock, SteadyTime(wakeAt));
+					continue;
+				}
+				this->idleProcs++;
+				std::cv_status status = std::cv_status::no_timeout;
+				bool idleExpired = false;
+				if (wakeAt != 0 && (this->config.workerIdleTimeout.count() == 0 || SteadyTime(wakeAt) < deadline))
+					status = this->cv.wait_until(lock, SteadyTime(wakeAt));
+				else if (this->config.workerIdleTimeout.count() == 0)
+					this->cv.wait(lock);
+				else
+					idleExpired = (status = this->cv.wait_until(lock, deadline)) == std::cv_status::timeout;
+				this->idleProcs--;
+				// every notified return consumes a claimed wake-up, a rare spurious one at worst lets the
+				// next Enqueue notify once more than needed
+				if (status == std::cv_status::no_timeout && this->pendingWakeups > 0) this->pendingWakeups--;
+				if (idleExpired && !ready()) {
+					timedOut = true;
+					break;
+				}
+			}
+			this->pendingWakeups = std::min(this->pendingWakeups, this->idleProcs);
+			WakeAction handover = WakeAction::WakeNone;
+			if (watching) {
+				this->timerWatcher = false;
+				// another parked Proc takes over the remaining timers while this one is busy
+				if (timers.NextWake() != Syscall::Sleep::NoTimer && this->idleProcs > this->pendingWakeups) {
+					this->pendingWakeups++;
+					handover = WakeAction::WakeNotify;
+				}
+			}
+			if (timersDue) {
+				// fire as a spinning Proc, the tasks they wake are this Proc's to run and nobody else is woken for them
+				spinning = true;
+				this->spinningProcs.fetch_add(1);
+				spinUntil = Stats::NowNs() + this->config.spinDuration.count();
+			}
+			lock.unlock();
+			ApplyWake(handover);
+			if (timedOut) {
+				if (TryRetire(proc)) return nullptr;
+				continue;
+			}
+		}
+		else lock.unlock();
+	}
+	if (spinning) this->spinningProcs.fetch_sub(1);
+	return nullptr;
+}
+
+// FetchTask of a single-threaded runtime. Timers fire and the run queue is popped in this one loop
+// without the queue lock; it is only taken to drain the inbox and to sleep.
+ITask* CoroutineScheduler::Runtime::FetchTaskSingleThreaded(Proc& proc)
+{
+	Syscall::Sleep& timers = *this->sleepSyscall;
+	while (!this->exiting.load(std::memory_order_relaxed)) {
+		if (size_t fired = timers.RunDue(Stats::NowNs()))
+			proc.counters.timersFired.fetch_add(fired, std::memory_order_relaxed);
+		if (this->inboxed.load(std::memory_order_acquire) != 0) {
+			std::lock_guard lock(this->queueMutex);
+			for (ITask* task : this->inbox)
+				this->globalQueue.PushBack(task);
+			this->inbox.clear();
+			this->inboxed.store(0, std::memory_order_relaxed);
+		}
+		if (ITask* task = this->globalQueue.PopFront(Stats::NowNs())) {
+			this->queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+			return task;
+		}
+		uint64_t now, spinUntil = Stats::NowNs() + this->config.spinDuration.count();
+		while (this->inboxed.load(std::memory_order_relaxed) == 0 && (now = Stats::NowNs()) < spinUntil
+			&& now < timers.NextDeadline() && !this->exiting.load(std::memory_order_relaxed))
+			CpuRelax();
+		if (this->inboxed.load(std::memory_order_relaxed) != 0 || Stats::NowNs() >= timers.NextDeadline())
+			continue;
+
+		std::unique_lock lock(this->queueMutex);
+		if (!this->inbox.empty() || this->exiting)
+			continue;
+		// asleep until a hand-over, the next timer or, when only throttled groups have work, the first refill
+		uint64_t wakeAt = timers.NextWake();
+		uint64_t refill = this->globalQueue.NextRefill();
+		if (refill != 0 && refill < wakeAt) wakeAt = refill;
+		if (wakeAt <= Stats::NowNs())
+			continue;
+		proc.counters.procParks.fetch_add(1, std::memory_order_relaxed);
+		this->idleProcs++;
+		this->timerWatchUntil = wakeAt;
+		if (wakeAt == Syscall::Sleep::NoTimer) this->cv.wait(lock);
+		else this->cv.wait_until(lock, SteadyTime(wakeAt));
+		this->idleProcs--;
+		this->pendingWakeups = 0;
+	}
+	return nullptr;
+}
+
 ITask* CoroutineScheduler::Runtime::GetCurrentContextTask()
 {
 	if (coroutineContext->task != nullptr) {
@@ -91,29 +558,283 @@ ITask* CoroutineScheduler::Runtime::GetCurrentContextTask()
 	return nullptr;
 }
 
-void CoroutineScheduler::Runtime::PreemptCurrentTask()
+void CoroutineScheduler::Runtime::PreemptCurrentTask(ParkReason reason)
+{
+	if (coroutineContext->currentProc != nullptr && coroutineContext->task != nullptr) {
+		ParkCurrentTask(reason);
+	}
+}
+
+bool CoroutineScheduler::Runtime::AwaitTask(ITask& task, uint64_t deadlineNs)
 {
-	if (coroutineContext->currentProc != nullptr) {
-		coroutineContext->task->state = TaskState::TaskPaused;
-		//std::cout << std::format("[INFO] Preempting task {}\n", coroutineContext->task->GetTaskName());
-		Fiber::SwitchToFiber(coroutineContext->task->fiberHandle, coroutineContext->currentProc->threadHandle);
+	ITask* current = coroutineContext->task;
+	if (coroutineContext->currentProc == nullptr || current == nullptr) {
+		if (deadlineNs == 0) {
+			task.Await();
+			return true;
+		}
+		return task.AwaitUntil(SteadyTime(deadlineNs));
 	}
+	// A child nobody has started yet runs right here on the awaiter's fiber: no fiber of its own, no
+	// queueing and no switches. Only when nothing tells them apart, the same token and group so that
+	// blocking calls and CPU time count the same, and with half the stack still free for it.
+	if (deadlineNs == 0 && !task.started.load(std::memory_order_relaxed) && task.runtime == this
+		&& task.cancellation == current->cancellation && task.group == current->group
+		&& Fiber::StackRemaining(current->fiberHandle) >= this->config.stackSize / 2) {
+		if (current->IsCancelled())
+			throw CancelledError();
+		// a Proc that pops its spawn entry first starts it as usual
+		if (!task.started.exchange(true, std::memory_order_acq_rel)) {
+			RunInline(task, *current);
+			return true;
+		}
+	}
+	// A park can end on the timer, a cancellation or the completion while the others are still on
+	// their way. Done waiting, the await lets them all arrive and drops what they left pending: a late
+	// wake would end an unrelated park, or reach the task after it was freed. The timer is cancelled
+	// after every park, which returns only once a firing one delivered its wake; the completion's is
+	// tracked by 'task', and a cancelled task checks for cancellation before it parks anyway.
+	auto settle = [&](bool completed) {
+		if (completed) {
+			while (!task.CompletionWakeSettled(current))
+				RequeueCurrentTask(ParkReason::ParkDependentTask);
+		}
+		std::lock_guard lock(current->parkMtx);
+		current->wakePending = false;
+	};
+	// Giving up fails when 'task' completed in the meantime, and the await counts as done.
+	auto giveUp = [&]() {
+		bool completed = !task.SetDependentTask(nullptr);
+		settle(completed);
+		return completed;
+	};
+	// SetDependentTask fails once 'task' completed, anything else that woke us just parks again
+	bool parked = false;
+	while (task.SetDependentTask(current)) {
+		if (current->IsCancelled()) {
+			if (giveUp())
+				return true;
+			throw CancelledError();
+		}
+		if (deadlineNs != 0) {
+			if (Stats::NowNs() >= deadlineNs)
+				return giveUp();
+			GetSleepSyscall().ScheduleWake(current, deadlineNs);
+		}
+		ParkCurrentTask(ParkReason::ParkDependentTask);
+		parked = true;
+		if (deadlineNs != 0) GetSleepSyscall().Cancel(current->timer);
+	}
+	if (parked) settle(true);
+	return true;
 }
 
-void CoroutineScheduler::Runtime::PreemptForDependentTask(ITask& task)
+void CoroutineScheduler::Runtime::YieldCurrentTask()
 {
-	if (coroutineContext->currentProc != nullptr && task.SetDependentTask(coroutineContext->task)) {
-		coroutineContext->task->state = TaskState::TaskPaused;
-		//std::cout << std::format("[INFO] Preempting task {}\n", coroutineContext->task->GetTaskName());
-		Fiber::SwitchToFiber(coroutineContext->task->fiberHandle, coroutineContext->currentProc->threadHandle);
+	ITask* task = coroutineContext->task;
+	if (coroutineContext->currentProc == nullptr || task == nullptr) {
+		std::this_thread::yield();
+		return;
 	}
+	assert(task->noPark == 0 && "a coroutine must not block inside ProcLocal::With");
+	if (task->IsCancelled())
+		throw CancelledError();
+	RequeueCurrentTask(ParkReason::ParkYield);
 }
 
-inline Runtime& CoroutineScheduler::Runtime::GetInstance() {
-	return *instance;
+void CoroutineScheduler::Runtime::RequeueCurrentTask(ParkReason reason)
+{
+	ITask* task = coroutineContext->task;
+	{
+		std::lock_guard lock(task->parkMtx);
+		task->parkReason = reason;
+		task->state.store(TaskState::TaskParking, std::memory_order_release);
+		task->wakePending = true;
+	}
+	Fiber::SwitchToFiber(task->fiberHandle, coroutineContext->currentProc->threadHandle);
+}
+
+void CoroutineScheduler::Runtime::SleepUntil(uint64_t deadlineNs)
+{
+	ITask* task = coroutineContext->task;
+	if (coroutineContext->currentProc == nullptr || task == nullptr) {
+		std::this_thread::sleep_until(SteadyTime(deadlineNs));
+		return;
+	}
+	if (task->IsCancelled())
+		throw CancelledError();
+	uint64_t spin = static_cast<uint64_t>(this->config.timerSpin.count());
+	if (Stats::NowNs() + spin < deadlineNs) {
+		this->sleepSyscall->ScheduleWake(task, deadlineNs - spin);
+		do {
+			ParkCurrentTask(ParkReason::ParkSleep);
+			if (task->IsCancelled()) {
+				this->sleepSyscall->Cancel(task->timer);
+				throw CancelledError();
+			}
+		} while (this->sleepSyscall->IsScheduled(task->timer));
+	}
+	// the rest is too short to park for, spin it out without holding up queued tasks
+	while (Stats::NowNs() < deadlineNs) {
+		if (this->queuedTasks.load(std::memory_order_relaxed) != 0) YieldCurrentTask();
+		else CpuRelax();
+	}
+}
+
+Syscall::Sleep& CoroutineScheduler::Runtime::GetSleepSyscall()
+{
+	return *this->sleepSyscall;
+}
+
+Stats::ProcCounters& CoroutineScheduler::Runtime::CurrentCounters()
+{
+	if (coroutineContext->currentProc != nullptr && coroutineContext->currentProc->runtime == this)
+		return coroutineContext->currentProc->counters;
+	return this->externalCounters;
+}
+
+Stats::RuntimeStats CoroutineScheduler::Runtime::GetStats()
+{
+	Stats::RuntimeStats stats;
+	std::lock_guard workersLock(this->workersMutex);
+	std::lock_guard lock(this->queueMutex);
+	stats.workers = this->liveWorkers.load();
+	stats.spinningProcs = this->spinningProcs.load();
+	stats.idleProcs = this->idleProcs;
+	// the single Proc pops its queue without the lock, the counter is all that can be read from here
+	stats.globalQueueDepth = this->config.singleThreaded ? this->queuedTasks.load() : this->globalQueue.Size();
+	for (auto& group : this->groups) {
+		stats.groups.push_back({ group->name, group->config.weight, group->cpuTime.load(std::memory_order_relaxed),
+			group->throttled.load(std::memory_order_relaxed) });
+	}
+	for (auto& t : this->workerThreads) {
+		stats.Accumulate(t.second->counters);
+	}
+	stats.Accumulate(this->externalCounters);
+	return stats;
+}
+
+static std::string SymbolizeAddress(void* address) {
+#if defined(__linux__)
+	Dl_info info;
+	if (dladdr(address, &info) != 0 && info.dli_sname != nullptr) {
+		int status = 0;
+		char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+		std::string name = (status == 0 && demangled != nullptr) ? demangled : info.dli_sname;
+		std::free(demangled);
+		return std::format("{}+0x{:x}", name, reinterpret_cast<uintptr_t>(address) - reinterpret_cast<uintptr_t>(info.dli_saddr));
+	}
+#endif
+	return "??";
+}
+
+static const char* TaskStateName(TaskState state) {
+	switch (state) {
+	case TaskState::TaskNotStarted: return "not started";
+	case TaskState::TaskRunning: return "running";
+	case TaskState::TaskCompleted: return "completed";
+	case TaskState::TaskPaused: return "parked";
+	case TaskState::TaskParking: return "parking";
+	case TaskState::TaskDumping: return "parked";
+	default: return "unknown";
+	}
+}
+
+static const char* ParkReasonName(ParkReason reason) {
+	switch (reason) {
+	case ParkReason::ParkChannel: return "channel";
+	case ParkReason::ParkSleep: return "sleep";
+	case ParkReason::ParkDependentTask: return "dependent task";
+	case ParkReason::ParkYield: return "yield";
+	default: return "none";
+	}
+}
+
+void CoroutineScheduler::Runtime::DumpCoroutines(std::ostream& out)
+{
+	constexpr int MaxFrames = 32;
+	uint64_t now = Stats::NowNs();
+	unsigned int liveTasks = 0, maxHighWater = 0;
+	std::string dump;
+	// woken while claimed, queued once the registry lock is released
+	std::vector<ITask*> woken;
+	this->registry.ForEach([&](ITask& task) {
+		liveTasks++;
+		// only a parked task's stack holds still, and only while no Proc can resume it: claim it
+		// first, a wake arriving meanwhile stays pending until it is released below
+		TaskState state = TaskState::TaskPaused;
+		bool claimed = task.state.compare_exchange_strong(state, TaskState::TaskDumping, std::memory_order_acq_rel);
+		if (claimed) {
+			dump += std::format("coroutine {} [{}: {}, {} ms] \"{}\":\n", task.id, TaskStateName(TaskState::TaskPaused), ParkReasonName(task.parkReason),
+				(now - task.parkedAt) / 1000000, task.GetTaskName());
+		}
+		else {
+			// a Proc owns everything but the immutable header of a task it may be running
+			dump += std::format("coroutine {} [{}] \"{}\":\n", task.id, TaskStateName(state), task.GetTaskName());
+			dump += state == TaskState::TaskNotStarted ? "\t(no stack yet)\n\n" : "\t(stack unavailable while running)\n\n";
+			return;
+		}
+		if (task.group != nullptr)
+			dump += std::format("\tgroup {}, cpu time {:.3f} ms\n", task.group->name, task.cpuTime / 1e6);
+		if (this->config.stackAccounting) {
+			unsigned int highWater = Fiber::StackHighWaterMark(task.fiberHandle);
+			maxHighWater = std::max(maxHighWater, highWater);
+			dump += std::format("\tstack high-water: {} / {} bytes\n", highWater, this->config.stackSize);
+		}
+		void* frames[MaxFrames];
+		int count = Fiber::CaptureBacktrace(task.fiberHandle, frames, MaxFrames);
+		for (int i = 0; i < count; i++)
+			dump += std::format("\t#{} {} {}\n", i, frames[i], SymbolizeAddress(frames[i]));
+		dump += "\n";
+
+		std::lock_guard lock(task.parkMtx);
+		if (task.wakePending) {
+			task.wakePending = false;
+			task.state.store(TaskState::TaskRunning, std::memory_order_release);
+			woken.push_back(&task);
+		}
+		else task.state.store(TaskState::TaskPaused, std::memory_order_release);
+		});
+	// still parked from the runtime's point of view, so nothing can complete and free them before this
+	for (ITask* task : woken)
+		Enqueue(task);
+	std::string procs;
+	{
+		std::lock_guard lock(this->workersMutex);
+		for (auto& t : this->workerThreads) {
+			if (t.second->cpu < 0) continue;
+			procs += std::format("proc {} on cpu {} (node {}), steals from", t.second->id, t.second->cpu, t.second->node);
+			for (unsigned int victim : t.second->stealOrder) procs += std::format(" {}", victim);
+			procs += "\n";
+		}
+	}
+	if (this->config.stackAccounting)
+		out << std::format("{} live coroutines, deepest stack {} / {} bytes\n", liveTasks, maxHighWater, this->config.stackSize);
+	else out << std::format("{} live coroutines, stack use not tracked (RuntimeConfig::stackAccounting)\n", liveTasks);
+	out << procs << "\n" << dump;
+	out.flush();
+}
+
+Runtime& CoroutineScheduler::Runtime::GetInstance() {
+	static Runtime instance(RuntimeConfig::FromEnvironment());
+	return instance;
+}
+
+Runtime& CoroutineScheduler::Runtime::Current() {
+	if (coroutineContext->currentProc != nullptr)
+		return *coroutineContext->currentProc->runtime;
+	return GetInstance();
+}
+
+void CoroutineScheduler::Runtime::Wake(ITask* const task) {
+	if (task != nullptr && task->runtime != nullptr)
+		task->runtime->ResumeTask(task);
+}
+
+Proc* CoroutineScheduler::Runtime::CurrentProc() {
+	return coroutineContext->currentProc;
 }
 
-constexpr auto COROUTINE_STACK_SIZE = 8 * 1024;
 static void FiberMain(void* args);
 
 void CoroutineScheduler::Proc::ForceExitProc() {
@@ -129,56 +850,185 @@ bool CoroutineScheduler::Proc::ShouldExit() {
 void CoroutineScheduler::Proc::RunTask(ITask* task, std::string& osThreadId)
 {
 	if (task->state == TaskState::TaskNotStarted) {
-		task->fiberHandle = Fiber::CreateFiber(COROUTINE_STACK_SIZE, FiberMain);
+		// claimed by an awaiter that ran it inline, only the spawn entry's reference is left to drop
+		if (task->started.exchange(true, std::memory_order_acq_rel)) {
+			if (!task->MarkForDeletion()) delete task;
+			return;
+		}
+		task->fiberHandle = nullptr;
+		bool paintStack = this->runtime->GetConfig().stackAccounting;
+		if (this->stackArena != nullptr)
+			task->fiberHandle = this->stackArena->CreateFiber(FiberMain, nullptr, paintStack);
+		if (task->fiberHandle == nullptr)
+			task->fiberHandle = Fiber::CreateFiber(this->runtime->GetConfig().stackSize, FiberMain, nullptr, paintStack);
 	}
 
 	coroutineContext->currentProc = this;
 	coroutineContext->task = task;
+	Trace::Record(Trace::EventType::EventRunStart, task);
+
+	uint64_t sliceStart = Stats::NowNs();
+	this->counters.runQueueWait.Record(sliceStart - task->enqueuedAt);
+	this->counters.contextSwitches.fetch_add(1, std::memory_order_relaxed);
+	if (task->parkReason != ParkReason::ParkNone) {
+		this->counters.resumedBy[task->parkReason].fetch_add(1, std::memory_order_relaxed);
+		task->parkReason = ParkReason::ParkNone;
+	}
 
 	Fiber::SwitchToFiber(this->threadHandle, task->fiberHandle);
+	coroutineContext->task = nullptr;
+	uint64_t sliceEnd = Stats::NowNs();
+	this->counters.timeSlice.Record(sliceEnd - sliceStart);
+	this->runtime->ChargeSlice(task, sliceEnd - sliceStart, sliceEnd);
 
 	switch (task->state) {
 	case TaskState::TaskCompleted:
-		std::cout << std::format("[INFO] Task {} completed on thread {}\n", task->GetTaskName(), osThreadId);
-		if (task->dependentTask != nullptr) {
-			RunTask(task->dependentTask, osThreadId);
+		Trace::Record(Trace::EventType::EventComplete, task);
+		this->counters.completed.fetch_add(1, std::memory_order_relaxed);
+		if (task->deadline != 0 && Stats::NowNs() > task->deadline)
+			this->counters.deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+		if (!task->arena.Empty()) task->arena.Release(this->arenaPages);
+		COROUTINE_LOG("[INFO] Task {} completed on thread {}\n", task->GetTaskName(), osThreadId);
+		// hand the Proc straight to the task that was awaiting this one, unless it belongs to another runtime
+		if (ITask* dependent = task->TakeDependentTask(); dependent != nullptr) {
+			bool handOff = false;
+			if (dependent->runtime != this->runtime) Runtime::Wake(dependent);
+			else handOff = this->runtime->MarkRunnable(dependent);
+			// an awaiter that gave up meanwhile waits for this before it goes on
+			task->DependentWoken();
+			if (handOff) {
+				dependent->enqueuedAt = Stats::NowNs();
+				RunTask(dependent, osThreadId);
+			}
 		}
 		if (!task->MarkForDeletion()) {
 			delete task;
 		}
 		break;
-	case TaskState::TaskPaused:
-		std::cout << std::format("[INFO] Task {} paused on thread {}\n", task->GetTaskName(), osThreadId);
+	case TaskState::TaskParking: {
+		Trace::Record(Trace::EventType::EventPark, task, task->parkReason);
+		task->parkedAt = Stats::NowNs();
+		this->counters.parked.fetch_add(1, std::memory_order_relaxed);
+		this->counters.parkedBy[task->parkReason].fetch_add(1, std::memory_order_relaxed);
+		COROUTINE_LOG("[INFO] Task {} paused on thread {}\n", task->GetTaskName(), osThreadId);
+		bool requeue = false;
+		{
+			std::lock_guard lock(task->parkMtx);
+			if (task->wakePending) {
+				task->wakePending = false;
+				task->state.store(TaskState::TaskRunning, std::memory_order_release);
+				requeue = true;
+			}
+			else task->state.store(TaskState::TaskPaused, std::memory_order_release);
+		}
+		if (requeue) this->runtime->Enqueue(task);
+		break;
+	}
+	default:
 		break;
 	};
 }
 
 void CoroutineScheduler::Proc::ThreadMainLoop() {
+	// pinned before anything is allocated, fiber stacks are painted on this thread so first touch puts them on its node
+	bool pinned = this->cpu >= 0 && Topology::PinCurrentThread(this->cpu);
+#if defined(__linux__)
+	// the kernel otherwise lets a timed wait run up to 50us late to batch wake-ups, more than the timers' resolution
+	prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+#endif
 	threadHandle = Fiber::CreateFiberFromThread();
+	coroutineContext->currentProc = this;
 	std::thread::id tid = std::this_thread::get_id();
 	std::stringstream _ss;
 	_ss << tid;
 	auto osThreadId = _ss.str();
-	std::cout << std::format("[INFO] Thread {} started.\n", osThreadId);
+	auto& runtimeName = this->runtime->GetConfig().name;
+	Trace::SetCurrentTrack(this->runtime->GetId() * 1024 + this->id,
+		runtimeName.empty() ? std::format("Proc {}", this->id) : std::format("{} Proc {}", runtimeName, this->id));
+	if (pinned) COROUTINE_LOG("[INFO] Thread {} started on cpu {} (node {}).\n", osThreadId, this->cpu, this->node);
+	else COROUTINE_LOG("[INFO] Thread {} started.\n", osThreadId);
 	while (!ShouldExit()) {
-		auto task = Runtime::GetInstance().FetchTaskFromGlobalQueue();
-		if (task != nullptr) RunTask(task, osThreadId);
+		auto task = this->runtime->FetchTask(*this);
+		if (task == nullptr) break;
+		RunTask(task, osThreadId);
 	}
-	std::cout << std::format("[INFO] Thread {} Exited.\n", _ss.str());
+	COROUTINE_LOG("[INFO] Thread {} Exited.\n", _ss.str());
 	Fiber::DeleteFiber(this->threadHandle);
 	this->threadHandle = nullptr;
 	delete coroutineContext;
 }
 
-static void FiberMain(void* args) {
-	std::thread::id tid = std::this_thread::get_id();
+#ifndef COROUTINE_SCHEDULER_NO_LOG
+static std::string ThreadIdString() {
 	std::stringstream _ss;
-	_ss << tid;
-	std::cout << std::format("[INFO] Executing task: {} on thread {}\n", coroutineContext->task->GetTaskName(), _ss.str());
-	coroutineContext->task->state = TaskState::TaskRunning;
+	_ss << std::this_thread::get_id();
+	return _ss.str();
+}
+#endif
+
+// A fiber can park on one Proc thread and resume on another, so code that spans a park must not
+// reuse a thread_local address the compiler computed before it. Reading through a call that is
+// never inlined forces a fresh lookup.
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+static CoroutineContext* CurrentContext() {
+	return coroutineContext;
+}
+
+FiberLocalSlots& CoroutineScheduler::CurrentFiberLocals() {
+	ITask* task = coroutineContext->task;
+	if (task != nullptr)
+		return task->guest != nullptr ? task->guest->locals : task->locals;
+	thread_local FiberLocalSlots threadLocals;
+	return threadLocals;
+}
+
+std::pmr::memory_resource* CoroutineScheduler::CurrentArena() {
+	ITask* task = coroutineContext->task;
+	if (task == nullptr)
+		return std::pmr::get_default_resource();
+	return task->guest != nullptr ? &task->guest->arena : &task->arena;
+}
+
+ArenaPageCache& CoroutineScheduler::CurrentArenaPageCache() {
+	if (Proc* proc = coroutineContext->currentProc)
+		return proc->arenaPages;
+	// only reached by an arena used off its Proc, its pages go back to the heap
+	thread_local ArenaPageCache threadPages(RuntimeConfig{}.arenaPageSize, 0);
+	return threadPages;
+}
+
+// Runs a claimed child on its awaiter's fiber. The host stays the current task throughout, so
+// whatever the child blocks on parks and wakes the host, and FiberLocals resolve to the child
+// through 'guest'. The child itself stays TaskNotStarted, wakers leave it alone and the Proc that
+// pops its spawn entry only drops the runtime's reference, see Proc::RunTask.
+static void RunInline(ITask& task, ITask& host) noexcept {
+	ITask* outer = host.guest;
+	host.guest = &task;
+	task.Execute();
+	host.guest = outer;
+	Trace::Record(Trace::EventType::EventComplete, &task);
+	// the child may have parked the host, which then resumed on another Proc
+	Proc* proc = CurrentContext()->currentProc;
+	if (!task.arena.Empty()) task.arena.Release(proc->arenaPages);
+	Stats::ProcCounters& counters = proc->counters;
+	counters.completed.fetch_add(1, std::memory_order_relaxed);
+	counters.inlined.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void FiberMain(void* args) {
+	ITask* task = coroutineContext->task;
+	COROUTINE_LOG("[INFO] Executing task: {} on thread {}\n", task->GetTaskName(), ThreadIdString());
+	{
+		std::lock_guard lock(task->parkMtx);
+		task->state.store(TaskState::TaskRunning, std::memory_order_release);
+	}
 
-	coroutineContext->task->Execute();
+	task->Execute();
 
-	coroutineContext->task->state = TaskState::TaskCompleted;
-	Fiber::SwitchToFiber(coroutineContext->task->fiberHandle, coroutineContext->currentProc->threadHandle);
+	task->state.store(TaskState::TaskCompleted, std::memory_order_release);
+	Fiber::SwitchToFiber(task->fiberHandle, CurrentContext()->currentProc->threadHandle);
 }
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <deque>
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <mutex>
@@ -8,46 +8,204 @@
 #include <memory>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 #include "Task.hpp"
+#include "Stats.hpp"
+#include "RingQueue.hpp"
+#include "RunQueue.hpp"
+#include "TaskGroup.hpp"
+#include "Syscalls.hpp"
+#include "StackArena.hpp"
 
 namespace CoroutineScheduler {
 
 	struct CoroutineContext;
+	class Runtime;
+
+	struct RuntimeConfig {
+		// Proc worker threads, 0 uses std::thread::hardware_concurrency()
+		unsigned int workers = 0;
+		// bytes of stack given to every coroutine fiber
+		unsigned int stackSize = 8 * 1024;
+		// runnable normal priority tasks the run queue holds before it has to grow
+		size_t runQueueCapacity = 256;
+		// share of the Procs each class gets while all are busy: interactive, normal, background, deadline
+		unsigned int priorityWeights[RunQueue::ClassCount] = { 8, 4, 1, 16 };
+		// pending sleeps the timer heap holds before it has to grow
+		size_t timerQueueCapacity = 64;
+		// how late a timer may fire so that timers due close together are woken in one pass
+		std::chrono::nanoseconds timerResolution{ 0 };
+		// the last stretch of a sleep that is spun instead of parked, trading CPU for wake-up precision;
+		// the sleeper yields while other tasks are queued
+		std::chrono::nanoseconds timerSpin{ 0 };
+		// prefixes the Proc track names in traces
+		std::string name = "";
+		// pin every Proc thread to its own CPU, see Topology::CpuTopology::PlaceWorkers
+		bool pinWorkers = false;
+		// CPUs the Procs are placed on when pinned, empty for every CPU the process may use
+		std::vector<int> cpus;
+		// idle Procs allowed to spin for work at once, 0 allows half of the workers
+		unsigned int maxSpinningProcs = 0;
+		// how long an idle Proc spins before it parks
+		std::chrono::nanoseconds spinDuration{ 20'000 };
+		// a parked Proc idle this long exits its thread, 0 keeps every worker; the last one never retires
+		std::chrono::milliseconds workerIdleTimeout{ 10'000 };
+		// bytes of the pages coroutine arenas are carved from, see Coroutine::Arena()
+		size_t arenaPageSize = 16 * 1024;
+		// free arena pages each Proc keeps for the next coroutines instead of returning them to the heap
+		size_t arenaCachedPages = 64;
+		// carve the fiber stacks of each Proc out of 2 MiB huge-page regions instead of allocating each
+		// one on its own, for fewer TLB misses when switching among many coroutines; Linux only
+		bool stackArena = false;
+		// fill every new fiber stack with a marker so DumpCoroutines can report how deep it was used;
+		// this writes each stack in full on spawn, which commits all of its pages
+		bool stackAccounting = false;
+		// One Proc that owns the run queue, 'workers' is ignored: the tasks it makes runnable itself are
+		// queued without the queue lock, other threads hand theirs over through a locked inbox. Channels
+		// used only by its coroutines can drop their lock too, see Coroutine::LocalChannel.
+		bool singleThreaded = false;
+
+		// The default configuration with 'workers' taken from the COMAXPROCS environment variable.
+		static RuntimeConfig FromEnvironment();
+	};
 
 	struct Proc {
 		std::mutex exitmtx;
 		std::condition_variable cv;
 		Fiber::FiberHandle threadHandle;
 		bool forceExit;
+		// the thread left after an idle timeout, guarded by the runtime's workersMutex
+		bool retired;
+		const unsigned int id;
+		Runtime* const runtime;
+		// CPU the thread is pinned to and its NUMA node, -1 when unpinned
+		const int cpu;
+		const int node;
+		// other Procs by id, nearest in the CPU topology first
+		const std::vector<unsigned int> stealOrder;
+		Stats::ProcCounters counters;
+		// pages of the arenas of tasks that completed on this Proc, for the next ones
+		ArenaPageCache arenaPages;
+		// stacks of the fibers started on this Proc when RuntimeConfig::stackArena is set, nullptr otherwise
+		StackArena* stackArena;
 
-		Proc() : forceExit(false), threadHandle(nullptr) {}
+		Proc(unsigned int id, Runtime* runtime, const RuntimeConfig& config, int cpu, int node, std::vector<unsigned int> stealOrder)
+			: threadHandle(nullptr), forceExit(false), retired(false), id(id), runtime(runtime), cpu(cpu), node(node), stealOrder(std::move(stealOrder)),
+			arenaPages(config.arenaPageSize, config.arenaCachedPages), stackArena(config.stackArena ? StackArena::Create(config.stackSize) : nullptr) {}
+		~Proc() {
+			if (this->stackArena != nullptr) this->stackArena->Retire();
+		}
 		void ForceExitProc();
 		bool ShouldExit();
 		void RunTask(ITask* task, std::string& osThreadId);
 		void ThreadMainLoop();
 	};
 
+	// Proc threads are started on first use, so constructing a Runtime is cheap
+	// and several independent runtimes can live in one process.
 	class Runtime {
 	private:
+		static inline std::atomic<unsigned int> nextRuntimeId{ 0 };
+		const RuntimeConfig config;
+		const unsigned int id;
 		unsigned int threadCount;
+		// CPU of each Proc when pinned, empty otherwise
+		std::vector<int> placement;
 		std::vector<std::pair<std::thread, std::unique_ptr<Proc>>> workerThreads;
-		std::deque<ITask*> globalQueue;
+		std::mutex workersMutex;
+		std::atomic<unsigned int> liveWorkers{ 0 };
+		unsigned int maxSpinning;
+		std::vector<std::unique_ptr<TaskGroup>> groups;
+		TaskGroup* defaultGroup;
+		GroupQueue globalQueue;
 		std::mutex queueMutex;
 		std::condition_variable cv;
-		static std::unique_ptr<Runtime> instance;
+		// mirrors globalQueue.Size() so Procs can check it without the lock, counts throttled tasks too
+		std::atomic<size_t> queuedTasks{ 0 };
+		std::atomic<unsigned int> spinningProcs{ 0 };
+		// Procs waiting on cv and how many of them were already notified, guarded by queueMutex
+		unsigned int idleProcs = 0;
+		unsigned int pendingWakeups = 0;
+		// the one idle Proc that waits on timerCv for the next timer instead of on cv, guarded by queueMutex
+		bool timerWatcher = false;
+		bool timerWatcherNotified = false;
+		uint64_t timerWatchUntil = 0;
+		std::condition_variable timerCv;
+		std::atomic<bool> exiting{ false };
+		// single-threaded mode: tasks handed over by other threads, guarded by queueMutex, and their count
+		std::vector<ITask*> inbox;
+		std::atomic<size_t> inboxed{ 0 };
+		Stats::ProcCounters externalCounters;
+		TaskRegistry registry;
+		std::unique_ptr<Syscall::Sleep> sleepSyscall;
+
+		void ParkCurrentTask(ParkReason reason);
+		// Parks with the task's own wake already pending, so its Proc puts it straight back in the queue.
+		void RequeueCurrentTask(ParkReason reason);
+		std::unique_ptr<Proc> MakeProc(unsigned int procId);
+		enum WakeAction { WakeNone, WakeNotify, WakeTimerWatcher, WakeStartWorker };
+		WakeAction ClaimIdleProcLocked();
+		void ApplyWake(WakeAction action);
+		ITask* TryPopGlobalQueue(bool& spinning);
+		void EnqueueSingleThreaded(ITask* const* tasks, size_t count);
+		ITask* FetchTaskSingleThreaded(Proc& proc);
+		void StartWorker();
+		bool TryRetire(Proc& proc);
 	public:
-		Runtime();
+		explicit Runtime(const RuntimeConfig& config = {});
+		Runtime(const Runtime&) = delete;
+		Runtime& operator=(const Runtime&) = delete;
 		~Runtime();
-		void EnsureThreadCount();
 		void AddTask(ITask* task);
-		ITask* FetchTaskFromGlobalQueue();
+		// Spawns tasks that were not started yet in one go: one queue lock for all of them, and up to as
+		// many Procs woken at once as there are tasks, rather than each Proc waking the next as it finds
+		// work left behind.
+		void AddTasks(ITask* const* tasks, size_t count);
+		// Makes a started task runnable again, a no-op for tasks that are running, done or not started yet.
+		void ResumeTask(ITask* task);
+		void Enqueue(ITask* task);
+		bool MarkRunnable(ITask* task);
+		// Accounts a finished slice to the task and its group.
+		void ChargeSlice(ITask* task, uint64_t sliceNs, uint64_t now);
+
+		// Creates a group that tasks can be spawned into with RunOptions::group, it lives as long as the runtime.
+		TaskGroup& CreateTaskGroup(std::string name, const TaskGroupConfig& config = {});
+		// Next task for the Proc, nullptr when the Proc should exit or has retired.
+		ITask* FetchTask(Proc& proc);
 
 		ITask* GetCurrentContextTask();
-		void PreemptCurrentTask();
-		void PreemptForDependentTask(ITask& task);
+		void PreemptCurrentTask(ParkReason reason);
+		// Parks the current task until 'task' completes, or blocks the thread outside a coroutine.
+		// Returns false once deadlineNs (a Stats::NowNs timestamp, 0 for none) passes first.
+		// Throws CancelledError, leaving 'task' running, when the current task is cancelled.
+		bool AwaitTask(ITask& task, uint64_t deadlineNs = 0);
+		// Requeues the current task behind the runnable ones.
+		void YieldCurrentTask();
+		// Parks the current task until deadlineNs, spinning through the last RuntimeConfig::timerSpin of
+		// it, or sleeps the thread outside a coroutine. Throws CancelledError when cancelled.
+		void SleepUntil(uint64_t deadlineNs);
+		// Lets the Proc waiting for timers know that one is now due at wakeAtNs, called by the timers.
+		void TimerScheduled(uint64_t wakeAtNs);
+
+		const RuntimeConfig& GetConfig() const { return this->config; }
+		unsigned int GetId() const { return this->id; }
+		// Procs the runtime runs at most, their ids are below this
+		unsigned int GetWorkerCount() const { return this->threadCount; }
+		Syscall::Sleep& GetSleepSyscall();
+
+		Stats::ProcCounters& CurrentCounters();
+		Stats::RuntimeStats GetStats();
+		void DumpCoroutines(std::ostream& out = std::cout);
 
+		// The process-wide default runtime, configured from the environment on first use.
 		static Runtime& GetInstance();
+		// The runtime of the calling Proc thread, or the default one on any other thread.
+		static Runtime& Current();
+		// Makes a parked task runnable again on the runtime it was spawned on.
+		static void Wake(ITask* task);
+		// The Proc the calling thread runs, of whichever runtime, nullptr on any other thread.
+		static Proc* CurrentProc();
 	};
 
 	struct CoroutineContext {
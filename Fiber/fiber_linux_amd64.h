@@ -1,4 +1,6 @@
 #include <memory>
+#include <cstring>
+#include "../Log.hpp"
 
 #define TINY_FIBER_MALLOC   malloc
 #define TINY_FIBER_FREE     free
@@ -42,6 +44,8 @@ namespace Fiber {
 
 // Both x64 and arm64 require stack memory pointer to be 16 bytes aligned
 #define FIBER_STACK_ALIGNMENT   16
+// Stacks created with paint_stack are filled with this byte so the deepest used address can be found later
+#define FIBER_STACK_PAINT       0xCD
 
 #define FIBER_REG_RBX			0x00
 #define FIBER_REG_RBP			0x08
@@ -116,23 +120,34 @@ namespace Fiber {
 		context->rip = (uintptr_t)target;
 		context->rdi = (uintptr_t)arg;
 		context->rsp = (uintptr_t)&stack_top[-3];
+		// null return address terminates frame-pointer walks at the fiber entry
+		stack_top[-3] = 0;
 		stack_top[-2] = 0;
 
 		return true;
 	}
 
+	// Takes back the stack of a fiber created with CreateFiberOnStack.
+	typedef void (*StackRelease)(void* owner, void* stack);
+
 	struct Fiber
 	{
 		FiberContexInternal context;
 		void* stack_ptr = nullptr;
 		unsigned int stack_size = 0;
 		bool is_fiber_from_thread = false;
+		// set when the stack was provided by the caller instead of allocated here
+		StackRelease release_stack = nullptr;
+		void* stack_owner = nullptr;
+		// filled with FIBER_STACK_PAINT when created, StackHighWaterMark has nothing to measure otherwise
+		bool stack_painted = false;
 	};
 
 	typedef Fiber*  FiberHandle;
 
 	//! Allocate stack memory for the fiber. If there is no valid function pointer provided, it will fail.
-	inline FiberHandle CreateFiber(uint32_t stack_size, void (*fiber_func)(void*), void* arg = nullptr) {
+	//! Painting the stack for StackHighWaterMark writes, and so commits, every page of it.
+	inline FiberHandle CreateFiber(uint32_t stack_size, void (*fiber_func)(void*), void* arg = nullptr, bool paint_stack = false) {
 		if(stack_size == 0 || !fiber_func)
 			return nullptr;
 		
@@ -141,10 +156,16 @@ namespace Fiber {
 		ptr->context = {};
 		ptr->stack_ptr = TINY_FIBER_MALLOC(stack_size + FIBER_STACK_ALIGNMENT - 1);
 		ptr->stack_size = stack_size;
+		ptr->is_fiber_from_thread = false;
+		ptr->release_stack = nullptr;
+		ptr->stack_owner = nullptr;
+		ptr->stack_painted = paint_stack;
 
 		if(!ptr->stack_ptr)
 			return nullptr;
-		std::cout << std::format("Stack allocated : {}\n", ptr->stack_ptr);
+		if(paint_stack)
+			memset(ptr->stack_ptr, FIBER_STACK_PAINT, stack_size + FIBER_STACK_ALIGNMENT - 1);
+		COROUTINE_LOG("Stack allocated : {}\n", ptr->stack_ptr);
 		// Make sure the stack meets the alignment requirement
 		uintptr_t aligned_stack_ptr = (uintptr_t)ptr->stack_ptr;
 		aligned_stack_ptr += FIBER_STACK_ALIGNMENT - 1;
@@ -156,6 +177,32 @@ namespace Fiber {
 		return ptr;
 	}
 
+	//! Create a fiber on a stack the caller provides, 16 bytes aligned. DeleteFiber hands it to 'release'
+	//! with 'owner' instead of freeing it.
+	inline FiberHandle CreateFiberOnStack(void* stack, uint32_t stack_size, void (*fiber_func)(void*), StackRelease release, void* owner, void* arg = nullptr, bool paint_stack = false) {
+		if(stack == nullptr || stack_size == 0 || !fiber_func || !release)
+			return nullptr;
+
+		Fiber* ptr = (Fiber*)TINY_FIBER_MALLOC(sizeof(Fiber));
+		if(!ptr)
+			return nullptr;
+		ptr->context = {};
+		ptr->stack_ptr = stack;
+		ptr->stack_size = stack_size;
+		ptr->is_fiber_from_thread = false;
+		ptr->release_stack = release;
+		ptr->stack_owner = owner;
+		ptr->stack_painted = paint_stack;
+
+		if(paint_stack)
+			memset(stack, FIBER_STACK_PAINT, stack_size);
+		if(!_create_fiber_internal(stack, stack_size, fiber_func, arg, &ptr->context)) {
+			TINY_FIBER_FREE(ptr);
+			return nullptr;
+		}
+		return ptr;
+	}
+
 	// Note, on Ubuntu, this doesn't really convert the current thread to a new fiber,
 	// it really just creates a brand new fiber that has nothing to do with the current thread.
 	// However, as long as the thread first switch to a fiber from this created fiber,
@@ -166,6 +213,9 @@ namespace Fiber {
 		ptr->stack_ptr = nullptr;
 		ptr->stack_size = 0;
 		ptr->is_fiber_from_thread = true;
+		ptr->release_stack = nullptr;
+		ptr->stack_owner = nullptr;
+		ptr->stack_painted = false;
 		return ptr;
 	}
 
@@ -178,12 +228,64 @@ namespace Fiber {
 		_switch_fiber_internal(&from_fiber->context, &to_fiber->context);
 	}
 
+	inline uintptr_t _fiber_stack_base(const Fiber* fiber) {
+		return ((uintptr_t)fiber->stack_ptr + FIBER_STACK_ALIGNMENT - 1) & ~(uintptr_t)(FIBER_STACK_ALIGNMENT - 1);
+	}
+
+	//! Number of stack bytes the fiber has touched so far, 0 if it has no stack of its own or it was not painted.
+	inline unsigned int StackHighWaterMark(const Fiber* fiber) {
+		if(fiber == nullptr || fiber->stack_ptr == nullptr || fiber->is_fiber_from_thread || !fiber->stack_painted)
+			return 0;
+		const uint8_t* bottom = (const uint8_t*)_fiber_stack_base(fiber);
+		unsigned int untouched = 0;
+		while(untouched < fiber->stack_size && bottom[untouched] == FIBER_STACK_PAINT)
+			untouched++;
+		return fiber->stack_size - untouched;
+	}
+
+	//! Stack bytes left below the caller's frame, called on the fiber that is running. 0 if it has no stack of its own.
+	inline unsigned int StackRemaining(const Fiber* fiber) {
+		if(fiber == nullptr || fiber->stack_ptr == nullptr || fiber->is_fiber_from_thread)
+			return 0;
+		uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+		uintptr_t bottom = _fiber_stack_base(fiber);
+		if(sp < bottom || sp > bottom + fiber->stack_size)
+			return 0;
+		return (unsigned int)(sp - bottom);
+	}
+
+	//! Return addresses of a fiber that is switched out, innermost first, found by following the saved rbp chain.
+	//! Only frames compiled with frame pointers are found. Must not be called on a running fiber.
+	inline int CaptureBacktrace(const Fiber* fiber, void** frames, int max_frames) {
+		if(fiber == nullptr || fiber->stack_ptr == nullptr || fiber->is_fiber_from_thread || max_frames <= 0)
+			return 0;
+		uintptr_t low = _fiber_stack_base(fiber);
+		uintptr_t high = low + fiber->stack_size;
+		int count = 0;
+		frames[count++] = (void*)fiber->context.rip;
+		uintptr_t fp = fiber->context.rbp;
+		while(count < max_frames && fp >= low && fp + 2 * sizeof(uintptr_t) <= high && (fp & (sizeof(uintptr_t) - 1)) == 0) {
+			const uintptr_t* frame = (const uintptr_t*)fp;
+			if(frame[1] == 0)
+				break;
+			frames[count++] = (void*)frame[1];
+			// frames of callers always live above the callee on the stack
+			if(frame[0] <= fp)
+				break;
+			fp = frame[0];
+		}
+		return count;
+	}
+
 	// If the fiber is converted from a thread, delete fiber will convert the fiber back to a regular thread then.
 	inline void DeleteFiber(FiberHandle fiber_handle) {
 		if(fiber_handle == nullptr)
 			return;
 		if(fiber_handle->stack_ptr != nullptr && !fiber_handle->is_fiber_from_thread) {
-			TINY_FIBER_FREE(fiber_handle->stack_ptr);
+			if(fiber_handle->release_stack != nullptr)
+				fiber_handle->release_stack(fiber_handle->stack_owner, fiber_handle->stack_ptr);
+			else
+				TINY_FIBER_FREE(fiber_handle->stack_ptr);
 			fiber_handle->stack_ptr = nullptr;
 		}
 		TINY_FIBER_FREE(fiber_handle);
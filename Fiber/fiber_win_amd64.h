@@ -15,12 +15,14 @@ namespace Fiber {
 
 	typedef Fiber* FiberHandle;
 
-	inline FiberHandle CreateFiber(UINT32 stack_size, void (*fiber_func)(void*)) {
+	// The OS owns the stack, it is never painted.
+	inline FiberHandle CreateFiber(UINT32 stack_size, void (*fiber_func)(void*), void* arg = nullptr, bool paint_stack = false) {
 		if (stack_size == 0 || !fiber_func)
 			::abort();
 
 		Fiber* ptr = (Fiber*)TINY_FIBER_MALLOC(sizeof(Fiber));
-		ptr->context.raw_fiber_handle = ::CreateFiber(stack_size, fiber_func, nullptr);
+		(void)paint_stack;
+		ptr->context.raw_fiber_handle = ::CreateFiber(stack_size, fiber_func, arg);
 		ptr->is_fiber_from_thread = false;
 		return ptr;
 	}
@@ -38,6 +40,19 @@ namespace Fiber {
 		::SwitchToFiber(to_fiber->context.raw_fiber_handle);
 	}
 
+	// Windows fibers keep their stack and registers inside the OS fiber object, neither is inspected here.
+	inline unsigned int StackHighWaterMark(const Fiber* fiber) {
+		return 0;
+	}
+
+	inline unsigned int StackRemaining(const Fiber* fiber) {
+		return 0;
+	}
+
+	inline int CaptureBacktrace(const Fiber* fiber, void** frames, int max_frames) {
+		return 0;
+	}
+
 	inline void DeleteFiber(FiberHandle fiber_handle) {
 		if (fiber_handle == nullptr || fiber_handle->context.raw_fiber_handle == nullptr)
 			return;
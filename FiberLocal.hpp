@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace CoroutineScheduler
+{
+	// The FiberLocal values of one task, or of one thread outside the runtime, indexed by each
+	// FiberLocal's slot. The first InlineSlots are stored in the task object itself and later ones in
+	// an overflow vector; an inline slot also holds a small value without a destructor itself instead
+	// of pointing to one on the heap. Only the owning task touches them, so nothing is locked.
+	class FiberLocalSlots {
+	public:
+		using Destroy = void (*)(void*);
+		static constexpr size_t InlineSlots = 8;
+		static constexpr size_t InlineValueSize = 2 * sizeof(void*);
+		static constexpr size_t InlineValueAlign = alignof(void*);
+
+	private:
+		struct Slot {
+			void* value = nullptr;
+			// nullptr for a value in 'storage', there is nothing to destroy then
+			Destroy destroy = nullptr;
+			alignas(InlineValueAlign) unsigned char storage[InlineValueSize];
+		};
+		Slot inlineSlots[InlineSlots];
+		std::vector<Slot> overflow;
+		// slots are never reused, a FiberLocal is normally a global or a static
+		static inline std::atomic<size_t> nextIndex{ 0 };
+
+		Slot& At(size_t index) {
+			if (index < InlineSlots)
+				return this->inlineSlots[index];
+			index -= InlineSlots;
+			if (index >= this->overflow.size()) this->overflow.resize(index + 1);
+			return this->overflow[index];
+		}
+
+	public:
+		FiberLocalSlots() = default;
+		FiberLocalSlots(const FiberLocalSlots&) = delete;
+		FiberLocalSlots& operator=(const FiberLocalSlots&) = delete;
+		~FiberLocalSlots() { Clear(); }
+
+		static size_t AllocateIndex() { return nextIndex.fetch_add(1, std::memory_order_relaxed); }
+
+		void* Find(size_t index) const {
+			if (index < InlineSlots)
+				return this->inlineSlots[index].value;
+			index -= InlineSlots;
+			return index < this->overflow.size() ? this->overflow[index].value : nullptr;
+		}
+
+		// Where a value of up to InlineValueSize bytes can be constructed in place, nullptr for an
+		// overflow slot: the vector moves them.
+		void* InlineStorage(size_t index) {
+			return index < InlineSlots ? this->inlineSlots[index].storage : nullptr;
+		}
+
+		void Set(size_t index, void* value, Destroy destroy) {
+			Slot& slot = At(index);
+			void* oldValue = slot.value;
+			Destroy oldDestroy = slot.destroy;
+			slot.value = value;
+			slot.destroy = destroy;
+			if (oldValue != nullptr && oldDestroy != nullptr) oldDestroy(oldValue);
+		}
+
+		void Reset(size_t index) {
+			if (Find(index) != nullptr) Set(index, nullptr, nullptr);
+		}
+
+		// Destroys every value. A destructor may touch another FiberLocal and create a value again,
+		// so this repeats until a pass finds nothing.
+		void Clear() {
+			bool found = true;
+			while (found) {
+				found = false;
+				for (size_t i = 0; i < InlineSlots + this->overflow.size(); i++) {
+					if (Find(i) != nullptr) {
+						Reset(i);
+						found = true;
+					}
+				}
+			}
+			this->overflow.clear();
+		}
+	};
+
+	// The calling task's slots, or the calling thread's outside a coroutine. Defined out of line so
+	// that a coroutine resumed on another Proc looks its task up again, see CurrentContext.
+	FiberLocalSlots& CurrentFiberLocals();
+
+	// A value per coroutine rather than per thread: it follows the coroutine across Procs, where a
+	// thread_local would hand it another thread's copy after a park. Constructed on first access,
+	// from 'init' when given, and destroyed when the coroutine completes. Outside coroutines every
+	// thread has its own value. References stay valid across parks until the coroutine completes.
+	template<typename T>
+	class FiberLocal {
+		const size_t index;
+		const std::function<T()> init;
+
+		// kept in the slot itself when the slot is an inline one, see FiberLocalSlots
+		static constexpr bool FitsInline = std::is_trivially_destructible_v<T>
+			&& sizeof(T) <= FiberLocalSlots::InlineValueSize && alignof(T) <= FiberLocalSlots::InlineValueAlign;
+
+		static void Destroy(void* value) {
+			delete static_cast<T*>(value);
+		}
+
+		// On the heap when 'storage' is nullptr.
+		T* Construct(void* storage) {
+			if (this->init) return storage != nullptr ? new (storage) T(this->init()) : new T(this->init());
+			if constexpr (std::is_default_constructible_v<T>) return storage != nullptr ? new (storage) T() : new T();
+			else throw std::logic_error("FiberLocal of a type without a default constructor needs an initializer");
+		}
+
+	public:
+		FiberLocal() : index(FiberLocalSlots::AllocateIndex()) {}
+		explicit FiberLocal(std::function<T()> init) : index(FiberLocalSlots::AllocateIndex()), init(std::move(init)) {}
+		FiberLocal(const FiberLocal&) = delete;
+		FiberLocal& operator=(const FiberLocal&) = delete;
+
+		T& Get() {
+			FiberLocalSlots& slots = CurrentFiberLocals();
+			if (void* value = slots.Find(this->index))
+				return *static_cast<T*>(value);
+			void* storage = nullptr;
+			if constexpr (FitsInline) storage = slots.InlineStorage(this->index);
+			T* value = Construct(storage);
+			slots.Set(this->index, value, storage != nullptr ? nullptr : Destroy);
+			return *value;
+		}
+		T& operator*() { return Get(); }
+		T* operator->() { return &Get(); }
+
+		// false until the calling coroutine first accessed its value
+		bool HasValue() const { return CurrentFiberLocals().Find(this->index) != nullptr; }
+		// Destroys the calling coroutine's value, the next access constructs a new one.
+		void Reset() { CurrentFiberLocals().Reset(this->index); }
+	};
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+#include "CoroutineScheduler.hpp"
+#include "Fiber/fiber.h"
+
+namespace CoroutineScheduler
+{
+	// Runs a producer on its own fiber and hands its values to the consumer one at a time: every
+	// Yield switches straight back to the consumer and every step of the consumer switches straight
+	// into the producer, without the run queue or a lock. Nothing runs until the first value is asked for.
+	//
+	// The consumer may be a coroutine or a plain thread. While the producer runs it stands in for the
+	// consuming task, so a blocking call inside it (Sleep, a channel) parks the consumer with it.
+	// Destroying an unfinished generator unwinds the producer's stack. Not thread-safe.
+	template<typename T>
+	class Generator {
+		// thrown out of Yield to unwind an abandoned producer
+		struct Stop {};
+
+	public:
+		class Yielder {
+			Generator* generator;
+		public:
+			explicit Yielder(Generator* generator) : generator(generator) {}
+			// Hands the value to the consumer and returns once it asks for the next one.
+			void Yield(T value) {
+				this->generator->current = &value;
+				this->generator->SwitchToConsumer();
+				if (this->generator->stopping)
+					throw Stop{};
+			}
+		};
+
+		class Iterator {
+			Generator* generator;
+		public:
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+
+			explicit Iterator(Generator* generator = nullptr) : generator(generator) {}
+			T& operator*() const { return *this->generator->current; }
+			T* operator->() const { return this->generator->current; }
+			Iterator& operator++() {
+				this->generator->Resume();
+				return *this;
+			}
+			void operator++(int) { ++*this; }
+			bool operator==(std::default_sentinel_t) const { return this->generator->done; }
+		};
+
+	private:
+		std::function<void(Yielder&)> producer;
+		Fiber::FiberHandle fiber;
+		// where the consumer's registers are saved: its task's fiber, or threadFiber on a plain thread
+		Fiber::FiberHandle consumer = nullptr;
+		ITask* consumerTask = nullptr;
+		Fiber::FiberHandle threadFiber = nullptr;
+		// points into the producer's stack, valid until the consumer resumes it
+		T* current = nullptr;
+		std::exception_ptr error;
+		bool started = false;
+		bool done = false;
+		bool stopping = false;
+
+		static void FiberEntry(void* arg) {
+			auto* self = static_cast<Generator*>(arg);
+			try {
+				Yielder yielder(self);
+				if (!self->stopping) self->producer(yielder);
+			}
+			catch (const Stop&) {}
+			catch (...) {
+				self->error = std::current_exception();
+			}
+			self->done = true;
+			self->current = nullptr;
+			// the fiber has no caller to return to, it is never switched to again
+			self->SwitchToConsumer();
+		}
+
+		void SwitchToConsumer() {
+			if (this->consumerTask != nullptr) this->consumerTask->fiberHandle = this->consumer;
+			Fiber::SwitchToFiber(this->fiber, this->consumer);
+		}
+
+		void Resume() {
+			if (this->done)
+				return;
+			this->started = true;
+			this->consumerTask = Runtime::Current().GetCurrentContextTask();
+			if (this->consumerTask != nullptr) {
+				// the task runs on the producer's fiber until the next Yield, a park saves and resumes that
+				this->consumer = this->consumerTask->fiberHandle;
+				this->consumerTask->fiberHandle = this->fiber;
+			}
+			else {
+				if (this->threadFiber == nullptr) this->threadFiber = Fiber::CreateFiberFromThread();
+				this->consumer = this->threadFiber;
+			}
+			Fiber::SwitchToFiber(this->consumer, this->fiber);
+			if (this->error != nullptr)
+				std::rethrow_exception(std::exchange(this->error, nullptr));
+		}
+
+	public:
+		// stackSize 0 uses the current runtime's RuntimeConfig::stackSize
+		explicit Generator(std::function<void(Yielder&)> producer, unsigned int stackSize = 0)
+			: producer(std::move(producer)) {
+			if (stackSize == 0) stackSize = Runtime::Current().GetConfig().stackSize;
+			this->fiber = Fiber::CreateFiber(stackSize, FiberEntry, this);
+		}
+		Generator(const Generator&) = delete;
+		Generator& operator=(const Generator&) = delete;
+
+		~Generator() {
+			if (this->started && !this->done) {
+				this->stopping = true;
+				Resume();
+			}
+			Fiber::DeleteFiber(this->fiber);
+			Fiber::DeleteFiber(this->threadFiber);
+		}
+
+		// The next value, nullptr once the producer returned. Rethrows what the producer threw.
+		T* Next() {
+			Resume();
+			return this->current;
+		}
+
+		Iterator begin() {
+			if (!this->started) Resume();
+			return Iterator(this);
+		}
+		std::default_sentinel_t end() { return std::default_sentinel; }
+	};
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <iostream>
+#include <format>
+
+// Scheduler lifecycle messages ([INFO] lines). Define COROUTINE_SCHEDULER_NO_LOG to compile them out,
+// arguments are then not evaluated either.
+#ifndef COROUTINE_SCHEDULER_NO_LOG
+#define COROUTINE_LOG(...) (std::cout << std::format(__VA_ARGS__))
+#else
+#define COROUTINE_LOG(...) ((void)0)
+#endif
@@ -0,0 +1,276 @@
+#pragma once
+
+#if defined(__linux__)
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace CoroutineScheduler
+{
+	// The one thread of the process that issues the MappedFileReaders' madvise(MADV_WILLNEED) calls.
+	// On a file mapping the call submits the readahead itself and may wait on metadata or the block
+	// layer meanwhile, which would stall the Proc that parses.
+	class FilePrefetcher {
+		struct Range {
+			const void* owner;
+			void* address;
+			size_t length;
+		};
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<Range> queue;
+		// owner of the request being issued right now, Cancel waits until it is done
+		const void* issuing = nullptr;
+		bool started = false;
+
+		FilePrefetcher() = default;
+
+		void Loop() {
+			std::unique_lock lock(this->mtx);
+			while (true) {
+				this->cv.wait(lock, [this] { return !this->queue.empty(); });
+				Range range = this->queue.front();
+				this->queue.pop_front();
+				this->issuing = range.owner;
+				lock.unlock();
+				madvise(range.address, range.length, MADV_WILLNEED);
+				lock.lock();
+				this->issuing = nullptr;
+				this->cv.notify_all();
+			}
+		}
+
+	public:
+		// Never destroyed, readers with static storage may outlive any exit-time destructor.
+		static FilePrefetcher& Get() {
+			static FilePrefetcher* prefetcher = new FilePrefetcher();
+			return *prefetcher;
+		}
+
+		// Queues the range, 'address' on a page boundary, and returns at once.
+		void Request(const void* owner, void* address, size_t length) {
+			std::lock_guard lock(this->mtx);
+			this->queue.push_back({ owner, address, length });
+			if (!this->started) {
+				this->started = true;
+				std::thread(&FilePrefetcher::Loop, this).detach();
+			}
+			this->cv.notify_all();
+		}
+
+		// Drops the owner's queued ranges and returns once the thread no longer touches any of them.
+		void Cancel(const void* owner) {
+			std::unique_lock lock(this->mtx);
+			std::erase_if(this->queue, [owner](const Range& range) { return range.owner == owner; });
+			while (this->issuing == owner)
+				this->cv.wait(lock);
+		}
+	};
+
+	struct MappedFileReaderConfig {
+		// byte that ends a record, it is not part of the record
+		char delimiter = '\n';
+		// bytes ahead of the reader the kernel is asked to read in, 0 for none
+		size_t prefetchWindow = 4 * 1024 * 1024;
+	};
+
+	// Reads the records of a file without copying them: the file is mapped read-only and every record
+	// is a std::string_view into the mapping, valid as long as the reader. Records are found with a
+	// vectorised delimiter scan, AVX2 when the CPU has it and SSE2 otherwise.
+	//
+	// Each time the reader is halfway through the prefetch window it queues the next one with the
+	// FilePrefetcher, whose thread has the kernel read it in while the Proc parses, so the Proc seldom
+	// takes a fault on a page that is not resident yet. Such a fault still blocks the Proc like any other.
+	//
+	// The file must not be truncated while it is mapped: touching a page past its new end raises
+	// SIGBUS inside the fiber that parses, which takes the whole process down.
+	//
+	// Consumed with range-for or Next, or fed into a channel or pipeline with SendTo. A last record
+	// without a trailing delimiter is returned too. Not thread-safe.
+	class MappedFileReader {
+		using ScanFunction = const char* (*)(const char* begin, const char* end, char delimiter);
+
+		const std::string path;
+		const MappedFileReaderConfig config;
+		const ScanFunction scan;
+		const char* data = nullptr;
+		size_t size = 0;
+		size_t offset = 0;
+		// where the next window is requested, SIZE_MAX once the file's end was
+		size_t prefetchAt = SIZE_MAX;
+		// how far the FilePrefetcher was asked to read, on a page boundary or the end of the file
+		size_t prefetched = 0;
+
+		[[noreturn]] static void ThrowErrno(const std::string& what) {
+			throw std::system_error(errno, std::generic_category(), what);
+		}
+
+		static const char* ScanScalar(const char* begin, const char* end, char delimiter) {
+			while (begin < end && *begin != delimiter)
+				begin++;
+			return begin;
+		}
+
+#if defined(__x86_64__)
+		static const char* ScanSse2(const char* begin, const char* end, char delimiter) {
+			__m128i needle = _mm_set1_epi8(delimiter);
+			while (end - begin >= 16) {
+				int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin)), needle));
+				if (mask != 0)
+					return begin + __builtin_ctz(static_cast<unsigned int>(mask));
+				begin += 16;
+			}
+			return ScanScalar(begin, end, delimiter);
+		}
+
+		__attribute__((target("avx2")))
+		static const char* ScanAvx2(const char* begin, const char* end, char delimiter) {
+			__m256i needle = _mm256_set1_epi8(delimiter);
+			while (end - begin >= 32) {
+				int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin)), needle));
+				if (mask != 0)
+					return begin + __builtin_ctz(static_cast<unsigned int>(mask));
+				begin += 32;
+			}
+			return ScanSse2(begin, end, delimiter);
+		}
+#endif
+
+		static ScanFunction SelectScan() {
+#if defined(__x86_64__)
+			return __builtin_cpu_supports("avx2") ? &ScanAvx2 : &ScanSse2;
+#else
+			return &ScanScalar;
+#endif
+		}
+
+		// Asks for the window past the current offset, the next request is due halfway through it.
+		void RequestPrefetch() {
+			static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			// clamped to what is left of the file, the sum cannot wrap for any window
+			size_t ahead = std::min(this->config.prefetchWindow, this->size - this->offset);
+			size_t wanted = std::min(this->size, (this->offset + ahead + pageSize - 1) / pageSize * pageSize);
+			this->prefetchAt = wanted == this->size ? SIZE_MAX : wanted - this->config.prefetchWindow / 2;
+			if (wanted <= this->prefetched)
+				return;
+			FilePrefetcher::Get().Request(this, const_cast<char*>(this->data) + this->prefetched, wanted - this->prefetched);
+			this->prefetched = wanted;
+		}
+
+	public:
+		class Iterator {
+			MappedFileReader* reader;
+			std::optional<std::string_view> current;
+
+		public:
+			using value_type = std::string_view;
+			using difference_type = std::ptrdiff_t;
+
+			explicit Iterator(MappedFileReader* reader = nullptr) : reader(reader) {
+				if (reader != nullptr) this->current = reader->Next();
+			}
+			const std::string_view& operator*() const { return *this->current; }
+			const std::string_view* operator->() const { return &*this->current; }
+			Iterator& operator++() {
+				this->current = this->reader->Next();
+				return *this;
+			}
+			void operator++(int) { ++*this; }
+			bool operator==(std::default_sentinel_t) const { return !this->current.has_value(); }
+		};
+
+		explicit MappedFileReader(const std::string& path, const MappedFileReaderConfig& config = {})
+			: path(path), config(config), scan(SelectScan()) {
+			int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				ThrowErrno("open " + path);
+			struct stat st {};
+			if (fstat(fd, &st) != 0) {
+				int error = errno;
+				close(fd);
+				errno = error;
+				ThrowErrno("fstat " + path);
+			}
+			this->size = static_cast<size_t>(st.st_size);
+			if (this->size != 0) {
+				void* address = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+				int error = errno;
+				close(fd);
+				errno = error;
+				if (address == MAP_FAILED)
+					ThrowErrno("mmap " + path);
+				this->data = static_cast<const char*>(address);
+				// more readahead, and pages behind the reader are the first to go
+				madvise(address, this->size, MADV_SEQUENTIAL);
+			}
+			else close(fd);
+			if (this->size != 0 && this->config.prefetchWindow != 0)
+				RequestPrefetch();
+		}
+		MappedFileReader(const MappedFileReader&) = delete;
+		MappedFileReader& operator=(const MappedFileReader&) = delete;
+
+		~MappedFileReader() {
+			if (this->data == nullptr)
+				return;
+			if (this->prefetched != 0) FilePrefetcher::Get().Cancel(this);
+			munmap(const_cast<char*>(this->data), this->size);
+		}
+
+		// The next record without its delimiter, nullopt at the end of the file.
+		std::optional<std::string_view> Next() {
+			if (this->offset >= this->size)
+				return std::nullopt;
+			if (this->offset >= this->prefetchAt)
+				RequestPrefetch();
+			const char* begin = this->data + this->offset;
+			const char* end = this->data + this->size;
+			const char* found = this->scan(begin, end, this->config.delimiter);
+			this->offset = static_cast<size_t>(found - this->data) + (found != end ? 1 : 0);
+			return std::string_view(begin, static_cast<size_t>(found - begin));
+		}
+
+		Iterator begin() { return Iterator(this); }
+		std::default_sentinel_t end() { return {}; }
+
+		// Hands every remaining record to 'sink', through Send for channels and Push for pipelines,
+		// parking whenever the sink is full. Returns how many were handed over.
+		template<typename Sink>
+		size_t SendTo(Sink& sink) {
+			size_t count = 0;
+			while (std::optional<std::string_view> record = Next()) {
+				if constexpr (requires { sink.Send(*record); }) sink.Send(*record);
+				else sink.Push(*record);
+				count++;
+			}
+			return count;
+		}
+
+		// The whole mapped file, and how far into it the records were handed out.
+		std::string_view Data() const { return std::string_view(this->data, this->size); }
+		size_t Offset() const { return this->offset; }
+		size_t Size() const { return this->size; }
+		const std::string& GetPath() const { return this->path; }
+	};
+}
+#endif
@@ -0,0 +1,476 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "CoroutineScheduler.hpp"
+#include "Channel.hpp"
+#include "Stats.hpp"
+#include "Task.hpp"
+#include "Trace.hpp"
+
+namespace CoroutineScheduler
+{
+	struct PipelineStageConfig {
+		// worker coroutines running the stage function
+		unsigned int parallelism = 1;
+		// items the stage's input queue holds before whoever feeds it blocks
+		size_t buffer = 256;
+		// pass results on in the order the stage received them, parallel workers finish out of order otherwise
+		bool ordered = false;
+	};
+
+	// Counters of one stage since the pipeline started.
+	struct PipelineStageStats {
+		std::string name;
+		unsigned int parallelism = 0;
+		uint64_t itemsIn = 0;
+		// handed to the next stage, 0 for the sink
+		uint64_t itemsOut = 0;
+		uint64_t batches = 0;
+		// items waiting in the stage's input queue, and its bound
+		size_t queued = 0;
+		size_t capacity = 0;
+		// time the workers spent in the stage function, and waiting for room downstream
+		uint64_t busyNs = 0;
+		uint64_t blockedNs = 0;
+	};
+
+	template<typename T>
+	struct PipelineBatch {
+		std::vector<T> items;
+		uint64_t sequence = 0;
+		// one per worker of the receiving stage closes the stream
+		bool end = false;
+	};
+
+	// A stage's input queue. Items travel in batches of up to batchSize: a quarter of the buffer per
+	// worker, so the queue holds enough batches to keep every worker supplied.
+	template<typename T>
+	struct PipelineInlet {
+		const size_t batchSize;
+		const size_t capacity;
+		const unsigned int consumers;
+		Channel::SimpleChannel<PipelineBatch<T>> channel;
+		std::atomic<size_t> queued{ 0 };
+		// numbers the batches in queue order, guarded by the channel's lock
+		uint64_t nextSequence = 0;
+
+		static size_t BatchSizeFor(const PipelineStageConfig& config) {
+			return std::clamp<size_t>(config.buffer / (4 * std::max(1u, config.parallelism)), 1, 128);
+		}
+
+		static size_t BatchesFor(const PipelineStageConfig& config) {
+			return std::max<size_t>(1, config.buffer / BatchSizeFor(config));
+		}
+
+		explicit PipelineInlet(const PipelineStageConfig& config)
+			: batchSize(BatchSizeFor(config)), capacity(std::max<size_t>(1, config.buffer)), consumers(std::max(1u, config.parallelism)),
+			channel(static_cast<unsigned int>(BatchesFor(config))) {}
+
+		// Parks while the queue is full, returns how long that took.
+		uint64_t Send(std::vector<T> items) {
+			this->queued.fetch_add(items.size(), std::memory_order_relaxed);
+			uint64_t start = Stats::NowNs();
+			this->channel.Send(PipelineBatch<T>{ std::move(items), 0, false }, [this](PipelineBatch<T>& batch) { batch.sequence = this->nextSequence++; });
+			return Stats::NowNs() - start;
+		}
+
+		void SendEnd() {
+			for (unsigned int i = 0; i < this->consumers; i++)
+				this->channel.Send(PipelineBatch<T>{ {}, 0, true });
+		}
+	};
+
+	struct PipelineCounters {
+		std::atomic<uint64_t> itemsIn{ 0 };
+		std::atomic<uint64_t> itemsOut{ 0 };
+		std::atomic<uint64_t> batches{ 0 };
+		std::atomic<uint64_t> busyNs{ 0 };
+		std::atomic<uint64_t> blockedNs{ 0 };
+	};
+
+	// One producer's partly filled batch for the next stage. A full batch goes out, and so does a
+	// partial one whenever the next stage has nothing queued: batches stay small while it keeps up and
+	// grow up to batchSize as a backlog builds, which is when the per-batch cost matters.
+	template<typename T>
+	class PipelineOutlet {
+		PipelineInlet<T>* inlet = nullptr;
+		PipelineCounters* counters = nullptr;
+		std::vector<T> pending;
+
+	public:
+		PipelineOutlet() = default;
+		PipelineOutlet(PipelineInlet<T>* inlet, PipelineCounters* counters) : inlet(inlet), counters(counters) {
+			this->pending.reserve(inlet->batchSize);
+		}
+
+		void Add(T item) {
+			this->pending.push_back(std::move(item));
+			if (this->pending.size() >= this->inlet->batchSize || this->inlet->queued.load(std::memory_order_relaxed) == 0)
+				Flush();
+		}
+
+		void Flush() {
+			if (this->pending.empty())
+				return;
+			size_t count = this->pending.size();
+			std::vector<T> batch = std::exchange(this->pending, {});
+			this->pending.reserve(this->inlet->batchSize);
+			uint64_t blocked = this->inlet->Send(std::move(batch));
+			this->counters->itemsOut.fetch_add(count, std::memory_order_relaxed);
+			this->counters->blockedNs.fetch_add(blocked, std::memory_order_relaxed);
+		}
+	};
+
+	template<typename T>
+	struct PipelineResult { using Type = T; static constexpr bool Filters = false; };
+	template<typename T>
+	struct PipelineResult<std::optional<T>> { using Type = T; static constexpr bool Filters = true; };
+
+	class PipelineStageBase {
+	protected:
+		std::vector<ITask*> workers;
+		std::atomic<unsigned int> live{ 0 };
+		std::mutex errorMtx;
+		std::exception_ptr error;
+
+		virtual void Work() = 0;
+
+		// The failing item is dropped and the stage carries on, so the stream still drains to its end.
+		void RecordError() {
+			std::lock_guard lock(this->errorMtx);
+			if (this->error == nullptr) this->error = std::current_exception();
+		}
+
+	public:
+		const std::string name;
+		const PipelineStageConfig config;
+		// 'name' for the worker tasks, interned since trace events may outlive the stage
+		const char* const taskName;
+		PipelineCounters counters;
+
+		PipelineStageBase(std::string name, const PipelineStageConfig& config)
+			: name(std::move(name)), config(config), taskName(Trace::InternName(this->name)) {}
+		PipelineStageBase(const PipelineStageBase&) = delete;
+		PipelineStageBase& operator=(const PipelineStageBase&) = delete;
+		virtual ~PipelineStageBase() = default;
+
+		virtual size_t Queued() const = 0;
+		virtual size_t Capacity() const = 0;
+
+		void Start(Runtime& runtime) {
+			unsigned int count = std::max(1u, this->config.parallelism);
+			this->live.store(count);
+			for (unsigned int i = 0; i < count; i++) {
+				ITask* task = new Task<std::function<void()>>(this->taskName, std::function<void()>([this] { Work(); }));
+				this->workers.push_back(task);
+				runtime.AddTask(task);
+			}
+		}
+
+		// Awaits the workers, which return once the end of the stream reached them.
+		void Join(Runtime& runtime) {
+			for (ITask* task : this->workers) {
+				runtime.AwaitTask(*task);
+				if (!task->MarkForDeletion()) delete task;
+			}
+			this->workers.clear();
+		}
+
+		std::exception_ptr TakeError() {
+			std::lock_guard lock(this->errorMtx);
+			return std::exchange(this->error, nullptr);
+		}
+
+		PipelineStageStats GetStats() const {
+			PipelineStageStats stats;
+			stats.name = this->name;
+			stats.parallelism = std::max(1u, this->config.parallelism);
+			stats.itemsIn = this->counters.itemsIn.load(std::memory_order_relaxed);
+			stats.itemsOut = this->counters.itemsOut.load(std::memory_order_relaxed);
+			stats.batches = this->counters.batches.load(std::memory_order_relaxed);
+			stats.queued = Queued();
+			stats.capacity = Capacity();
+			stats.busyNs = this->counters.busyNs.load(std::memory_order_relaxed);
+			stats.blockedNs = this->counters.blockedNs.load(std::memory_order_relaxed);
+			return stats;
+		}
+	};
+
+	// Out is void for the sink.
+	template<typename In, typename Out, typename F>
+	class PipelineStage : public PipelineStageBase {
+		using NextInlet = std::conditional_t<std::is_void_v<Out>, void, PipelineInlet<Out>>;
+		// int stands in for the sink's missing output, nothing of that type is ever stored
+		using Item = std::conditional_t<std::is_void_v<Out>, int, Out>;
+		using Results = std::vector<Item>;
+
+		F function;
+
+		// ordered stages release results by input sequence; whoever finds the next one missing leaves
+		// its results here for the worker that is releasing
+		std::mutex reorderMtx;
+		std::map<uint64_t, Results> reorder;
+		uint64_t nextRelease = 0;
+		bool releasing = false;
+		// one slot per batch taken but not yet released: an ordered worker parks for a slot before it
+		// takes input, so a slow batch holds up at most this many behind it in 'reorder'
+		Channel::SimpleChannel<bool> window;
+
+		static unsigned int WindowFor(const PipelineStageConfig& config) {
+			return static_cast<unsigned int>(std::max<size_t>(PipelineInlet<In>::BatchesFor(config), std::max(1u, config.parallelism)));
+		}
+
+		void Release(uint64_t sequence, Results results) {
+			std::unique_lock lock(this->reorderMtx);
+			this->reorder.emplace(sequence, std::move(results));
+			if (this->releasing)
+				return;
+			this->releasing = true;
+			while (!this->reorder.empty() && this->reorder.begin()->first == this->nextRelease) {
+				auto node = this->reorder.extract(this->reorder.begin());
+				this->nextRelease++;
+				// the send may park, it must not hold the lock
+				lock.unlock();
+				if (!node.mapped().empty()) {
+					size_t count = node.mapped().size();
+					uint64_t blocked = this->next->Send(std::move(node.mapped()));
+					this->counters.itemsOut.fetch_add(count, std::memory_order_relaxed);
+					this->counters.blockedNs.fetch_add(blocked, std::memory_order_relaxed);
+				}
+				this->window.TryReceive();
+				lock.lock();
+			}
+			this->releasing = false;
+		}
+
+		void Apply(In& item, Results& results) {
+			try {
+				if constexpr (std::is_void_v<Out>)
+					this->function(std::move(item));
+				else if constexpr (PipelineResult<std::invoke_result_t<F&, In>>::Filters) {
+					if (auto result = this->function(std::move(item)); result.has_value())
+						results.push_back(std::move(*result));
+				}
+				else results.push_back(this->function(std::move(item)));
+			}
+			catch (...) {
+				RecordError();
+			}
+		}
+
+		void Work() override {
+			PipelineOutlet<Item> outlet;
+			if constexpr (!std::is_void_v<Out>)
+				if (!this->config.ordered) outlet = PipelineOutlet<Item>(this->next, &this->counters);
+			Results results;
+			while (true) {
+				if constexpr (!std::is_void_v<Out>) {
+					if (this->config.ordered) {
+						uint64_t start = Stats::NowNs();
+						this->window.Send(true);
+						this->counters.blockedNs.fetch_add(Stats::NowNs() - start, std::memory_order_relaxed);
+					}
+				}
+				std::optional<PipelineBatch<In>> received = this->inlet.channel.TryReceive();
+				if (!received.has_value()) {
+					// about to wait for input, what was batched so far must not wait with it
+					if constexpr (!std::is_void_v<Out>) outlet.Flush();
+					received = this->inlet.channel.Receive();
+				}
+				PipelineBatch<In>& batch = *received;
+				if (batch.end) {
+					if constexpr (!std::is_void_v<Out>)
+						if (this->config.ordered) this->window.TryReceive();
+					break;
+				}
+				size_t count = batch.items.size();
+				this->inlet.queued.fetch_sub(count, std::memory_order_relaxed);
+				this->counters.itemsIn.fetch_add(count, std::memory_order_relaxed);
+				this->counters.batches.fetch_add(1, std::memory_order_relaxed);
+
+				uint64_t start = Stats::NowNs();
+				results.clear();
+				for (In& item : batch.items)
+					Apply(item, results);
+				this->counters.busyNs.fetch_add(Stats::NowNs() - start, std::memory_order_relaxed);
+
+				if constexpr (!std::is_void_v<Out>) {
+					if (this->config.ordered) Release(batch.sequence, std::exchange(results, {}));
+					else for (auto& result : results) outlet.Add(std::move(result));
+				}
+			}
+			if constexpr (!std::is_void_v<Out>) {
+				outlet.Flush();
+				// the last worker out has seen every other worker's results sent
+				if (this->live.fetch_sub(1) == 1) this->next->SendEnd();
+			}
+		}
+
+	public:
+		PipelineInlet<In> inlet;
+		NextInlet* next = nullptr;
+
+		PipelineStage(std::string name, const PipelineStageConfig& config, F function)
+			: PipelineStageBase(std::move(name), config), function(std::move(function)), window(WindowFor(config)), inlet(config) {}
+
+		size_t Queued() const override { return this->inlet.queued.load(std::memory_order_relaxed); }
+		size_t Capacity() const override { return this->inlet.capacity; }
+	};
+
+	template<typename Source, typename Current>
+	class PipelineBuilder;
+
+	// A chain of stages connected by bounded queues, fed through Push by one producer at a time. Each
+	// stage runs its function on 'parallelism' coroutines; a full queue parks whoever feeds it, so a
+	// slow sink holds back every stage before it and finally Push. Stage functions return the next
+	// stage's item, or an optional of it to drop items. An exception drops the item, the first one is
+	// rethrown by Close. Built with PipelineBuilder.
+	template<typename Source>
+	class Pipeline {
+		template<typename, typename> friend class PipelineBuilder;
+
+		Runtime& runtime;
+		const std::string name;
+		std::vector<std::unique_ptr<PipelineStageBase>> stages;
+		PipelineInlet<Source>* first = nullptr;
+		PipelineCounters sourceCounters;
+		PipelineOutlet<Source> source;
+		// until Start, a builder given up on leaves nothing to close
+		bool closed = true;
+
+		Pipeline(std::string name, Runtime& runtime) : runtime(runtime), name(std::move(name)) {}
+
+		void Start() {
+			this->source = PipelineOutlet<Source>(this->first, &this->sourceCounters);
+			this->closed = false;
+			for (auto& stage : this->stages)
+				stage->Start(this->runtime);
+		}
+
+	public:
+		Pipeline(const Pipeline&) = delete;
+		Pipeline& operator=(const Pipeline&) = delete;
+
+		~Pipeline() {
+			try {
+				Close();
+			}
+			catch (...) {}
+		}
+
+		const std::string& GetName() const { return this->name; }
+
+		// Parks, or blocks outside the runtime, while the first stage's queue is full.
+		void Push(Source item) {
+			this->sourceCounters.itemsIn.fetch_add(1, std::memory_order_relaxed);
+			this->source.Add(std::move(item));
+		}
+
+		// Hands on a partly filled batch without waiting for more items.
+		void Flush() { this->source.Flush(); }
+
+		// Ends the stream and returns once every stage has drained it. Rethrows the first exception a
+		// stage function threw.
+		void Close() {
+			if (this->closed)
+				return;
+			this->closed = true;
+			this->source.Flush();
+			this->first->SendEnd();
+			for (auto& stage : this->stages)
+				stage->Join(this->runtime);
+			for (auto& stage : this->stages)
+				if (auto error = stage->TakeError(); error != nullptr)
+					std::rethrow_exception(error);
+		}
+
+		// The source first, with what was pushed and how long Push waited, then every stage in order.
+		std::vector<PipelineStageStats> GetStats() const {
+			std::vector<PipelineStageStats> stats;
+			PipelineStageStats source;
+			source.name = "source";
+			source.parallelism = 1;
+			source.itemsIn = this->sourceCounters.itemsIn.load(std::memory_order_relaxed);
+			source.itemsOut = this->sourceCounters.itemsOut.load(std::memory_order_relaxed);
+			source.blockedNs = this->sourceCounters.blockedNs.load(std::memory_order_relaxed);
+			stats.push_back(std::move(source));
+			for (auto& stage : this->stages)
+				stats.push_back(stage->GetStats());
+			return stats;
+		}
+
+		// The stage whose workers were busiest for their number, the one to give more parallelism.
+		std::string Bottleneck() const {
+			const PipelineStageBase* busiest = nullptr;
+			uint64_t most = 0;
+			for (auto& stage : this->stages) {
+				uint64_t perWorker = stage->counters.busyNs.load(std::memory_order_relaxed) / std::max(1u, stage->config.parallelism);
+				if (busiest == nullptr || perWorker > most) {
+					busiest = stage.get();
+					most = perWorker;
+				}
+			}
+			return busiest == nullptr ? std::string() : busiest->name;
+		}
+	};
+
+	// Declares a pipeline stage by stage, from the type pushed into it to a sink that consumes the
+	// last stage's items. Sink starts the workers and returns the running pipeline.
+	//
+	//   auto pipeline = PipelineBuilder<std::string>("ingest")
+	//       .Stage("parse", Parse, { .parallelism = 4, .ordered = true })
+	//       .Stage("enrich", Enrich, { .parallelism = 8, .buffer = 1024 })
+	//       .Sink("write", Write);
+	template<typename Source, typename Current = Source>
+	class PipelineBuilder {
+		template<typename, typename> friend class PipelineBuilder;
+
+		std::unique_ptr<Pipeline<Source>> pipeline;
+		// where the previous stage's output gets connected
+		PipelineInlet<Current>** tail;
+
+		PipelineBuilder(std::unique_ptr<Pipeline<Source>> pipeline, PipelineInlet<Current>** tail)
+			: pipeline(std::move(pipeline)), tail(tail) {}
+
+		template<typename Out, typename F>
+		PipelineStage<Current, Out, std::decay_t<F>>* Append(std::string name, F&& function, const PipelineStageConfig& config) {
+			auto stage = std::make_unique<PipelineStage<Current, Out, std::decay_t<F>>>(std::move(name), config, std::forward<F>(function));
+			auto* raw = stage.get();
+			*this->tail = &raw->inlet;
+			this->pipeline->stages.push_back(std::move(stage));
+			return raw;
+		}
+
+	public:
+		explicit PipelineBuilder(std::string name, Runtime& runtime = Runtime::Current()) requires std::is_same_v<Source, Current>
+			: pipeline(new Pipeline<Source>(std::move(name), runtime)), tail(&this->pipeline->first) {}
+
+		template<typename F>
+		auto Stage(std::string name, F&& function, const PipelineStageConfig& config = {}) && {
+			using Out = typename PipelineResult<std::invoke_result_t<std::decay_t<F>&, Current>>::Type;
+			static_assert(!std::is_void_v<Out>, "only the sink may return void");
+			auto* stage = Append<Out>(std::move(name), std::forward<F>(function), config);
+			return PipelineBuilder<Source, Out>(std::move(this->pipeline), &stage->next);
+		}
+
+		template<typename F>
+		std::unique_ptr<Pipeline<Source>> Sink(std::string name, F&& function, const PipelineStageConfig& config = {}) && {
+			Append<void>(std::move(name), std::forward<F>(function), config);
+			this->pipeline->Start();
+			return std::move(this->pipeline);
+		}
+	};
+}
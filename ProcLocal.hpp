@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "CoroutineScheduler.hpp"
+
+namespace CoroutineScheduler
+{
+	// One T per Proc of a runtime, each on cache lines of its own, for counters and caches every
+	// coroutine updates: a coroutine only touches the instance of the Proc it runs on, without atomics
+	// or locks. Coroutines move between Procs only when they park, so an instance stays the caller's
+	// until its next blocking call (a channel, Sleep, Await, Yield). Threads outside the runtime share
+	// one extra instance under a lock.
+	//
+	// ForEach and Reduce read every instance while the Procs may be writing theirs. For exact totals
+	// while running, keep the fields std::atomic and update them with relaxed load and store, which
+	// costs the owner no more than plain accesses.
+	template<typename T>
+	class ProcLocal {
+		struct alignas(64) Instance {
+			T value;
+		};
+
+		Runtime& runtime;
+		const unsigned int procs;
+		// one per Proc by id, then the one shared by outside threads
+		std::unique_ptr<Instance[]> instances;
+		std::mutex externalMtx;
+
+		// Marks the calling task as not allowed to park while it holds its Proc's instance, so that
+		// blocking inside With trips an assert instead of resuming on another Proc.
+		struct NoPark {
+			ITask* const task;
+			explicit NoPark(ITask* task) : task(task) { if (task != nullptr) task->noPark++; }
+			~NoPark() { if (this->task != nullptr) this->task->noPark--; }
+		};
+
+		Instance* Own() {
+			Proc* proc = Runtime::CurrentProc();
+			if (proc != nullptr && proc->runtime == &this->runtime && proc->id < this->procs)
+				return &this->instances[proc->id];
+			return nullptr;
+		}
+
+	public:
+		explicit ProcLocal(Runtime& runtime = Runtime::Current())
+			: runtime(runtime), procs(runtime.GetWorkerCount()), instances(new Instance[runtime.GetWorkerCount() + 1]) {}
+		explicit ProcLocal(const T& initial, Runtime& runtime = Runtime::Current()) : ProcLocal(runtime) {
+			for (unsigned int i = 0; i <= this->procs; i++)
+				this->instances[i].value = initial;
+		}
+		ProcLocal(const ProcLocal&) = delete;
+		ProcLocal& operator=(const ProcLocal&) = delete;
+
+		// Runs fn on the calling Proc's instance and returns its result. fn must not block, the
+		// coroutine could resume on another Proc while still holding this one's instance; without
+		// NDEBUG parking inside fn fails an assert.
+		template<typename F>
+		decltype(auto) With(F&& fn) {
+			if (Instance* own = Own()) {
+#ifndef NDEBUG
+				NoPark noPark(this->runtime.GetCurrentContextTask());
+#endif
+				return std::forward<F>(fn)(own->value);
+			}
+			std::lock_guard lock(this->externalMtx);
+			return std::forward<F>(fn)(this->instances[this->procs].value);
+		}
+
+		// The calling Proc's instance, valid until the caller next blocks. nullptr outside the
+		// runtime's Procs, use With there.
+		T* Local() {
+			Instance* own = Own();
+			return own != nullptr ? &own->value : nullptr;
+		}
+
+		// Every Proc's instance by Proc id, then the outside threads' one.
+		template<typename F>
+		void ForEach(F&& fn) {
+			for (unsigned int i = 0; i < this->procs; i++)
+				fn(this->instances[i].value);
+			std::lock_guard lock(this->externalMtx);
+			fn(this->instances[this->procs].value);
+		}
+
+		template<typename R, typename F>
+		R Reduce(R initial, F&& fn) {
+			ForEach([&](T& value) { initial = fn(std::move(initial), value); });
+			return initial;
+		}
+
+		// instances, one per Proc plus the outside threads' one
+		size_t Size() const { return static_cast<size_t>(this->procs) + 1; }
+	};
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace CoroutineScheduler
+{
+	// FIFO over a power-of-two ring that doubles when full. Unlike std::deque it allocates
+	// nothing while it stays under its reserved capacity. The ring is raw storage, values are only
+	// constructed while queued, so T just has to be move constructible. Not thread-safe.
+	template<typename T>
+	class RingQueue {
+		T* items = nullptr;
+		size_t mask = 0;
+		size_t head = 0;
+		size_t count = 0;
+
+		void Release() {
+			for (size_t i = 0; i < this->count; i++)
+				std::destroy_at(&this->items[(this->head + i) & this->mask]);
+			if (this->items != nullptr)
+				std::allocator<T>().deallocate(this->items, this->mask + 1);
+		}
+
+	public:
+		explicit RingQueue(size_t initialCapacity = 64) {
+			Reserve(initialCapacity);
+		}
+		RingQueue(RingQueue&& other) noexcept
+			: items(std::exchange(other.items, nullptr)), mask(std::exchange(other.mask, 0)),
+			head(std::exchange(other.head, 0)), count(std::exchange(other.count, 0)) {}
+		RingQueue& operator=(RingQueue&& other) noexcept {
+			if (this != &other) {
+				Release();
+				this->items = std::exchange(other.items, nullptr);
+				this->mask = std::exchange(other.mask, 0);
+				this->head = std::exchange(other.head, 0);
+				this->count = std::exchange(other.count, 0);
+			}
+			return *this;
+		}
+		RingQueue(const RingQueue&) = delete;
+		RingQueue& operator=(const RingQueue&) = delete;
+		~RingQueue() {
+			Release();
+		}
+
+		void Reserve(size_t capacity) {
+			size_t cap = 1;
+			while (cap < capacity) cap <<= 1;
+			if (this->items != nullptr && cap <= this->mask + 1)
+				return;
+			T* grown = std::allocator<T>().allocate(cap);
+			for (size_t i = 0; i < this->count; i++) {
+				T& item = this->items[(this->head + i) & this->mask];
+				std::construct_at(&grown[i], std::move(item));
+				std::destroy_at(&item);
+			}
+			if (this->items != nullptr)
+				std::allocator<T>().deallocate(this->items, this->mask + 1);
+			this->items = grown;
+			this->mask = cap - 1;
+			this->head = 0;
+		}
+
+		void PushBack(T value) {
+			if (this->items == nullptr || this->count == this->mask + 1)
+				Reserve((this->mask + 1) * 2);
+			std::construct_at(&this->items[(this->head + this->count) & this->mask], std::move(value));
+			this->count++;
+		}
+
+		T PopFront() {
+			T& item = this->items[this->head];
+			T value = std::move(item);
+			std::destroy_at(&item);
+			this->head = (this->head + 1) & this->mask;
+			this->count--;
+			return value;
+		}
+
+		T& Front() { return this->items[this->head]; }
+		bool Empty() const { return this->count == 0; }
+		size_t Size() const { return this->count; }
+	};
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Task.hpp"
+#include "RingQueue.hpp"
+
+namespace CoroutineScheduler
+{
+	// Runnable tasks split by class: a FIFO per TaskPriority plus an earliest-deadline-first heap for
+	// tasks spawned with a deadline. Classes share the Procs by stride scheduling, every pop charges the
+	// class 1/weight, so with weights 8:4:1 a saturated background class still gets 1 slot in 13 while
+	// an idle class cannot bank credit for later. Not thread-safe.
+	class RunQueue {
+	public:
+		static constexpr size_t ClassCount = PriorityClassCount + 1;
+		static constexpr size_t DeadlineClass = PriorityClassCount;
+
+	private:
+		static constexpr uint64_t StrideScale = 1 << 20;
+
+		struct DeadlineEntry {
+			uint64_t deadline;
+			uint64_t sequence;
+			ITask* task;
+			// std heaps are max-heaps, so "less" means a later deadline
+			bool operator<(const DeadlineEntry& other) const {
+				return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+			}
+		};
+
+		RingQueue<ITask*> fifo[PriorityClassCount];
+		std::vector<DeadlineEntry> deadlines;
+		uint64_t deadlineSequence = 0;
+		uint64_t stride[ClassCount];
+		uint64_t pass[ClassCount] = {};
+		size_t count = 0;
+
+		size_t ClassSize(size_t cls) const {
+			return cls == DeadlineClass ? this->deadlines.size() : this->fifo[cls].Size();
+		}
+
+	public:
+		// weights are indexed by TaskPriority with the deadline class last, a weight of 0 counts as 1
+		RunQueue(size_t initialCapacity, const unsigned int (&weights)[ClassCount]) {
+			for (size_t cls = 0; cls < PriorityClassCount; cls++)
+				this->fifo[cls] = RingQueue<ITask*>(cls == TaskPriority::PriorityNormal ? initialCapacity : 16);
+			this->deadlines.reserve(16);
+			for (size_t cls = 0; cls < ClassCount; cls++)
+				this->stride[cls] = StrideScale / std::max(1u, weights[cls]);
+		}
+
+		void PushBack(ITask* task) {
+			size_t cls = task != nullptr && task->deadline != 0 ? DeadlineClass
+				: task != nullptr ? static_cast<size_t>(task->priority) : static_cast<size_t>(TaskPriority::PriorityNormal);
+			if (ClassSize(cls) == 0) {
+				// a class coming back from idle starts level with the least served busy class
+				uint64_t floor = UINT64_MAX;
+				for (size_t c = 0; c < ClassCount; c++)
+					if (ClassSize(c) != 0) floor = std::min(floor, this->pass[c]);
+				if (floor != UINT64_MAX) this->pass[cls] = std::max(this->pass[cls], floor);
+			}
+			if (cls == DeadlineClass) {
+				this->deadlines.push_back({ task->deadline, this->deadlineSequence++, task });
+				std::push_heap(this->deadlines.begin(), this->deadlines.end());
+			}
+			else this->fifo[cls].PushBack(task);
+			this->count++;
+		}
+
+		ITask* PopFront() {
+			size_t pick = ClassCount;
+			for (size_t cls = 0; cls < ClassCount; cls++) {
+				if (ClassSize(cls) != 0 && (pick == ClassCount || this->pass[cls] < this->pass[pick]))
+					pick = cls;
+			}
+			this->pass[pick] += this->stride[pick];
+			this->count--;
+			if (pick == DeadlineClass) {
+				std::pop_heap(this->deadlines.begin(), this->deadlines.end());
+				ITask* task = this->deadlines.back().task;
+				this->deadlines.pop_back();
+				return task;
+			}
+			return this->fifo[pick].PopFront();
+		}
+
+		bool Empty() const { return this->count == 0; }
+		size_t Size() const { return this->count; }
+	};
+}
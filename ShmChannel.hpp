@@ -0,0 +1,474 @@
+#pragma once
+
+#if defined(__linux__)
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "CoroutineScheduler.hpp"
+#include "Stats.hpp"
+#include "Task.hpp"
+
+namespace CoroutineScheduler
+{
+namespace Channel
+{
+	// The one thread of the process that sleeps on the futex words of every ShmChannel segment with
+	// parked coroutines, all at once with futex_waitv, and wakes them once they can proceed.
+	class ShmPoller {
+	public:
+		class Endpoint {
+		public:
+			// Wakes the parked coroutines that can proceed, false once none is left parked.
+			virtual bool WakeReady() = 0;
+			// true when a parked coroutine could proceed
+			virtual bool HasReady() = 0;
+			// the segment's futex word and its count of sleepers, see ShmChannel::Header
+			virtual std::atomic<uint32_t>& Events() = 0;
+			virtual std::atomic<uint32_t>& Sleepers() = 0;
+		protected:
+			~Endpoint() = default;
+		};
+
+	private:
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::vector<Endpoint*> watched;
+		// what the thread sleeps on right now, an endpoint going away waits until it is off the list
+		std::vector<Endpoint*> sleepingOn;
+		// process-private futex word bumped to interrupt the sleep when the watch list changes
+		std::atomic<uint32_t> kick{ 0 };
+		bool started = false;
+
+		void Kick() {
+			this->kick.fetch_add(1);
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&this->kick), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+		}
+
+		// Sleeps until the kick word or any of the events words changes. Without futex_waitv (before
+		// Linux 5.16), or with more segments than it takes, it polls every millisecond instead.
+		void Sleep(uint32_t kickSeen, const std::vector<uint32_t>& seen) {
+#if defined(SYS_futex_waitv) && defined(FUTEX_WAITV_MAX)
+			if (this->sleepingOn.size() < FUTEX_WAITV_MAX) {
+				struct futex_waitv waiters[FUTEX_WAITV_MAX] = {};
+				waiters[0] = { kickSeen, reinterpret_cast<uintptr_t>(&this->kick), FUTEX_32 | FUTEX_PRIVATE_FLAG, 0 };
+				for (size_t i = 0; i < this->sleepingOn.size(); i++)
+					waiters[i + 1] = { seen[i], reinterpret_cast<uintptr_t>(&this->sleepingOn[i]->Events()), FUTEX_32, 0 };
+				if (syscall(SYS_futex_waitv, waiters, this->sleepingOn.size() + 1, 0, nullptr, 0) >= 0 || errno != ENOSYS)
+					return;
+			}
+#else
+			(void)seen;
+#endif
+			timespec poll{ 0, 1000000 };
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&this->kick), FUTEX_WAIT_PRIVATE, kickSeen, &poll, nullptr, 0);
+		}
+
+		void Loop() {
+			std::unique_lock lock(this->mtx);
+			std::vector<uint32_t> seen;
+			while (true) {
+				if (this->watched.empty()) {
+					this->cv.wait(lock);
+					continue;
+				}
+				std::erase_if(this->watched, [](Endpoint* endpoint) { return !endpoint->WakeReady(); });
+				if (this->watched.empty())
+					continue;
+				uint32_t kickSeen = this->kick.load();
+				this->sleepingOn = this->watched;
+				seen.clear();
+				for (Endpoint* endpoint : this->sleepingOn) {
+					seen.push_back(endpoint->Events().load());
+					endpoint->Sleepers().fetch_add(1);
+				}
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				// a send or receive from before the sleeper was counted did not bump events, look once more
+				bool ready = std::any_of(this->sleepingOn.begin(), this->sleepingOn.end(), [](Endpoint* endpoint) { return endpoint->HasReady(); });
+				lock.unlock();
+				if (!ready) Sleep(kickSeen, seen);
+				lock.lock();
+				for (Endpoint* endpoint : this->sleepingOn)
+					endpoint->Sleepers().fetch_sub(1);
+				this->sleepingOn.clear();
+				this->cv.notify_all();
+			}
+		}
+
+	public:
+		// Never destroyed, endpoints with static storage may outlive any exit-time destructor.
+		static ShmPoller& Get() {
+			static ShmPoller* poller = new ShmPoller();
+			return *poller;
+		}
+
+		// Has the endpoint's parked coroutines woken once they can proceed, until it has none left.
+		void Watch(Endpoint* endpoint) {
+			std::lock_guard lock(this->mtx);
+			if (std::find(this->watched.begin(), this->watched.end(), endpoint) != this->watched.end())
+				return;
+			this->watched.push_back(endpoint);
+			if (!this->started) {
+				this->started = true;
+				std::thread(&ShmPoller::Loop, this).detach();
+			}
+			this->cv.notify_all();
+			Kick();
+		}
+
+		// Returns once the thread no longer touches the endpoint.
+		void Unwatch(Endpoint* endpoint) {
+			std::unique_lock lock(this->mtx);
+			std::erase(this->watched, endpoint);
+			while (std::find(this->sleepingOn.begin(), this->sleepingOn.end(), endpoint) != this->sleepingOn.end()) {
+				Kick();
+				this->cv.wait(lock);
+			}
+		}
+	};
+
+	// Channel between processes on one host: a lock-free bounded MPMC ring (one sequence number per
+	// cell) in a POSIX shared memory segment, so a message is one copy into the ring and one out.
+	// Send and Receive block like SimpleChannel's: coroutines park and plain threads block.
+	//
+	// While the other side is active a caller finds its slot or value within the spin window and
+	// never enters the kernel; a spinning coroutine yields to the others of its Proc meanwhile. Past
+	// it, a coroutine parks on the runtime and the process's ShmPoller thread sleeps on a futex in the
+	// segment, which every send and receive bumps while anybody sleeps on it, and wakes the coroutines
+	// once they can proceed. Waiters of the same process are woken directly, without the futex.
+	//
+	// The first endpoint opened under a name creates the segment, later ones map it and ignore
+	// 'capacity'. The segment outlives the endpoints until Unlink. On a single CPU the other process
+	// cannot make progress while the caller spins, so there is no spin window there.
+	template<typename T>
+	class ShmChannel : private ShmPoller::Endpoint {
+		static_assert(std::is_trivially_copyable_v<T>, "ShmChannel copies values between processes byte for byte");
+		static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+			"the ring's atomics must be lock-free to work across processes");
+
+		static constexpr uint64_t Magic = 0x314e414843534d43; // "CMSCHAN1"
+
+		struct Cell {
+			std::atomic<uint64_t> sequence;
+			// the bytes of a T, values are only ever copied in and out
+			alignas(T) unsigned char value[sizeof(T)];
+		};
+
+		struct Header {
+			uint64_t magic;
+			uint64_t capacity;
+			uint32_t cellSize;
+			std::atomic<uint32_t> ready;
+			alignas(64) std::atomic<uint64_t> enqueuePos;
+			alignas(64) std::atomic<uint64_t> dequeuePos;
+			// the futex word, and how many threads of any process sleep on it
+			alignas(64) std::atomic<uint32_t> events;
+			std::atomic<uint32_t> sleepers;
+		};
+
+		const std::string name;
+		const std::chrono::nanoseconds spin;
+		int fd = -1;
+		size_t mappedSize = 0;
+		Header* header = nullptr;
+		Cell* cells = nullptr;
+		uint64_t mask = 0;
+
+		// this endpoint's parked coroutines, the ShmPoller watches the futex for them
+		std::mutex mtx;
+		WaitQueue senderWaitQueue;
+		WaitQueue receiverWaitQueue;
+		std::atomic<unsigned int> localWaiters{ 0 };
+
+		static size_t SegmentSize(uint64_t capacity) {
+			return sizeof(Header) + capacity * sizeof(Cell);
+		}
+
+		static void FutexWait(std::atomic<uint32_t>* word, uint32_t expected) {
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+		}
+
+		static void FutexWakeAll(std::atomic<uint32_t>* word) {
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+		}
+
+		static void CpuRelax() {
+#if defined(__x86_64__)
+			__builtin_ia32_pause();
+#endif
+		}
+
+		[[noreturn]] static void ThrowErrno(const std::string& what) {
+			throw std::system_error(errno, std::generic_category(), what);
+		}
+
+		void Map(size_t size) {
+			void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+			if (address == MAP_FAILED)
+				ThrowErrno("mmap " + this->name);
+			this->mappedSize = size;
+			this->header = static_cast<Header*>(address);
+			this->cells = reinterpret_cast<Cell*>(static_cast<char*>(address) + sizeof(Header));
+		}
+
+		void Create(uint64_t capacity) {
+			if (ftruncate(this->fd, static_cast<off_t>(SegmentSize(capacity))) != 0)
+				ThrowErrno("ftruncate " + this->name);
+			Map(SegmentSize(capacity));
+			Header* h = new (this->header) Header();
+			h->magic = Magic;
+			h->capacity = capacity;
+			h->cellSize = sizeof(Cell);
+			for (uint64_t i = 0; i < capacity; i++)
+				new (&this->cells[i]) Cell{ i, {} };
+			h->ready.store(1, std::memory_order_release);
+		}
+
+		// Another process may still be creating the segment, it is usable once its header is ready.
+		void Open() {
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			struct stat st {};
+			while (true) {
+				if (fstat(this->fd, &st) != 0)
+					ThrowErrno("fstat " + this->name);
+				if (static_cast<size_t>(st.st_size) >= sizeof(Header)) break;
+				if (std::chrono::steady_clock::now() > deadline)
+					throw std::runtime_error("ShmChannel " + this->name + " was never initialized");
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			Map(static_cast<size_t>(st.st_size));
+			while (this->header->ready.load(std::memory_order_acquire) == 0) {
+				if (std::chrono::steady_clock::now() > deadline)
+					throw std::runtime_error("ShmChannel " + this->name + " was never initialized");
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			if (this->header->magic != Magic || this->header->cellSize != sizeof(Cell) || SegmentSize(this->header->capacity) > this->mappedSize)
+				throw std::runtime_error("ShmChannel " + this->name + " holds another type of value");
+		}
+
+		bool TryPush(const T& value) {
+			uint64_t pos = this->header->enqueuePos.load(std::memory_order_relaxed);
+			Cell* cell;
+			while (true) {
+				cell = &this->cells[pos & this->mask];
+				int64_t diff = static_cast<int64_t>(cell->sequence.load(std::memory_order_acquire) - pos);
+				if (diff == 0) {
+					if (this->header->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+				}
+				else if (diff < 0) return false;
+				else pos = this->header->enqueuePos.load(std::memory_order_relaxed);
+			}
+			std::memcpy(cell->value, &value, sizeof(T));
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		std::optional<T> TryPop() {
+			uint64_t pos = this->header->dequeuePos.load(std::memory_order_relaxed);
+			Cell* cell;
+			while (true) {
+				cell = &this->cells[pos & this->mask];
+				int64_t diff = static_cast<int64_t>(cell->sequence.load(std::memory_order_acquire) - (pos + 1));
+				if (diff == 0) {
+					if (this->header->dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+				}
+				else if (diff < 0) return std::nullopt;
+				else pos = this->header->dequeuePos.load(std::memory_order_relaxed);
+			}
+			std::optional<T> value(std::bit_cast<T>(cell->value));
+			cell->sequence.store(pos + this->mask + 1, std::memory_order_release);
+			return value;
+		}
+
+		bool Readable() const {
+			uint64_t pos = this->header->dequeuePos.load(std::memory_order_acquire);
+			return this->cells[pos & this->mask].sequence.load(std::memory_order_acquire) == pos + 1;
+		}
+
+		bool Writable() const {
+			uint64_t pos = this->header->enqueuePos.load(std::memory_order_acquire);
+			return this->cells[pos & this->mask].sequence.load(std::memory_order_acquire) == pos;
+		}
+
+		// After a push or a pop: one local waiter of the other side, then sleepers of any process.
+		void Signal(WaitQueue& waitQueue) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (this->localWaiters.load(std::memory_order_relaxed) != 0) {
+				std::lock_guard lock(this->mtx);
+				if (ITask* task = waitQueue.PopFront()) {
+					this->localWaiters.fetch_sub(1);
+					Runtime::Wake(task);
+				}
+			}
+			if (this->header->sleepers.load(std::memory_order_relaxed) != 0) {
+				this->header->events.fetch_add(1);
+				FutexWakeAll(&this->header->events);
+			}
+		}
+
+		// Called with mtx held.
+		void WakeAll(WaitQueue& waitQueue) {
+			while (ITask* task = waitQueue.PopFront()) {
+				this->localWaiters.fetch_sub(1);
+				Runtime::Wake(task);
+			}
+		}
+
+		bool WakeReady() override {
+			std::lock_guard lock(this->mtx);
+			if (!this->receiverWaitQueue.Empty() && Readable()) WakeAll(this->receiverWaitQueue);
+			if (!this->senderWaitQueue.Empty() && Writable()) WakeAll(this->senderWaitQueue);
+			return !this->receiverWaitQueue.Empty() || !this->senderWaitQueue.Empty();
+		}
+
+		bool HasReady() override {
+			std::lock_guard lock(this->mtx);
+			return (!this->receiverWaitQueue.Empty() && Readable()) || (!this->senderWaitQueue.Empty() && Writable());
+		}
+
+		std::atomic<uint32_t>& Events() override { return this->header->events; }
+		std::atomic<uint32_t>& Sleepers() override { return this->header->sleepers; }
+
+		// Spins through the spin window, then parks the coroutine or blocks the thread until 'ready'
+		// may hold. The caller tries again, another waiter may have been faster.
+		void Wait(WaitQueue& waitQueue, bool (ShmChannel::* ready)() const) {
+			auto& runtime = Runtime::Current();
+			uint64_t spinUntil = Stats::NowNs() + static_cast<uint64_t>(this->spin.count());
+			for (unsigned int i = 1; ; i++) {
+				if ((this->*ready)()) return;
+				if ((i & 63) == 0) {
+					if (Stats::NowNs() >= spinUntil) break;
+					// the Proc's other coroutines run meanwhile, only an idle Proc really spins
+					runtime.YieldCurrentTask();
+				}
+				else CpuRelax();
+			}
+			ITask* current = runtime.GetCurrentContextTask();
+			if (current == nullptr) {
+				uint32_t seen = this->header->events.load();
+				this->header->sleepers.fetch_add(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (!(this->*ready)()) FutexWait(&this->header->events, seen);
+				this->header->sleepers.fetch_sub(1);
+				return;
+			}
+			if (current->IsCancelled())
+				throw CancelledError();
+			{
+				std::lock_guard lock(this->mtx);
+				waitQueue.PushBack(current);
+				this->localWaiters.fetch_add(1);
+			}
+			ShmPoller::Get().Watch(this);
+			if ((this->*ready)()) {
+				std::lock_guard lock(this->mtx);
+				// not there any more means it was popped and woken, the park below consumes that wake
+				if (waitQueue.Remove(current)) {
+					this->localWaiters.fetch_sub(1);
+					return;
+				}
+			}
+			runtime.PreemptCurrentTask(ParkReason::ParkChannel);
+			{
+				std::lock_guard lock(this->mtx);
+				if (waitQueue.Remove(current)) this->localWaiters.fetch_sub(1);
+			}
+			if (current->IsCancelled())
+				throw CancelledError();
+		}
+
+	public:
+		ShmChannel(const std::string& name, size_t capacity = 1024, std::chrono::nanoseconds spin = std::chrono::microseconds(20))
+			: name(name.starts_with('/') ? name : "/" + name), spin(std::thread::hardware_concurrency() > 1 ? spin : std::chrono::nanoseconds(0)) {
+			uint64_t cap = 1;
+			while (cap < std::max<size_t>(1, capacity)) cap <<= 1;
+			this->fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+			bool created = this->fd >= 0;
+			if (!created && errno == EEXIST)
+				this->fd = shm_open(this->name.c_str(), O_RDWR, 0600);
+			if (this->fd < 0)
+				ThrowErrno("shm_open " + this->name);
+			try {
+				if (created) Create(cap);
+				else Open();
+			}
+			catch (...) {
+				if (this->header != nullptr) munmap(this->header, this->mappedSize);
+				close(this->fd);
+				throw;
+			}
+			this->mask = this->header->capacity - 1;
+		}
+		ShmChannel(const ShmChannel&) = delete;
+		ShmChannel& operator=(const ShmChannel&) = delete;
+
+		~ShmChannel() {
+			ShmPoller::Get().Unwatch(this);
+			munmap(this->header, this->mappedSize);
+			close(this->fd);
+		}
+
+		// Removes the segment's name, endpoints that have it open keep working.
+		static void Unlink(const std::string& name) {
+			shm_unlink((name.starts_with('/') ? name : "/" + name).c_str());
+		}
+
+		void Send(const T& value) {
+			while (!TryPush(value))
+				Wait(this->senderWaitQueue, &ShmChannel::Writable);
+			Signal(this->receiverWaitQueue);
+		}
+
+		// false when the ring is full
+		bool TrySend(const T& value) {
+			if (!TryPush(value))
+				return false;
+			Signal(this->receiverWaitQueue);
+			return true;
+		}
+
+		T Receive() {
+			std::optional<T> value = TryPop();
+			while (!value.has_value()) {
+				Wait(this->receiverWaitQueue, &ShmChannel::Readable);
+				value = TryPop();
+			}
+			Signal(this->senderWaitQueue);
+			return *value;
+		}
+
+		std::optional<T> TryReceive() {
+			std::optional<T> value = TryPop();
+			if (value.has_value())
+				Signal(this->senderWaitQueue);
+			return value;
+		}
+
+		size_t Capacity() const { return static_cast<size_t>(this->header->capacity); }
+		const std::string& GetName() const { return this->name; }
+	};
+}
+}
+#endif
@@ -0,0 +1,121 @@
+#include "StackArena.hpp"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#endif
+
+namespace {
+	constexpr size_t RoundUp(size_t value, size_t multiple) {
+		return (value + multiple - 1) / multiple * multiple;
+	}
+}
+
+CoroutineScheduler::StackArena* CoroutineScheduler::StackArena::Create(uint32_t stackSize) {
+#if defined(__linux__)
+	if (stackSize == 0 || RoundUp(stackSize, ColorStride) + (Colors - 1) * ColorStride > RegionSize)
+		return nullptr;
+	return new StackArena(stackSize);
+#else
+	(void)stackSize;
+	return nullptr;
+#endif
+}
+
+CoroutineScheduler::StackArena::StackArena(uint32_t stackSize)
+	: stackSize(static_cast<uint32_t>(RoundUp(stackSize, ColorStride))),
+	slotSize(RoundUp(stackSize, ColorStride) + (Colors - 1) * ColorStride) {}
+
+CoroutineScheduler::StackArena::~StackArena() {
+#if defined(__linux__)
+	for (void* region : this->regions)
+		munmap(region, RegionSize);
+#endif
+}
+
+bool CoroutineScheduler::StackArena::MapRegion() {
+#if defined(__linux__)
+	// reserved huge pages first, they fail at once when the pool is empty
+	void* region = mmap(nullptr, RegionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	bool hugeTlb = region != MAP_FAILED;
+	if (!hugeTlb) {
+		// twice the size, trimmed to a 2 MiB aligned region transparent huge pages can back
+		void* raw = mmap(nullptr, RegionSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (raw == MAP_FAILED)
+			return false;
+		uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+		uintptr_t aligned = RoundUp(start, RegionSize);
+		if (aligned != start)
+			munmap(raw, aligned - start);
+		if (aligned + RegionSize != start + RegionSize * 2)
+			munmap(reinterpret_cast<void*>(aligned + RegionSize), start + RegionSize - aligned);
+		region = reinterpret_cast<void*>(aligned);
+		madvise(region, RegionSize, MADV_HUGEPAGE);
+	}
+	this->regions.push_back(region);
+	if (hugeTlb) this->hugeTlbRegions++;
+	this->carveNext = reinterpret_cast<uintptr_t>(region);
+	this->carveEnd = this->carveNext + RegionSize;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void* CoroutineScheduler::StackArena::Acquire() {
+	if (this->localFree == nullptr)
+		this->localFree = this->remoteFree.exchange(nullptr, std::memory_order_acquire);
+	if (this->localFree != nullptr) {
+		FreeStack* stack = this->localFree;
+		this->localFree = stack->next;
+		return stack;
+	}
+	if (this->carveEnd - this->carveNext < this->slotSize && !MapRegion())
+		return nullptr;
+	uintptr_t slot = this->carveNext;
+	this->carveNext += this->slotSize;
+	// a stack keeps its slot's color for good, the free lists hand out the stack bottom as is
+	size_t color = this->carved++ % Colors;
+	return reinterpret_cast<void*>(slot + (Colors - 1 - color) * ColorStride);
+}
+
+Fiber::FiberHandle CoroutineScheduler::StackArena::CreateFiber(void (*fiberFunc)(void*), void* arg, bool paintStack) {
+#if defined(__linux__)
+	void* stack = Acquire();
+	if (stack == nullptr)
+		return nullptr;
+	this->references.fetch_add(1, std::memory_order_relaxed);
+#if defined(__SANITIZE_ADDRESS__)
+	// the fiber that had the stack before left the redzones of its frames poisoned
+	ASAN_UNPOISON_MEMORY_REGION(stack, this->stackSize);
+#endif
+	Fiber::FiberHandle fiber = Fiber::CreateFiberOnStack(stack, this->stackSize, fiberFunc, &StackArena::Release, this, arg, paintStack);
+	if (fiber == nullptr)
+		Release(this, stack);
+	return fiber;
+#else
+	(void)fiberFunc;
+	(void)arg;
+	(void)paintStack;
+	return nullptr;
+#endif
+}
+
+void CoroutineScheduler::StackArena::Release(void* owner, void* stack) {
+	StackArena* arena = static_cast<StackArena*>(owner);
+	FreeStack* node = static_cast<FreeStack*>(stack);
+	node->next = arena->remoteFree.load(std::memory_order_relaxed);
+	while (!arena->remoteFree.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+	arena->Unreference();
+}
+
+void CoroutineScheduler::StackArena::Retire() {
+	Unreference();
+}
+
+void CoroutineScheduler::StackArena::Unreference() {
+	if (this->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete this;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Fiber/fiber.h"
+
+namespace CoroutineScheduler
+{
+	// Fiber stacks of one Proc packed side by side into 2 MiB regions, mapped with huge pages when the
+	// system has some reserved and advised for transparent huge pages otherwise, so that thousands of
+	// stacks share a few TLB entries instead of two 4 KiB pages each. Only the owning Proc creates
+	// fibers on it; DeleteFiber may run on any thread and returns the stack through a lock-free list.
+	//
+	// The arena frees itself once the Proc retired it and the last stack came back, tasks may well
+	// outlive the Proc their fiber was created on. Linux only, Create returns nullptr elsewhere.
+	class StackArena {
+	public:
+		static constexpr size_t RegionSize = 2 * 1024 * 1024;
+		// consecutive slots move their stack top down by one more cache line, wrapping after this many,
+		// so the hot top frames of neighbouring fibers do not all map to the same cache sets
+		static constexpr size_t Colors = 16;
+		static constexpr size_t ColorStride = 64;
+
+		// nullptr when stacks of this size do not fit a region or the platform has no support
+		static StackArena* Create(uint32_t stackSize);
+
+		StackArena(const StackArena&) = delete;
+		StackArena& operator=(const StackArena&) = delete;
+
+		// Owner only. nullptr when no region could be mapped, the caller falls back to Fiber::CreateFiber.
+		// 'paintStack' as for Fiber::CreateFiber.
+		Fiber::FiberHandle CreateFiber(void (*fiberFunc)(void*), void* arg = nullptr, bool paintStack = false);
+
+		// Drops the owner's reference, the arena is unmapped now or when its last stack comes back.
+		void Retire();
+
+		// regions mapped so far and how many of them are backed by reserved huge pages
+		size_t Regions() const { return this->regions.size(); }
+		size_t HugeTlbRegions() const { return this->hugeTlbRegions; }
+
+	private:
+		struct FreeStack {
+			FreeStack* next;
+		};
+
+		const uint32_t stackSize;
+		// stack plus the coloring pad, a multiple of the cache line
+		const size_t slotSize;
+		std::vector<void*> regions;
+		size_t hugeTlbRegions = 0;
+		// the part of the newest region not carved into slots yet
+		uintptr_t carveNext = 0;
+		uintptr_t carveEnd = 0;
+		size_t carved = 0;
+		// stacks returned on the owner's thread, after draining the remote list
+		FreeStack* localFree = nullptr;
+		// stacks returned by any thread, taken over by the owner at once
+		std::atomic<FreeStack*> remoteFree{ nullptr };
+		// one per stack out, one for the owner
+		std::atomic<size_t> references{ 1 };
+
+		explicit StackArena(uint32_t stackSize);
+		~StackArena();
+
+		void* Acquire();
+		bool MapRegion();
+		void Unreference();
+		static void Release(void* owner, void* stack);
+	};
+}
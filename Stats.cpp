@@ -0,0 +1,122 @@
+#include <format>
+#include <fstream>
+#include <stdexcept>
+
+#include "Stats.hpp"
+#include "Task.hpp"
+
+namespace CoroutineScheduler
+{
+namespace Stats
+{
+	//----------------------- HistogramSnapshot -----------------------
+	void HistogramSnapshot::Merge(const LatencyHistogram& h) {
+		if (this->counts.empty())
+			this->counts.resize(LatencyHistogram::BucketCount, 0);
+		for (size_t i = 0; i < LatencyHistogram::BucketCount; i++) {
+			uint64_t c = h.counts[i].load(std::memory_order_relaxed);
+			this->counts[i] += c;
+			this->total += c;
+		}
+		this->sum += h.sum.load(std::memory_order_relaxed);
+	}
+
+	uint64_t HistogramSnapshot::Percentile(double quantile) const {
+		if (this->total == 0) return 0;
+		uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(this->total));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < this->counts.size(); i++) {
+			seen += this->counts[i];
+			if (seen > rank) return LatencyHistogram::UpperBoundOf(i);
+		}
+		return LatencyHistogram::UpperBoundOf(this->counts.size() - 1);
+	}
+	//-----------------------------------------------------------------
+
+	//----------------------- RuntimeStats -----------------------
+	void RuntimeStats::Accumulate(const ProcCounters& counters) {
+		this->tasksSpawned += counters.spawned.load(std::memory_order_relaxed);
+		this->tasksCompleted += counters.completed.load(std::memory_order_relaxed);
+		this->tasksParked += counters.parked.load(std::memory_order_relaxed);
+		this->contextSwitches += counters.contextSwitches.load(std::memory_order_relaxed);
+		this->deadlineMisses += counters.deadlineMisses.load(std::memory_order_relaxed);
+		this->tasksInlined += counters.inlined.load(std::memory_order_relaxed);
+		this->procWakeups += counters.procWakeups.load(std::memory_order_relaxed);
+		this->procParks += counters.procParks.load(std::memory_order_relaxed);
+		this->timersFired += counters.timersFired.load(std::memory_order_relaxed);
+		// parks and resumes of one task may be counted on different Procs, so the
+		// per-Proc difference can be negative; only the total is meaningful.
+		this->parkedOnChannel += counters.parkedBy[ParkReason::ParkChannel].load(std::memory_order_relaxed)
+			- counters.resumedBy[ParkReason::ParkChannel].load(std::memory_order_relaxed);
+		this->parkedOnTimer += counters.parkedBy[ParkReason::ParkSleep].load(std::memory_order_relaxed)
+			- counters.resumedBy[ParkReason::ParkSleep].load(std::memory_order_relaxed);
+		this->parkedOnTask += counters.parkedBy[ParkReason::ParkDependentTask].load(std::memory_order_relaxed)
+			- counters.resumedBy[ParkReason::ParkDependentTask].load(std::memory_order_relaxed);
+		this->runQueueWait.Merge(counters.runQueueWait);
+		this->timeSlice.Merge(counters.timeSlice);
+	}
+
+	static void AppendHistogram(std::string& out, const char* name, const char* help, const HistogramSnapshot& h) {
+		out += std::format("# HELP {} {}\n# TYPE {} histogram\n", name, help, name);
+		// Prometheus wants fixed cumulative buckets, so collapse the HDR buckets onto powers of two from 1us to ~68s.
+		uint64_t cumulative = 0;
+		size_t index = 0;
+		for (unsigned int magnitude = 10; magnitude <= 36; magnitude++) {
+			size_t end = (magnitude - LatencyHistogram::SubBucketBits + 1) * LatencyHistogram::SubBuckets;
+			for (; index < end && index < h.counts.size(); index++)
+				cumulative += h.counts[index];
+			out += std::format("{}_bucket{{le=\"{:.9f}\"}} {}\n", name, static_cast<double>(uint64_t(1) << magnitude) / 1e9, cumulative);
+		}
+		out += std::format("{}_bucket{{le=\"+Inf\"}} {}\n", name, h.total);
+		out += std::format("{}_sum {:.9f}\n{}_count {}\n", name, static_cast<double>(h.sum) / 1e9, name, h.total);
+	}
+
+	static void AppendMetric(std::string& out, const char* name, const char* type, const char* help, uint64_t value) {
+		out += std::format("# HELP {} {}\n# TYPE {} {}\n{} {}\n", name, help, name, type, name, value);
+	}
+
+	std::string RuntimeStats::ToPrometheus() const {
+		std::string out;
+		AppendMetric(out, "coroutine_workers", "gauge", "Number of Proc worker threads.", this->workers);
+		AppendMetric(out, "coroutine_tasks_spawned_total", "counter", "Coroutines spawned.", this->tasksSpawned);
+		AppendMetric(out, "coroutine_tasks_completed_total", "counter", "Coroutines completed.", this->tasksCompleted);
+		AppendMetric(out, "coroutine_tasks_parked_total", "counter", "Times a coroutine parked.", this->tasksParked);
+		AppendMetric(out, "coroutine_context_switches_total", "counter", "Switches from a Proc into a coroutine.", this->contextSwitches);
+		AppendMetric(out, "coroutine_deadline_misses_total", "counter", "Coroutines with a deadline that completed after it.", this->deadlineMisses);
+		AppendMetric(out, "coroutine_tasks_inlined_total", "counter", "Coroutines run on the fiber of the coroutine awaiting them.", this->tasksInlined);
+		AppendMetric(out, "coroutine_proc_wakeups_total", "counter", "Idle Procs notified to look for work.", this->procWakeups);
+		AppendMetric(out, "coroutine_proc_parks_total", "counter", "Times an idle Proc went to sleep.", this->procParks);
+		AppendMetric(out, "coroutine_timers_fired_total", "counter", "Timers fired by the Procs.", this->timersFired);
+		AppendMetric(out, "coroutine_spinning_procs", "gauge", "Procs spinning for work.", this->spinningProcs);
+		AppendMetric(out, "coroutine_idle_procs", "gauge", "Procs asleep waiting for work.", this->idleProcs);
+		AppendMetric(out, "coroutine_global_queue_depth", "gauge", "Runnable coroutines in the global queue.", this->globalQueueDepth);
+		AppendMetric(out, "coroutine_parked_on_channel", "gauge", "Coroutines parked on a channel.", this->parkedOnChannel);
+		AppendMetric(out, "coroutine_parked_on_timer", "gauge", "Coroutines parked on a timer.", this->parkedOnTimer);
+		AppendMetric(out, "coroutine_parked_on_task", "gauge", "Coroutines parked awaiting another coroutine.", this->parkedOnTask);
+		if (!this->groups.empty()) {
+			out += "# HELP coroutine_group_cpu_seconds_total CPU time used by the coroutines of a task group.\n# TYPE coroutine_group_cpu_seconds_total counter\n";
+			for (auto& g : this->groups)
+				out += std::format("coroutine_group_cpu_seconds_total{{group=\"{}\"}} {:.9f}\n", g.name, static_cast<double>(g.cpuTimeNs) / 1e9);
+			out += "# HELP coroutine_group_throttled_total Times a task group used up its quota.\n# TYPE coroutine_group_throttled_total counter\n";
+			for (auto& g : this->groups)
+				out += std::format("coroutine_group_throttled_total{{group=\"{}\"}} {}\n", g.name, g.throttled);
+		}
+		AppendHistogram(out, "coroutine_run_queue_wait_seconds", "Time from becoming runnable to running.", this->runQueueWait);
+		AppendHistogram(out, "coroutine_time_slice_seconds", "Time a coroutine ran before yielding its Proc.", this->timeSlice);
+		return out;
+	}
+
+	void RuntimeStats::ExportPrometheus(const std::string& path) const {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) {
+			throw std::runtime_error(std::format("Failed to open stats file {}", path));
+		}
+		out << ToPrometheus();
+	}
+
+	void RuntimeStats::ExportPrometheus(const std::function<void(const std::string&)>& sink) const {
+		sink(ToPrometheus());
+	}
+	//------------------------------------------------------------
+}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Task.hpp"
+
+namespace CoroutineScheduler
+{
+namespace Stats
+{
+	inline uint64_t NowNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// The NowNs timestamp of a steady_clock time point, never 0 so 0 can stand for "no deadline".
+	inline uint64_t ToNs(std::chrono::steady_clock::time_point time) {
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+		return ns > 0 ? static_cast<uint64_t>(ns) : 1;
+	}
+
+	// HDR-style histogram of nanosecond values: one log2 magnitude per group of 8 linear
+	// sub-buckets, so every bucket is within 12.5% of the recorded value.
+	class LatencyHistogram {
+	public:
+		static constexpr unsigned int SubBucketBits = 3;
+		static constexpr unsigned int SubBuckets = 1 << SubBucketBits;
+		static constexpr size_t BucketCount = (64 - SubBucketBits + 1) * SubBuckets;
+
+		static constexpr size_t IndexOf(uint64_t value) {
+			if (value < SubBuckets) return static_cast<size_t>(value);
+			unsigned int magnitude = 63 - std::countl_zero(value);
+			uint64_t sub = (value >> (magnitude - SubBucketBits)) & (SubBuckets - 1);
+			return (magnitude - SubBucketBits + 1) * SubBuckets + sub;
+		}
+		static constexpr uint64_t UpperBoundOf(size_t index) {
+			if (index < SubBuckets) return index;
+			unsigned int magnitude = static_cast<unsigned int>(index / SubBuckets) + SubBucketBits - 1;
+			uint64_t width = uint64_t(1) << (magnitude - SubBucketBits);
+			return ((SubBuckets + index % SubBuckets) << (magnitude - SubBucketBits)) + width - 1;
+		}
+
+		std::atomic<uint64_t> counts[BucketCount] = {};
+		std::atomic<uint64_t> sum{ 0 };
+
+		inline void Record(uint64_t value) {
+			counts[IndexOf(value)].fetch_add(1, std::memory_order_relaxed);
+			sum.fetch_add(value, std::memory_order_relaxed);
+		}
+	};
+
+	// Counters of one Proc. Only the owning Proc thread writes them, the padding keeps
+	// neighbouring Procs off each other's cache lines.
+	struct alignas(64) ProcCounters {
+		std::atomic<uint64_t> spawned{ 0 };
+		std::atomic<uint64_t> completed{ 0 };
+		std::atomic<uint64_t> parked{ 0 };
+		std::atomic<uint64_t> contextSwitches{ 0 };
+		std::atomic<uint64_t> deadlineMisses{ 0 };
+		// children run on their awaiter's fiber instead of one of their own
+		std::atomic<uint64_t> inlined{ 0 };
+		// an idle Proc was notified, and a Proc went to sleep on the run queue
+		std::atomic<uint64_t> procWakeups{ 0 };
+		std::atomic<uint64_t> procParks{ 0 };
+		std::atomic<uint64_t> timersFired{ 0 };
+		// indexed by ParkReason, the difference is the number of tasks currently parked
+		std::atomic<uint64_t> parkedBy[ParkReasonCount] = {};
+		std::atomic<uint64_t> resumedBy[ParkReasonCount] = {};
+		alignas(64) LatencyHistogram runQueueWait;
+		alignas(64) LatencyHistogram timeSlice;
+	};
+
+	struct HistogramSnapshot {
+		std::vector<uint64_t> counts;
+		uint64_t total = 0;
+		uint64_t sum = 0;
+
+		void Merge(const LatencyHistogram& h);
+		// Upper bound, in nanoseconds, of the bucket holding the given quantile (0..1).
+		uint64_t Percentile(double quantile) const;
+	};
+
+	struct GroupStats {
+		std::string name;
+		unsigned int weight = 0;
+		uint64_t cpuTimeNs = 0;
+		uint64_t throttled = 0;
+	};
+
+	struct RuntimeStats {
+		unsigned int workers = 0;
+		uint64_t tasksSpawned = 0;
+		uint64_t tasksCompleted = 0;
+		uint64_t tasksParked = 0;
+		uint64_t contextSwitches = 0;
+		uint64_t deadlineMisses = 0;
+		uint64_t tasksInlined = 0;
+		uint64_t procWakeups = 0;
+		uint64_t procParks = 0;
+		uint64_t timersFired = 0;
+		unsigned int spinningProcs = 0;
+		unsigned int idleProcs = 0;
+		uint64_t globalQueueDepth = 0;
+		uint64_t parkedOnChannel = 0;
+		uint64_t parkedOnTimer = 0;
+		uint64_t parkedOnTask = 0;
+		HistogramSnapshot runQueueWait;
+		HistogramSnapshot timeSlice;
+		std::vector<GroupStats> groups;
+
+		void Accumulate(const ProcCounters& counters);
+		std::string ToPrometheus() const;
+		void ExportPrometheus(const std::string& path) const;
+		void ExportPrometheus(const std::function<void(const std::string&)>& sink) const;
+	};
+}
+}
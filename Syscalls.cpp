@@ -8,49 +8,75 @@ namespace CoroutineScheduler
 {
 namespace Syscall
 {
-	//-------------------------------------------------------------
-	std::unique_ptr<Sleep> Sleep::sleepSyscall = std::make_unique<Sleep>();
-	//-------------------------------------------------------------
-
 	//----------------------- Sleep Syscall -----------------------
-	Sleep::Sleep() : sleepThread(&Sleep::SleepLoop, this), exit(false) { }
-	Sleep::~Sleep() {
+	Sleep::Sleep(Runtime& runtime, std::chrono::nanoseconds resolution, size_t capacity)
+		: runtime(runtime), resolution(static_cast<uint64_t>(std::max<int64_t>(0, resolution.count()))) {
+		this->timers.Reserve(capacity);
+	}
+	// Called with mtx held.
+	void Sleep::PublishNext()
+	{
+		TimerEntry* top = this->timers.Top();
+		this->nextDeadline.store(top == nullptr ? NoTimer : top->deadline, std::memory_order_release);
+	}
+	static void WakeSleepingTask(TimerEntry& entry) {
+		Runtime::Wake(static_cast<ITask*>(entry.context));
+	}
+	void Sleep::ScheduleWake(ITask* task, uint64_t deadlineNs)
+	{
+		task->timer.fire = WakeSleepingTask;
+		task->timer.context = task;
+		Schedule(task->timer, deadlineNs);
+	}
+	void Sleep::Schedule(TimerEntry& entry, uint64_t deadlineNs, uint64_t periodNs)
+	{
+		bool earliest;
 		{
 			std::lock_guard lock(this->mtx);
-			this->exit = true;
+			entry.period = periodNs;
+			this->timers.Schedule(entry, deadlineNs);
+			earliest = this->timers.Top() == &entry;
+			if (earliest) PublishNext();
 		}
-		this->cv.notify_one();
-		this->sleepThread.join();
+		// the Proc waiting for timers may be waiting for a later one
+		if (earliest) this->runtime.TimerScheduled(deadlineNs + this->resolution);
 	}
-	void Sleep::SleepLoop()
+	bool Sleep::Cancel(TimerEntry& entry)
 	{
-		while (true) {
-			std::unique_lock lock(this->mtx);
-			if (this->sleepTimeQueue.empty())
-				this->cv.wait(lock, [this] { return !sleepTimeQueue.empty() || this->exit; });
-			else {
-				auto nextWakeTime = this->sleepTimeQueue.top();
-				this->cv.wait_until(lock, nextWakeTime.first, [this, nextWakeTime] {
-					return !this->sleepTimeQueue.empty() && this->sleepTimeQueue.top().first < nextWakeTime.first;
-					});
-			}
-			if (this->exit) break;
-			auto now = Clock::now();
-			while (!this->sleepTimeQueue.empty() && now >= this->sleepTimeQueue.top().first) {
-				auto taskToExecute = this->sleepTimeQueue.top();
-				this->sleepTimeQueue.pop();
-				Runtime::GetInstance().AddTask(taskToExecute.second);
-				now = Clock::now();
-			}
-		}
+		std::lock_guard lock(this->mtx);
+		bool cancelled = this->timers.Cancel(entry);
+		if (cancelled) PublishNext();
+		return cancelled;
+	}
+	bool Sleep::IsScheduled(TimerEntry& entry)
+	{
+		std::lock_guard lock(this->mtx);
+		return entry.Queued();
 	}
-	void Sleep::AddSleep(int milliSec, ITask* task)
+	size_t Sleep::RunDue(uint64_t now)
 	{
+		if (NextDeadline() > now)
+			return 0;
+		size_t fired = 0;
 		std::lock_guard lock(this->mtx);
-		this->sleepTimeQueue.push({ Clock::now() + std::chrono::milliseconds(milliSec), task });
-		this->cv.notify_one();
+		// fired with the lock held, Cancel() is what tells an owner its entry is no longer in use
+		while (!this->timers.Empty() && this->timers.Top()->deadline <= now) {
+			TimerEntry* entry = this->timers.Top();
+			if (entry->period != 0) {
+				// moved in place, on the original schedule so it does not drift; periods missed
+				// while the Procs were busy are skipped rather than fired in a burst
+				uint64_t next = entry->deadline + entry->period;
+				if (next <= now) next += ((now - next) / entry->period + 1) * entry->period;
+				this->timers.Schedule(*entry, next);
+			}
+			else this->timers.Pop();
+			entry->fire(*entry);
+			fired++;
+		}
+		PublishNext();
+		return fired;
 	}
 	//-------------------------------------------------------------
 
 }
-}
\ No newline at end of file
+}
@@ -1,32 +1,54 @@
-#include <queue>
-#include <thread>
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <mutex>
-#include <condition_variable>
 
 #include "Task.hpp"
+#include "Timer.hpp"
 
 namespace CoroutineScheduler
 {
+	class Runtime;
+
 namespace Syscall
 {
+	// The runtime's timers. There is no timer thread: Procs fire due entries between tasks, and one
+	// idle Proc at a time waits for the earliest deadline, see Runtime::FetchTask.
 	class Sleep {
-		using Clock = std::chrono::steady_clock;
-		using SleepPair = std::pair<Clock::time_point, ITask*>;
-
-		static std::unique_ptr<Sleep> sleepSyscall;
-
-		std::thread sleepThread;
+		Runtime& runtime;
+		const uint64_t resolution;
 		std::mutex mtx;
-		std::condition_variable cv;
-		std::priority_queue<SleepPair, std::vector<SleepPair>, std::greater<SleepPair>> sleepTimeQueue;
-		bool exit;
+		TimerHeap timers;
+		// deadline of the heap's top, NoTimer when empty; lets Procs check for due timers without the lock
+		std::atomic<uint64_t> nextDeadline{ NoTimer };
 
-		void SleepLoop();
+		void PublishNext();
 	public:
-		Sleep();
-		~Sleep();
-		void AddSleep(int milliSec, ITask* task);
-		inline static Sleep& GetInstance() { return *sleepSyscall; };
+		static constexpr uint64_t NoTimer = UINT64_MAX;
+
+		Sleep(Runtime& runtime, std::chrono::nanoseconds resolution, size_t capacity);
+		// Wakes the task at deadlineNs through its own timer entry, a task waits on one thing at a time.
+		// Whoever parks on it cancels the entry once woken, whichever way that happened.
+		void ScheduleWake(ITask* task, uint64_t deadlineNs);
+		// Queues or moves the entry; its fire callback runs on a Proc once the deadline passes, and
+		// again every periodNs after that when it is not 0.
+		void Schedule(TimerEntry& entry, uint64_t deadlineNs, uint64_t periodNs = 0);
+		// Returns false when the entry was not queued, it has fired or was never scheduled. Once this
+		// returns, the entry's callback is not running and will not run.
+		bool Cancel(TimerEntry& entry);
+		bool IsScheduled(TimerEntry& entry);
+
+		// Fires every entry due at 'now', returns how many fired.
+		size_t RunDue(uint64_t now);
+		uint64_t NextDeadline() const { return this->nextDeadline.load(std::memory_order_acquire); }
+		// When an idle Proc should wake for the next timer: its deadline plus the resolution, so that
+		// timers due close together fire in one pass. Nothing ever fires early.
+		uint64_t NextWake() const {
+			uint64_t next = NextDeadline();
+			return next == NoTimer ? NoTimer : next + this->resolution;
+		}
 	};
 }
 }
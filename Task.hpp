@@ -8,30 +8,206 @@
 #include <memory>
 #include <condition_variable>
 #include <type_traits>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include "./Log.hpp"
 #include "./Fiber/fiber.h"
+#include "./Cancellation.hpp"
+#include "./Timer.hpp"
+#include "./FiberLocal.hpp"
+#include "./Arena.hpp"
 
 namespace CoroutineScheduler {
 	enum TaskState {
 		TaskNotStarted,
 		TaskRunning,
 		TaskCompleted,
-		TaskPaused
+		TaskPaused,
+		// switching out of its fiber, the Proc turns it into TaskPaused once the switch is done
+		TaskParking,
+		// parked and claimed by Runtime::DumpCoroutines while it walks the stack, wakes stay pending
+		TaskDumping
 	};
+	// Scheduling class picked at spawn, see RunQueue for how the classes share the Procs.
+	enum TaskPriority {
+		PriorityInteractive,
+		PriorityNormal,
+		PriorityBackground
+	};
+	constexpr size_t PriorityClassCount = 3;
+	enum ParkReason {
+		ParkNone,
+		ParkChannel,
+		ParkSleep,
+		ParkDependentTask,
+		ParkYield
+	};
+	// one past the last ParkReason, sizes the arrays indexed by it
+	constexpr size_t ParkReasonCount = ParkReason::ParkYield + 1;
+	class ITask;
+	class Runtime;
+	class TaskGroup;
+
+	// Intrusive list of every live task, walked by Runtime::DumpCoroutines.
+	class TaskRegistry {
+		std::mutex mtx;
+		ITask* head = nullptr;
+	public:
+		void Add(ITask* task);
+		void Add(ITask* const* tasks, size_t count);
+		void Remove(ITask* task);
+		template<typename F>
+		void ForEach(F&& func);
+	};
+
+	// FIFO of tasks parked on one object (a channel side), linked through the tasks themselves since a
+	// task waits on one thing at a time. Never allocates. Guarded by the owner's lock.
+	class WaitQueue {
+		ITask* head = nullptr;
+		ITask* tail = nullptr;
+	public:
+		bool Empty() const { return head == nullptr; }
+		void PushBack(ITask* task);
+		ITask* PopFront();
+		// false when the task is not in this queue, e.g. because a waker already popped it
+		bool Remove(ITask* task);
+	};
+
 	class ITask {
+		static inline std::atomic<uint64_t> nextTaskId{ 1 };
 	public:
 		Fiber::FiberHandle fiberHandle;
-		TaskState state;
+		std::atomic<TaskState> state;
 		ITask* dependentTask;
+		const uint64_t id;
+		// the runtime the task was spawned on, wakers hand it back there
+		Runtime* runtime;
+		TaskPriority priority;
+		// steady clock nanoseconds (Stats::NowNs), 0 when the task has no deadline
+		uint64_t deadline;
+		// the group its CPU time is charged to, the runtime's default group unless spawned into another
+		TaskGroup* group;
+		// nanoseconds spent running, summed over its slices
+		uint64_t cpuTime;
+		// shared with the tasks spawned under the same token, nullptr when the task cannot be cancelled
+		std::shared_ptr<CancellationState> cancellation;
+		// the task's own timeout, see Syscall::Sleep
+		TimerEntry timer;
+		ParkReason parkReason;
+		uint64_t enqueuedAt;
+		uint64_t parkedAt;
+		TaskRegistry* registry;
+		ITask* registryPrev;
+		ITask* registryNext;
+		WaitQueue* waitQueue;
+		ITask* waitPrev;
+		ITask* waitNext;
+		// values of the FiberLocals the task touched, destroyed when it completes
+		FiberLocalSlots locals;
+		// bump-pointer memory handed out by Coroutine::Arena(), released in bulk once it completes
+		TaskArena arena;
+		// guards state transitions between parking and waking, see Runtime::AddTask
+		std::mutex parkMtx;
+		bool wakePending;
+		// claimed once by whoever starts the task: the Proc that pops its spawn entry, or an awaiter
+		// running it inline, see Runtime::AwaitTask
+		std::atomic<bool> started;
+		// the child this task is running inline on its own fiber, innermost first
+		ITask* guest;
+		// ProcLocal::With calls the task is inside of, it must not park until they returned (checked
+		// in builds without NDEBUG)
+		unsigned int noPark;
 
-		ITask() : state(TaskState::TaskNotStarted), fiberHandle(nullptr), dependentTask(nullptr) {}
-		virtual const char* const GetTaskName() const = 0;
+		ITask() : state(TaskState::TaskNotStarted), fiberHandle(nullptr), dependentTask(nullptr),
+			id(nextTaskId.fetch_add(1, std::memory_order_relaxed)), runtime(nullptr), priority(TaskPriority::PriorityNormal), deadline(0), group(nullptr), cpuTime(0), parkReason(ParkReason::ParkNone), enqueuedAt(0), parkedAt(0),
+			registry(nullptr), registryPrev(nullptr), registryNext(nullptr), waitQueue(nullptr), waitPrev(nullptr), waitNext(nullptr), wakePending(false), started(false), guest(nullptr), noPark(0) {}
+		bool IsCancelled() const {
+			return this->cancellation != nullptr && this->cancellation->IsCancelled();
+		}
+
+		// Trace events and dumps keep the pointer, so the name must outlive the task and every trace
+		// export after it: a string literal, or a runtime-built name from Trace::InternName.
+		virtual const char* GetTaskName() const = 0;
 		virtual void Execute() = 0;
 		virtual void Await() = 0;
+		// false when the deadline passed before the task completed
+		virtual bool AwaitUntil(std::chrono::steady_clock::time_point deadline) = 0;
 		virtual bool SetDependentTask(ITask* task) = 0;
+		// Called by the Proc that ran the task to completion: the awaiter it is to wake, nullptr for none.
+		virtual ITask* TakeDependentTask() { return std::exchange(this->dependentTask, nullptr); }
+		// Called by that Proc once the wake reached the awaiter, ending its park or left pending.
+		virtual void DependentWoken() {}
+		// For an awaiter 'task' that is done waiting: false while the completion's wake for it is still
+		// on its way. An awaiter the Proc has not taken yet is withdrawn instead, no wake will come.
+		virtual bool CompletionWakeSettled(ITask*) { return true; }
 		virtual bool MarkForDeletion() = 0;
 		virtual ~ITask() = default;
 	};
 
+	inline void TaskRegistry::Add(ITask* task) {
+		std::lock_guard<std::mutex> lock(mtx);
+		task->registry = this;
+		task->registryPrev = nullptr;
+		task->registryNext = head;
+		if (head != nullptr) head->registryPrev = task;
+		head = task;
+	}
+
+	inline void TaskRegistry::Add(ITask* const* tasks, size_t count) {
+		std::lock_guard<std::mutex> lock(mtx);
+		for (size_t i = 0; i < count; i++) {
+			ITask* task = tasks[i];
+			task->registry = this;
+			task->registryPrev = nullptr;
+			task->registryNext = head;
+			if (head != nullptr) head->registryPrev = task;
+			head = task;
+		}
+	}
+
+	inline void TaskRegistry::Remove(ITask* task) {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (task->registryPrev != nullptr) task->registryPrev->registryNext = task->registryNext;
+		else head = task->registryNext;
+		if (task->registryNext != nullptr) task->registryNext->registryPrev = task->registryPrev;
+		task->registry = nullptr;
+		task->registryPrev = task->registryNext = nullptr;
+	}
+
+	template<typename F>
+	void TaskRegistry::ForEach(F&& func) {
+		std::lock_guard<std::mutex> lock(mtx);
+		for (ITask* t = head; t != nullptr; t = t->registryNext)
+			func(*t);
+	}
+
+	inline void WaitQueue::PushBack(ITask* task) {
+		task->waitQueue = this;
+		task->waitPrev = tail;
+		task->waitNext = nullptr;
+		if (tail != nullptr) tail->waitNext = task;
+		else head = task;
+		tail = task;
+	}
+
+	inline ITask* WaitQueue::PopFront() {
+		ITask* task = head;
+		if (task != nullptr) Remove(task);
+		return task;
+	}
+
+	inline bool WaitQueue::Remove(ITask* task) {
+		if (task->waitQueue != this) return false;
+		if (task->waitPrev != nullptr) task->waitPrev->waitNext = task->waitNext;
+		else head = task->waitNext;
+		if (task->waitNext != nullptr) task->waitNext->waitPrev = task->waitPrev;
+		else tail = task->waitPrev;
+		task->waitQueue = nullptr;
+		task->waitPrev = task->waitNext = nullptr;
+		return true;
+	}
+
 	template<typename F, typename... A>
 	class Task : public ITask {
 	protected:
@@ -45,6 +221,10 @@ namespace CoroutineScheduler {
 
 		bool isCompleted = false;
 		bool isMarkedForDeletion = false;
+		bool wasCancelled = false;
+		// the Proc took dependentTask to wake it once the task completed, and the wake reached it
+		bool dependentTaken = false;
+		bool dependentWoken = false;
 
 	public:
 		// Deleted copy/move because mutexes cannot be moved
@@ -55,7 +235,7 @@ namespace CoroutineScheduler {
 			: taskName(taskName), function(std::forward<F>(func)), arguments(std::forward<A>(args)...) {
 		}
 
-		const char* const GetTaskName() const override {
+		const char* GetTaskName() const override {
 			return taskName;
 		}
 
@@ -64,6 +244,11 @@ namespace CoroutineScheduler {
 			cv.wait(lock, [this]() { return this->isCompleted; });
 		}
 
+		bool AwaitUntil(std::chrono::steady_clock::time_point deadline) override {
+			std::unique_lock<std::mutex> lock(mtx);
+			return cv.wait_until(lock, deadline, [this]() { return this->isCompleted; });
+		}
+
 		bool SetDependentTask(ITask* task) override {
 			std::lock_guard<std::mutex> lock(mtx);
 			if (isCompleted) {
@@ -73,10 +258,43 @@ namespace CoroutineScheduler {
 			return true;
 		}
 
+		ITask* TakeDependentTask() override {
+			std::lock_guard<std::mutex> lock(mtx);
+			ITask* dependent = std::exchange(this->dependentTask, nullptr);
+			dependentTaken = dependent != nullptr;
+			return dependent;
+		}
+
+		void DependentWoken() override {
+			std::lock_guard<std::mutex> lock(mtx);
+			dependentWoken = true;
+		}
+
+		bool CompletionWakeSettled(ITask* task) override {
+			std::lock_guard<std::mutex> lock(mtx);
+			if (this->dependentTask == task) this->dependentTask = nullptr;
+			return !dependentTaken || dependentWoken;
+		}
+
+		// true when the task ended through CancelledError, or was cancelled before it started
+		bool WasCancelled() {
+			std::lock_guard<std::mutex> lock(mtx);
+			return wasCancelled;
+		}
+
 		virtual void Execute() override {
-			std::apply(function, arguments);
+			bool cancelled = this->IsCancelled();
+			try {
+				if (!cancelled) std::apply(function, arguments);
+			}
+			catch (const CancelledError&) {
+				cancelled = true;
+			}
+			// before the task counts as completed, so whoever awaits it sees them gone
+			this->locals.Clear();
 			{
 				std::lock_guard<std::mutex> lock(mtx);
+				wasCancelled = cancelled;
 				isCompleted = true;
 			}
 			cv.notify_all();
@@ -90,7 +308,10 @@ namespace CoroutineScheduler {
 		}
 
 		virtual ~Task() {
-			std::cout << std::format("[INFO] Cleaning up Coroutine resource {}\n", GetTaskName());
+			// unlink before the fiber goes away, the registry may be walking its stack
+			if (this->registry != nullptr) this->registry->Remove(this);
+			if (this->cancellation != nullptr) this->cancellation->Unregister(this);
+			COROUTINE_LOG("[INFO] Cleaning up Coroutine resource {}\n", GetTaskName());
 			Fiber::DeleteFiber(fiberHandle);
 			this->fiberHandle = nullptr;
 			this->dependentTask = nullptr;
@@ -104,17 +325,24 @@ namespace CoroutineScheduler {
 		using Task<F, A...>::Task; // Inherit constructor
 
 		void Execute() override {
-			std::lock_guard<std::mutex> lock(this->mtx);
 			// Use std::apply and store the result
-			R ret = std::apply(this->function, this->arguments);
-			returnValue = std::make_unique<R>(std::move(ret));
+			bool cancelled = this->IsCancelled();
+			try {
+				if (!cancelled) returnValue = std::make_unique<R>(std::apply(this->function, this->arguments));
+			}
+			catch (const CancelledError&) {
+				cancelled = true;
+			}
+			this->locals.Clear();
 			{
 				std::lock_guard<std::mutex> lock(Task<F, A...>::mtx);
+				Task<F, A...>::wasCancelled = cancelled;
 				Task<F, A...>::isCompleted = true;
 			}
 			Task<F, A...>::cv.notify_all();
 		}
 
+		// nullptr when the task was cancelled
 		R const* GetReturnValue() {
 			Task<F, A...>::Await();
 			return returnValue.get();
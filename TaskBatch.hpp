@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "CoroutineScheduler.hpp"
+#include "Channel.hpp"
+#include "Task.hpp"
+
+namespace CoroutineScheduler
+{
+	// Coroutines running one function over the items of a range, spawned with Runtime::AddTasks. The
+	// tasks are constructed in a single allocation and freed together once the runtime is done with
+	// the last of them and the owner released the batch. Completion is counted down in the batch, so
+	// joining all of them is one wait instead of one per task.
+	template<typename F, typename Item>
+	class TaskBatch {
+	public:
+		using Result = std::invoke_result_t<F&, Item&>;
+		// monostate keeps the slots well-formed for void functions, none are allocated then
+		using Slot = std::conditional_t<std::is_void_v<Result>, std::monostate, std::optional<Result>>;
+
+	private:
+		class BatchTask : public ITask {
+			TaskBatch* const batch;
+			const size_t index;
+			Item item;
+
+		public:
+			BatchTask(TaskBatch* batch, size_t index, Item item) : batch(batch), index(index), item(std::move(item)) {}
+
+			~BatchTask() {
+				if (this->registry != nullptr) this->registry->Remove(this);
+				if (this->cancellation != nullptr) this->cancellation->Unregister(this);
+				Fiber::DeleteFiber(this->fiberHandle);
+				this->fiberHandle = nullptr;
+			}
+
+			const char* GetTaskName() const override { return this->batch->name; }
+
+			void Execute() override {
+				bool cancelled = this->IsCancelled();
+				try {
+					if (!cancelled) {
+						if constexpr (std::is_void_v<Result>) this->batch->function(this->item);
+						else this->batch->results[this->index].emplace(this->batch->function(this->item));
+					}
+				}
+				catch (const CancelledError&) {
+					cancelled = true;
+				}
+				this->locals.Clear();
+				// the rest of the batch may run on for long, a finished task should not show up in dumps meanwhile
+				if (this->registry != nullptr) this->registry->Remove(this);
+				if (cancelled) this->batch->cancelled.fetch_add(1, std::memory_order_relaxed);
+				this->batch->Finished();
+			}
+
+			// The tasks are only joined together, through the batch.
+			void Await() override { this->batch->Join(); }
+			bool AwaitUntil(std::chrono::steady_clock::time_point deadline) override { return this->batch->JoinUntil(deadline); }
+			bool SetDependentTask(ITask*) override { return false; }
+
+			// Called by the runtime once it no longer touches the task; the batch frees every task at once.
+			bool MarkForDeletion() override {
+				this->batch->Release();
+				return true;
+			}
+		};
+
+		const char* const name;
+		F function;
+		const size_t count;
+		BatchTask* tasks = nullptr;
+		// the tasks as the runtime takes them, in the same allocation right after them
+		ITask** pointers = nullptr;
+		std::vector<Slot> results;
+		std::atomic<size_t> running;
+		std::atomic<size_t> cancelled{ 0 };
+		// one per task the runtime has not finished with, and one for the owner
+		std::atomic<size_t> references;
+		Channel::SimpleChannel<bool> done{ 1 };
+		bool joined = false;
+
+		void Finished() {
+			if (this->running.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				this->done.TrySend(true);
+		}
+
+		~TaskBatch() {
+			for (size_t i = 0; i < this->count; i++)
+				this->tasks[i].~BatchTask();
+			::operator delete(this->tasks, std::align_val_t(alignof(BatchTask)));
+		}
+
+	public:
+		template<typename Range>
+		TaskBatch(const char* name, F function, Range&& range, size_t count)
+			: name(name), function(std::move(function)), count(count), running(count), references(count + 1) {
+			if constexpr (!std::is_void_v<Result>) this->results.resize(count);
+			void* block = ::operator new((sizeof(BatchTask) + sizeof(ITask*)) * std::max<size_t>(1, count), std::align_val_t(alignof(BatchTask)));
+			this->tasks = static_cast<BatchTask*>(block);
+			this->pointers = reinterpret_cast<ITask**>(this->tasks + std::max<size_t>(1, count));
+			size_t i = 0;
+			for (auto&& item : range) {
+				this->pointers[i] = new (&this->tasks[i]) BatchTask(this, i, Item(std::forward<decltype(item)>(item)));
+				i++;
+			}
+			if (count == 0) this->done.TrySend(true);
+		}
+		TaskBatch(const TaskBatch&) = delete;
+		TaskBatch& operator=(const TaskBatch&) = delete;
+
+		size_t Size() const { return this->count; }
+		ITask& operator[](size_t index) { return this->tasks[index]; }
+		// every task, for Runtime::AddTasks
+		ITask* const* Tasks() const { return this->pointers; }
+
+		// Frees the batch once the runtime is done with every task too.
+		void Release() {
+			if (this->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete this;
+		}
+
+		// Parks until every task completed, or blocks outside a coroutine. Not thread-safe.
+		void Join() {
+			if (this->joined)
+				return;
+			this->done.Receive();
+			this->joined = true;
+		}
+
+		bool JoinUntil(std::chrono::steady_clock::time_point deadline) {
+			if (this->joined)
+				return true;
+			this->joined = this->done.ReceiveUntil(deadline).has_value();
+			return this->joined;
+		}
+
+		size_t CancelledCount() const { return this->cancelled.load(std::memory_order_relaxed); }
+		// Valid after Join, empty slots for tasks that were cancelled.
+		std::vector<Slot>& Results() { return this->results; }
+	};
+}
@@ -0,0 +1,122 @@
+#include <algorithm>
+
+#include "TaskGroup.hpp"
+
+namespace CoroutineScheduler
+{
+	//----------------------- TaskGroup -----------------------
+	TaskGroup::TaskGroup(std::string name, const TaskGroupConfig& config, unsigned int runtimeId, size_t initialCapacity, const unsigned int(&weights)[RunQueue::ClassCount])
+		: queue(initialCapacity, weights), name(std::move(name)), config(config), runtimeId(runtimeId) {}
+
+	// Starts the periods that elapsed since the last charge. Usage beyond the quota is carried over
+	// as debt, a cooperative task can overrun its quota by a whole slice.
+	void TaskGroup::Refill(uint64_t now) {
+		uint64_t period = std::max<uint64_t>(1, this->config.period.count());
+		if (now < this->periodStart + period)
+			return;
+		uint64_t elapsed = (now - this->periodStart) / period;
+		this->periodStart += elapsed * period;
+		uint64_t refill = elapsed * static_cast<uint64_t>(this->config.quota.count());
+		this->periodUsage = this->periodUsage > refill ? this->periodUsage - refill : 0;
+		if (this->throttledUntil != 0)
+			this->throttledUntil = this->periodUsage < static_cast<uint64_t>(this->config.quota.count()) ? 0 : this->periodStart + period;
+	}
+
+	void TaskGroup::Charge(uint64_t sliceNs, uint64_t now) {
+		this->cpuTime.fetch_add(sliceNs, std::memory_order_relaxed);
+		this->vruntime.fetch_add(sliceNs * 1024 / std::max(1u, this->config.weight), std::memory_order_relaxed);
+		if (!HasQuota())
+			return;
+		if (this->periodStart == 0) this->periodStart = now;
+		Refill(now);
+		this->periodUsage += sliceNs;
+		if (this->periodUsage >= static_cast<uint64_t>(this->config.quota.count()) && this->throttledUntil == 0) {
+			this->throttledUntil = this->periodStart + std::max<uint64_t>(1, this->config.period.count());
+			this->throttled.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	//---------------------------------------------------------
+
+	//----------------------- GroupQueue -----------------------
+	void GroupQueue::PushBack(ITask* task) {
+		TaskGroup* group = task->group;
+		if (!group->active) {
+			// like CFS, a group waking up starts at the smallest virtual runtime instead of cashing in its idle time
+			uint64_t floor = UINT64_MAX;
+			for (TaskGroup* g : this->active)
+				floor = std::min(floor, g->vruntime.load(std::memory_order_relaxed));
+			if (floor != UINT64_MAX && group->vruntime.load(std::memory_order_relaxed) < floor)
+				group->vruntime.store(floor, std::memory_order_relaxed);
+			group->active = true;
+			this->active.push_back(group);
+		}
+		group->queue.PushBack(task);
+		this->count++;
+		if (group->throttledUntil == 0)
+			this->runnable.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void GroupQueue::SetThrottled(TaskGroup* group, bool wasThrottled) {
+		bool throttled = group->throttledUntil != 0;
+		if (!group->active || throttled == wasThrottled)
+			return;
+		if (throttled) this->runnable.fetch_sub(group->queue.Size(), std::memory_order_relaxed);
+		else this->runnable.fetch_add(group->queue.Size(), std::memory_order_relaxed);
+	}
+
+	void GroupQueue::Charge(TaskGroup* group, uint64_t sliceNs, uint64_t now) {
+		if (!group->HasQuota()) {
+			group->Charge(sliceNs, now);
+			return;
+		}
+		bool wasThrottled = group->throttledUntil != 0;
+		group->Charge(sliceNs, now);
+		SetThrottled(group, wasThrottled);
+	}
+
+	TaskGroup* GroupQueue::PickGroup(uint64_t now) {
+		TaskGroup* pick = nullptr;
+		uint64_t best = UINT64_MAX;
+		for (TaskGroup* g : this->active) {
+			if (g->throttledUntil != 0) {
+				g->Refill(now);
+				SetThrottled(g, true);
+				if (g->throttledUntil != 0) continue;
+			}
+			uint64_t v = g->vruntime.load(std::memory_order_relaxed);
+			if (pick == nullptr || v < best) {
+				pick = g;
+				best = v;
+			}
+		}
+		return pick;
+	}
+
+	ITask* GroupQueue::PopFront(uint64_t now) {
+		TaskGroup* group = PickGroup(now);
+		if (group == nullptr)
+			return nullptr;
+		ITask* task = group->queue.PopFront();
+		this->count--;
+		this->runnable.fetch_sub(1, std::memory_order_relaxed);
+		if (group->queue.Empty()) {
+			group->active = false;
+			this->active.erase(std::find(this->active.begin(), this->active.end(), group));
+		}
+		return task;
+	}
+
+	bool GroupQueue::HasRunnable(uint64_t now) {
+		return PickGroup(now) != nullptr;
+	}
+
+	uint64_t GroupQueue::NextRefill() const {
+		uint64_t next = 0;
+		for (TaskGroup* g : this->active) {
+			if (g->throttledUntil != 0 && (next == 0 || g->throttledUntil < next))
+				next = g->throttledUntil;
+		}
+		return next;
+	}
+	//----------------------------------------------------------
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Task.hpp"
+#include "RunQueue.hpp"
+
+namespace CoroutineScheduler
+{
+	struct TaskGroupConfig {
+		// share of the Procs relative to other busy groups, 1024 is the default group's weight
+		unsigned int weight = 1024;
+		// CPU time the group may use per period, 0 for no limit
+		std::chrono::nanoseconds quota{ 0 };
+		std::chrono::nanoseconds period = std::chrono::milliseconds(100);
+	};
+
+	// Tasks sharing CPU time, e.g. one tenant. Groups are picked by virtual runtime, the CPU time they
+	// used scaled by 1024/weight, so busy groups converge on CPU shares proportional to their weights
+	// however their tasks split that time into slices.
+	class TaskGroup {
+		friend class GroupQueue;
+
+		RunQueue queue;
+		// nanoseconds of Stats::NowNs, the bookkeeping below is guarded by the runtime's queueMutex
+		uint64_t periodStart = 0;
+		uint64_t periodUsage = 0;
+		uint64_t throttledUntil = 0;
+		bool active = false;
+
+		void Refill(uint64_t now);
+	public:
+		const std::string name;
+		const TaskGroupConfig config;
+		// Runtime::GetId of the runtime that created the group, tasks of other runtimes cannot join it
+		const unsigned int runtimeId;
+		std::atomic<uint64_t> vruntime{ 0 };
+		std::atomic<uint64_t> cpuTime{ 0 };
+		std::atomic<uint64_t> throttled{ 0 };
+
+		TaskGroup(std::string name, const TaskGroupConfig& config, unsigned int runtimeId, size_t initialCapacity, const unsigned int(&weights)[RunQueue::ClassCount]);
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+		bool HasQuota() const { return this->config.quota.count() != 0; }
+		// Adds a finished slice. Must hold the runtime's queueMutex when the group has a quota.
+		void Charge(uint64_t sliceNs, uint64_t now);
+	};
+
+	// The runtime's run queue: every group's RunQueue, served by smallest virtual runtime while
+	// skipping groups that used up their quota. Not thread-safe.
+	class GroupQueue {
+		std::vector<TaskGroup*> active;
+		size_t count = 0;
+		// queued tasks of groups that are not throttled, read without the lock by spinning Procs
+		std::atomic<size_t> runnable{ 0 };
+
+		void SetThrottled(TaskGroup* group, bool wasThrottled);
+
+		TaskGroup* PickGroup(uint64_t now);
+	public:
+		void PushBack(ITask* task);
+		// nullptr when every queued task belongs to a throttled group
+		ITask* PopFront(uint64_t now);
+		bool HasRunnable(uint64_t now);
+		// TaskGroup::Charge that moves the group's queued tasks in or out of Runnable when its quota
+		// runs out or is refilled
+		void Charge(TaskGroup* group, uint64_t sliceNs, uint64_t now);
+		// when the next throttled group gets its quota back, 0 when none is throttled
+		uint64_t NextRefill() const;
+		bool Empty() const { return this->count == 0; }
+		size_t Size() const { return this->count; }
+		// may be stale, a throttled group is only refilled when the queue is popped
+		size_t Runnable() const { return this->runnable.load(std::memory_order_relaxed); }
+	};
+}
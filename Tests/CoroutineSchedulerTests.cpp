@@ -0,0 +1,1231 @@
+// Behaviour tests for the coroutine scheduler.
+//
+// Each test is a function registered in 'tests' below; CTest runs every one in a process of its
+// own (CoroutineSchedulerTests <name>), without arguments all of them run in turn. A failed CHECK
+// prints the condition and exits with 1.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "../includes/Coroutine.h"
+
+#if defined(__linux__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+static void Check(bool ok, const char* what, const char* file, int line) {
+	if (!ok) {
+		std::cerr << std::format("{}:{}: check failed: {}\n", file, line, what);
+		std::exit(1);
+	}
+}
+
+//----------------------- Await -----------------------
+// Children finishing right around the awaiter's deadline: a timed-out await must neither lose the
+// child's value nor leave a wake-up behind that ends the awaiter's next park early.
+static void TestAwaitTimeoutRace() {
+	auto result = Coroutine::Run("awaiter", [] {
+		int completed = 0, timedOut = 0;
+		for (int i = 0; i < 2000; i++) {
+			auto child = Coroutine::Run("child", [i] {
+				auto busyUntil = Clock::now() + std::chrono::microseconds(i % 20);
+				while (Clock::now() < busyUntil) {}
+				Coroutine::Yield();
+				return i;
+			});
+			if (child->AwaitFor(std::chrono::microseconds(i % 25))) {
+				completed++;
+				CHECK(child->GetReturnValue() == i);
+			}
+			else timedOut++;
+			child->Await();
+			CHECK(child->GetReturnValue() == i);
+			if (i % 100 == 0) {
+				auto start = Clock::now();
+				Coroutine::Syscall::SleepFor(1ms);
+				CHECK(Clock::now() - start >= 1ms);
+			}
+		}
+		return completed + timedOut;
+	});
+	CHECK(result->GetReturnValue() == 2000);
+
+	// from a thread outside the runtime
+	auto slow = Coroutine::Run("slow", [] { Coroutine::Syscall::SleepFor(50ms); return 5; });
+	CHECK(!slow->AwaitFor(1ms));
+	CHECK(slow->AwaitFor(10s));
+	CHECK(slow->GetReturnValue() == 5);
+}
+
+// The child completes while its awaiter's timer fires: whichever wake ends the timed await, the
+// other must not be left to end the awaiter's next park, which only the helper thread may end.
+static void TestAwaitTimerCompletionRace() {
+	Coroutine::RuntimeConfig config;
+	config.workers = 2;
+	Coroutine::Runtime runtime(config);
+	auto awaiter = Coroutine::Run(runtime, "awaiter", [&] {
+		auto& current = Coroutine::Runtime::Current();
+		CoroutineScheduler::ITask* self = current.GetCurrentContextTask();
+		int stray = 0;
+		for (int i = 0; i < 10000; i++) {
+			auto wait = std::chrono::microseconds(10 + i % 20);
+			auto busyUntil = Clock::now() + wait + std::chrono::microseconds(i % 97);
+			Coroutine::RunOptions options;
+			options.cancellation = Coroutine::CancellationToken();
+			auto child = Coroutine::Run(current, options, "child", [busyUntil] { while (Clock::now() < busyUntil) {} });
+			child->AwaitFor(wait);
+			child->Await();
+			std::atomic<bool> woken{ false };
+			std::thread helper([&] {
+				std::this_thread::sleep_for(200us);
+				woken = true;
+				Coroutine::Runtime::Wake(self);
+			});
+			current.PreemptCurrentTask(CoroutineScheduler::ParkReason::ParkChannel);
+			if (!woken) {
+				stray++;
+				while (!woken) std::this_thread::yield();
+				current.PreemptCurrentTask(CoroutineScheduler::ParkReason::ParkChannel);
+			}
+			helper.join();
+		}
+		return stray;
+	});
+	CHECK(awaiter->GetReturnValue() == 0);
+}
+
+// Cancelling an awaiting coroutine ends its Await with CancelledError. The child it waited for has
+// a token of its own: the cancelled awaiter's handle lets go of it and it runs to completion.
+static void TestAwaitCancel() {
+	Coroutine::CancellationToken token;
+	Coroutine::RunOptions options;
+	options.cancellation = token;
+	std::atomic<bool> childFinished{ false };
+	std::atomic<bool> awaitThrew{ false };
+	auto awaiter = Coroutine::Run(options, "awaiter", [&] {
+		Coroutine::RunOptions childOptions;
+		childOptions.cancellation = Coroutine::CancellationToken();
+		auto child = Coroutine::Run(childOptions, "child", [&] {
+			Coroutine::Syscall::SleepFor(100ms);
+			childFinished = true;
+		});
+		try {
+			child->Await();
+		}
+		catch (const Coroutine::CancelledError&) {
+			awaitThrew = true;
+			throw;
+		}
+	});
+	std::this_thread::sleep_for(20ms);
+	token.Cancel();
+	CHECK(awaiter->IsCancelled());
+	CHECK(awaitThrew);
+	CHECK(!childFinished);
+	auto deadline = Clock::now() + 10s;
+	while (!childFinished && Clock::now() < deadline) std::this_thread::sleep_for(1ms);
+	CHECK(childFinished);
+}
+
+//----------------------- Channels -----------------------
+static void TestChannelTimeouts() {
+	auto channel = std::make_shared<CoroutineScheduler::Channel::SimpleChannel<int>>(1);
+	auto result = Coroutine::Run("timeouts", [channel] {
+		auto start = Clock::now();
+		CHECK(!channel->ReceiveFor(2ms).has_value());
+		CHECK(Clock::now() - start >= 2ms);
+
+		CHECK(channel->SendFor(1, 1s));
+		start = Clock::now();
+		CHECK(!channel->SendFor(2, 2ms));
+		CHECK(Clock::now() - start >= 2ms);
+		// the send that timed out left nothing behind
+		CHECK(channel->ReceiveFor(1s) == std::optional<int>(1));
+		CHECK(!channel->ReceiveFor(1ms).has_value());
+
+		// timeouts that never fire
+		int sum = 0;
+		for (int i = 0; i < 10000; i++) {
+			CHECK(channel->SendFor(i, 10s));
+			sum += *channel->ReceiveFor(10s);
+		}
+		return sum;
+	});
+	CHECK(result->GetReturnValue() == 9999 * 10000 / 2);
+
+	// a value arriving after a receiver gave up goes to the next receiver
+	auto late = Coroutine::Run("late", [channel] {
+		Coroutine::Syscall::SleepFor(20ms);
+		channel->Send(7);
+	});
+	CHECK(!channel->ReceiveFor(1ms).has_value());
+	CHECK(channel->ReceiveFor(10s) == std::optional<int>(7));
+	late->Await();
+}
+
+// A coroutine parked in Receive or Send is woken by Cancel and throws, without taking a value or
+// a slot from the others.
+static void TestChannelCancellation() {
+	auto channel = std::make_shared<CoroutineScheduler::Channel::SimpleChannel<int>>(1);
+	Coroutine::CancellationToken token;
+	Coroutine::RunOptions options;
+	options.cancellation = token;
+	std::atomic<int> cancelled{ 0 };
+	auto receiver = Coroutine::Run(options, "receiver", [&] {
+		try {
+			channel->Receive();
+		}
+		catch (const Coroutine::CancelledError&) {
+			cancelled++;
+			throw;
+		}
+		return 0;
+	});
+	auto full = std::make_shared<CoroutineScheduler::Channel::SimpleChannel<int>>(1);
+	full->Send(1);
+	auto sender = Coroutine::Run(options, "sender", [&] {
+		try {
+			full->Send(2);
+		}
+		catch (const Coroutine::CancelledError&) {
+			cancelled++;
+			throw;
+		}
+	});
+	std::this_thread::sleep_for(20ms);
+	token.Cancel();
+	CHECK(receiver->IsCancelled());
+	CHECK(sender->IsCancelled());
+	CHECK(cancelled == 2);
+	bool threw = false;
+	try {
+		receiver->GetReturnValue();
+	}
+	catch (const Coroutine::CancelledError&) {
+		threw = true;
+	}
+	CHECK(threw);
+
+	// both channels still work, and hold exactly what they held before
+	auto after = Coroutine::Run("after", [&] {
+		channel->Send(3);
+		int received = channel->Receive();
+		return received * 10 + full->Receive();
+	});
+	CHECK(after->GetReturnValue() == 31);
+	CHECK(!full->ReceiveFor(1ms).has_value());
+
+	// cancelled before it parks
+	Coroutine::CancellationToken early;
+	early.Cancel();
+	Coroutine::RunOptions earlyOptions;
+	earlyOptions.cancellation = early;
+	auto never = Coroutine::Run(earlyOptions, "never", [&] { channel->Receive(); });
+	CHECK(never->IsCancelled());
+}
+
+//----------------------- Tracing -----------------------
+// Spawn, run slices ended by a park or the completion, and the waits in between all reach the export.
+static void TestTraceExport() {
+	Coroutine::Trace::Start(1024);
+	auto traced = Coroutine::Run("traced", [] {
+		Coroutine::Syscall::SleepFor(1ms);
+		return 1;
+	});
+	CHECK(traced->GetReturnValue() == 1);
+	Coroutine::Trace::Stop();
+	// recorded after Stop: not in the export
+	Coroutine::Run("untraced", [] {})->Await();
+
+	auto path = std::filesystem::temp_directory_path() / "CoroutineSchedulerTests-trace.json";
+	Coroutine::Trace::ExportChromeTrace(path.string());
+	std::ifstream in(path);
+	std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	std::filesystem::remove(path);
+	auto contains = [&](const std::string& what) { return json.find(what) != std::string::npos; };
+	CHECK(json.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+	CHECK(json.ends_with("]}\n"));
+	CHECK(contains("\"name\":\"spawn traced\""));
+	CHECK(contains("\"name\":\"traced\",\"cat\":\"run\""));
+	CHECK(contains("\"end\":\"park: sleep\""));
+	CHECK(contains("\"end\":\"complete\""));
+	CHECK(contains("\"name\":\"parked: sleep\""));
+	CHECK(!contains("untraced"));
+}
+
+//----------------------- Metrics -----------------------
+static void TestStats() {
+	Coroutine::RuntimeConfig config;
+	config.workers = 2;
+	Coroutine::Runtime runtime(config);
+	auto waitFor = [&](auto condition) {
+		auto deadline = Clock::now() + 10s;
+		while (!condition(runtime.GetStats()) && Clock::now() < deadline) std::this_thread::sleep_for(1ms);
+		return condition(runtime.GetStats());
+	};
+
+	Coroutine::RunMany(runtime, "sleeper", [](int) { Coroutine::Syscall::SleepFor(1ms); }, std::views::iota(0, 100))->Await();
+
+	// the gauge follows the coroutines parked on a channel
+	auto channel = std::make_shared<CoroutineScheduler::Channel::SimpleChannel<int>>(1);
+	auto receivers = Coroutine::RunMany(runtime, "receiver", [channel](int) { channel->Receive(); }, std::views::iota(0, 8));
+	CHECK(waitFor([](const auto& stats) { return stats.parkedOnChannel == 8; }));
+	for (int i = 0; i < 8; i++) channel->Send(i);
+	receivers->Await();
+	CHECK(waitFor([](const auto& stats) { return stats.parkedOnChannel == 0 && stats.tasksCompleted == 108; }));
+
+	auto stats = runtime.GetStats();
+	CHECK(stats.workers == 2);
+	CHECK(stats.tasksSpawned == 108);
+	CHECK(stats.tasksParked >= 108);
+	CHECK(stats.timersFired >= 100);
+	CHECK(stats.runQueueWait.total >= 108);
+	CHECK(stats.timeSlice.total >= 108);
+	CHECK(stats.runQueueWait.Percentile(0.5) <= stats.runQueueWait.Percentile(0.99));
+
+	std::string text = stats.ToPrometheus();
+	auto contains = [&](const std::string& what) { return text.find(what) != std::string::npos; };
+	CHECK(contains("# TYPE coroutine_tasks_spawned_total counter\ncoroutine_tasks_spawned_total 108\n"));
+	CHECK(contains("coroutine_parked_on_channel 0\n"));
+	CHECK(contains(std::format("coroutine_time_slice_seconds_bucket{{le=\"+Inf\"}} {}\n", stats.timeSlice.total)));
+	CHECK(contains(std::format("coroutine_run_queue_wait_seconds_count {}\n", stats.runQueueWait.total)));
+}
+
+//----------------------- Coroutine dump -----------------------
+// Touches 16 KiB of its stack, then parks on 'channel' until it is sent a value.
+static void DeepReceive(CoroutineScheduler::Channel::SimpleChannel<int>& channel) {
+	volatile char frame[16 * 1024];
+	for (size_t i = 0; i < sizeof(frame); i++) frame[i] = 1;
+	channel.Receive();
+	CHECK(frame[0] == 1);
+}
+
+static void TestDumpCoroutines() {
+	for (bool accounting : { false, true }) {
+		Coroutine::RuntimeConfig config;
+		config.workers = 1;
+		config.stackSize = 64 * 1024;
+		config.stackAccounting = accounting;
+		Coroutine::Runtime runtime(config);
+		auto channel = std::make_shared<CoroutineScheduler::Channel::SimpleChannel<int>>(1);
+		auto parked = Coroutine::Run(runtime, "deep-receiver", [channel] { DeepReceive(*channel); });
+		std::string dump;
+		auto deadline = Clock::now() + 10s;
+		do {
+			std::ostringstream out;
+			runtime.DumpCoroutines(out);
+			dump = out.str();
+		} while (dump.find("[parked: channel") == std::string::npos && Clock::now() < deadline);
+		auto contains = [&](const std::string& what) { return dump.find(what) != std::string::npos; };
+		CHECK(dump.starts_with("1 live coroutines"));
+		CHECK(contains("\"deep-receiver\":\n"));
+		CHECK(contains("\t#0 "));
+		if (accounting) {
+			size_t at = dump.find("\tstack high-water: ");
+			CHECK(at != std::string::npos);
+			unsigned long highWater = std::stoul(dump.substr(at + std::strlen("\tstack high-water: ")));
+			CHECK(highWater >= 16 * 1024 && highWater < 64 * 1024);
+		}
+		else {
+			CHECK(contains("stack use not tracked"));
+			CHECK(!contains("high-water"));
+		}
+		channel->Send(1);
+		parked->Await();
+	}
+}
+
+//----------------------- Generator -----------------------
+static void TestGenerator() {
+	// consumed from a plain thread, lazily
+	int produced = 0;
+	Coroutine::Generator<int> squares([&](auto& out) {
+		for (int i = 1; i <= 5; i++) {
+			produced++;
+			out.Yield(i * i);
+		}
+	}, 64 * 1024);
+	CHECK(produced == 0);
+	std::vector<int> seen;
+	for (int value : squares) seen.push_back(value);
+	CHECK(seen == std::vector<int>({ 1, 4, 9, 16, 25 }));
+	CHECK(squares.Next() == nullptr);
+
+	// destroyed half way: the producer's stack is unwound
+	struct Guard {
+		bool& unwound;
+		~Guard() { unwound = true; }
+	};
+	bool unwound = false;
+	{
+		Coroutine::Generator<int> endless([&](auto& out) {
+			Guard guard{ unwound };
+			for (int i = 0;; i++) out.Yield(i);
+		}, 64 * 1024);
+		CHECK(*endless.Next() == 0);
+		CHECK(*endless.Next() == 1);
+	}
+	CHECK(unwound);
+
+	// what the producer throws reaches the consumer
+	Coroutine::Generator<int> failing([](auto& out) {
+		out.Yield(1);
+		throw std::runtime_error("producer failed");
+	}, 64 * 1024);
+	CHECK(*failing.Next() == 1);
+	bool threw = false;
+	try {
+		failing.Next();
+	}
+	catch (const std::runtime_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+
+	// consumed from a coroutine, a producer that sleeps parks its consumer with it
+	auto sum = Coroutine::Run("consumer", [] {
+		Coroutine::Generator<std::string> words([](auto& out) {
+			for (const char* word : { "a", "bb", "ccc" }) {
+				Coroutine::Syscall::SleepFor(1ms);
+				out.Yield(word);
+			}
+		});
+		size_t length = 0;
+		for (std::string& word : words) length += word.size();
+		return length;
+	});
+	CHECK(sum->GetReturnValue() == 6);
+}
+
+//----------------------- Pipeline -----------------------
+// Parallel workers of an ordered stage finish out of order, the sink must not see it.
+static void TestPipelineOrdering() {
+	std::vector<int> seen;
+	std::mutex seenMutex;
+	auto pipeline = Coroutine::PipelineBuilder<int>("ordering")
+		.Stage("jitter", [](int x) {
+			if (x % 7 == 0) Coroutine::Syscall::SleepFor(std::chrono::microseconds(x % 300));
+			return x * 2;
+		}, { .parallelism = 4, .buffer = 64, .ordered = true })
+		.Stage("drop-odd-tens", [](int x) -> std::optional<int> {
+			if ((x / 20) % 2 == 1) return std::nullopt;
+			return x;
+		}, { .parallelism = 3, .buffer = 32, .ordered = true })
+		.Sink("collect", [&](int x) {
+			std::lock_guard lock(seenMutex);
+			seen.push_back(x);
+		});
+	std::vector<int> expected;
+	for (int i = 0; i < 20000; i++) {
+		pipeline->Push(i);
+		if ((i * 2 / 20) % 2 == 0) expected.push_back(i * 2);
+	}
+	pipeline->Close();
+	CHECK(seen == expected);
+	auto stats = pipeline->GetStats();
+	CHECK(stats.size() == 4);
+	CHECK(stats[0].itemsIn == 20000);
+	CHECK(stats[1].itemsIn == 20000);
+	CHECK(stats[3].itemsIn == expected.size());
+}
+
+// A stalled item holds back everything behind it, so Push stops after a bounded number of items
+// instead of buffering the stream.
+static void TestPipelineBackpressure() {
+	std::atomic<bool> release{ false };
+	std::atomic<int> pushed{ 0 };
+	std::vector<int> seen;
+	std::mutex seenMutex;
+	auto pipeline = Coroutine::PipelineBuilder<int>("backpressure")
+		.Stage("stall-first", [&](int x) {
+			if (x == 0)
+				while (!release) Coroutine::Syscall::SleepFor(1ms);
+			return x;
+		}, { .parallelism = 4, .buffer = 16, .ordered = true })
+		.Sink("collect", [&](int x) {
+			std::lock_guard lock(seenMutex);
+			seen.push_back(x);
+		}, { .buffer = 16 });
+	std::thread producer([&] {
+		for (int i = 0; i < 100000; i++) {
+			pipeline->Push(i);
+			pushed++;
+		}
+		pipeline->Close();
+	});
+	std::this_thread::sleep_for(200ms);
+	int whileStalled = pushed.load();
+	release = true;
+	producer.join();
+	CHECK(whileStalled < 1000);
+	CHECK(seen.size() == 100000);
+	CHECK(std::ranges::is_sorted(seen));
+
+	// a slow sink holds back Push the same way
+	std::atomic<int> sunk{ 0 };
+	pushed = 0;
+	auto slow = Coroutine::PipelineBuilder<int>("slow-sink")
+		.Stage("pass", [](int x) { return x; }, { .parallelism = 2, .buffer = 16 })
+		.Sink("sleep", [&](int) {
+			Coroutine::Syscall::SleepFor(1ms);
+			sunk++;
+		}, { .buffer = 16 });
+	std::thread slowProducer([&] {
+		for (int i = 0; i < 400; i++) {
+			slow->Push(i);
+			pushed++;
+		}
+		slow->Close();
+	});
+	std::this_thread::sleep_for(50ms);
+	CHECK(pushed.load() - sunk.load() < 200);
+	slowProducer.join();
+	CHECK(sunk == 400);
+}
+
+// Stage names reach the trace through their worker tasks, the export must not read them after
+// the pipeline that owned them is gone.
+static void TestPipelineTraceNames() {
+	Coroutine::Trace::Start(1024);
+	{
+		auto pipeline = Coroutine::PipelineBuilder<int>("traced")
+			.Stage(std::string("double-") + "stage", [](int x) { return x * 2; }, { .parallelism = 2, .buffer = 8 })
+			.Sink("drop", [](int) {});
+		for (int i = 0; i < 100; i++) pipeline->Push(i);
+		pipeline->Close();
+	}
+	Coroutine::Trace::Stop();
+	auto path = std::filesystem::temp_directory_path() / "CoroutineSchedulerTests-pipeline-trace.json";
+	Coroutine::Trace::ExportChromeTrace(path.string());
+	std::ifstream in(path);
+	std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	std::filesystem::remove(path);
+	CHECK(json.find("\"name\":\"double-stage\",\"cat\":\"run\"") != std::string::npos);
+	CHECK(Coroutine::Trace::InternName(std::string("double-stage")) == Coroutine::Trace::InternName("double-stage"));
+}
+
+//----------------------- RunMany -----------------------
+static void TestRunMany() {
+	// results come back in the order of the range, whatever order the coroutines finish in
+	std::vector<std::string> words{ "one", "three", "five", "seven" };
+	auto lengths = Coroutine::RunMany("length", [](std::string word) {
+		Coroutine::Syscall::SleepFor(std::chrono::milliseconds(8 - word.size()));
+		return word.size();
+	}, words);
+	CHECK(lengths->Size() == 4);
+	CHECK(lengths->GetReturnValues() == std::vector<size_t>({ 3, 5, 4, 5 }));
+
+	auto none = Coroutine::RunMany("none", [](int x) { return x; }, std::vector<int>{});
+	CHECK(none->GetReturnValues().empty());
+
+	// one wait for all of them, with a deadline
+	std::atomic<int> finished{ 0 };
+	auto sleepers = Coroutine::RunMany("sleeper", [&](int) {
+		Coroutine::Syscall::SleepFor(30ms);
+		finished++;
+	}, std::views::iota(0, 1000));
+	CHECK(!sleepers->AwaitFor(1ms));
+	CHECK(sleepers->AwaitFor(10s));
+	CHECK(finished == 1000);
+
+	// cancelled half way: the ones still parked end with CancelledError
+	Coroutine::CancellationToken token;
+	Coroutine::RunOptions options;
+	options.cancellation = token;
+	auto parked = Coroutine::RunMany(options, "parked", [](int i) {
+		if (i % 2 == 0) Coroutine::Syscall::SleepFor(10s);
+		return i;
+	}, std::views::iota(0, 10));
+	std::this_thread::sleep_for(20ms);
+	token.Cancel();
+	CHECK(parked->CancelledCount() == 5);
+	bool threw = false;
+	try {
+		parked->GetReturnValues();
+	}
+	catch (const Coroutine::CancelledError&) {
+		threw = true;
+	}
+	CHECK(threw);
+
+	// awaited from a coroutine
+	auto sum = Coroutine::Run("spawner", [] {
+		auto squares = Coroutine::RunMany("square", [](int x) { return x * x; }, std::views::iota(1, 101));
+		int total = 0;
+		for (int value : squares->GetReturnValues()) total += value;
+		return total;
+	});
+	CHECK(sum->GetReturnValue() == 338350);
+}
+
+//----------------------- FiberLocal -----------------------
+static std::atomic<int> fiberLocalsDestroyed{ 0 };
+
+struct Tracked {
+	int value = 0;
+	~Tracked() { fiberLocalsDestroyed++; }
+};
+
+static void TestFiberLocal() {
+	Coroutine::RuntimeConfig config;
+	config.workers = 4;
+	Coroutine::Runtime runtime(config);
+	static Coroutine::FiberLocal<int> counter;
+	static Coroutine::FiberLocal<std::string> label([] { return std::string("unset"); });
+	static Coroutine::FiberLocal<Tracked> tracked;
+	// more than the inline slots, the rest go to the overflow vector
+	std::vector<std::unique_ptr<Coroutine::FiberLocal<long>>> many;
+	for (size_t i = 0; i < CoroutineScheduler::FiberLocalSlots::InlineSlots + 4; i++)
+		many.push_back(std::make_unique<Coroutine::FiberLocal<long>>());
+
+	// every coroutine keeps its own values across parks, whichever Proc it resumes on
+	auto checks = Coroutine::RunMany(runtime, "local", [&](int i) {
+		CHECK(!counter.HasValue());
+		CHECK(*label == "unset");
+		*label = std::to_string(i);
+		tracked->value = i;
+		for (auto& local : many) **local = i;
+		for (int step = 0; step < 20; step++) {
+			(*counter)++;
+			if (step % 2 == 0) Coroutine::Yield();
+			else Coroutine::Syscall::SleepFor(std::chrono::microseconds(50));
+		}
+		bool intact = *counter == 20 && *label == std::to_string(i) && tracked->value == i;
+		for (auto& local : many) intact = intact && **local == i;
+		counter.Reset();
+		CHECK(!counter.HasValue() && *counter == 0);
+		return intact;
+	}, std::views::iota(0, 200));
+	auto intact = checks->GetReturnValues();
+	CHECK(std::ranges::all_of(intact, [](bool ok) { return ok; }));
+	// destroyed when each coroutine completed, before its awaiter saw it done
+	CHECK(fiberLocalsDestroyed == 200);
+
+	// threads outside the runtime have a value each
+	*label = "main";
+	std::thread other([] { CHECK(*label == "unset"); });
+	other.join();
+	CHECK(*label == "main");
+}
+
+//----------------------- ProcLocal -----------------------
+static void TestProcLocal() {
+	Coroutine::RuntimeConfig config;
+	config.workers = 4;
+	Coroutine::Runtime runtime(config);
+	Coroutine::ProcLocal<uint64_t> hits(runtime);
+	Coroutine::ProcLocal<uint64_t> seeded(7, runtime);
+	CHECK(hits.Size() == 5);
+	CHECK(hits.Local() == nullptr);
+	CHECK(seeded.Reduce(uint64_t(0), std::plus<>()) == 35);
+
+	auto workers = Coroutine::RunMany(runtime, "counter", [&](int) {
+		for (int i = 0; i < 100; i++) {
+			hits.With([](uint64_t& count) { count++; });
+			if (i % 10 == 0) Coroutine::Yield();
+		}
+		CHECK(hits.Local() != nullptr);
+	}, std::views::iota(0, 1000));
+	// threads outside the runtime share the extra instance
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+		threads.emplace_back([&] { for (int i = 0; i < 1000; i++) hits.With([](uint64_t& count) { count++; }); });
+	for (auto& thread : threads) thread.join();
+	workers->Await();
+
+	CHECK(hits.Reduce(uint64_t(0), std::plus<>()) == 1000 * 100 + 4 * 1000);
+	std::vector<uint64_t> perInstance;
+	hits.ForEach([&](uint64_t& count) { perInstance.push_back(count); });
+	CHECK(perInstance.size() == 5);
+	CHECK(perInstance.back() == 4 * 1000);
+}
+
+//----------------------- ShmChannel -----------------------
+// A forked process echoes values back over a second segment: plain blocking threads on its side,
+// coroutines that park and are woken by the poller thread on this one.
+static void TestShmChannel() {
+#if defined(__linux__)
+	struct Message {
+		int sequence;
+		double payload;
+	};
+	std::string ping = std::format("/coroutine-tests-ping-{}", ::getpid());
+	std::string pong = std::format("/coroutine-tests-pong-{}", ::getpid());
+	{
+		// created before the fork so neither side can miss the other's segment
+		Coroutine::ShmChannel<Message> created(ping, 64);
+		Coroutine::ShmChannel<Message> createdPong(pong, 64);
+	}
+	// forked before this process starts any runtime thread
+	pid_t child = ::fork();
+	CHECK(child >= 0);
+	if (child == 0) {
+		Coroutine::ShmChannel<Message> in(ping);
+		Coroutine::ShmChannel<Message> out(pong);
+		while (true) {
+			Message message = in.Receive();
+			out.Send({ message.sequence, message.payload * 2 });
+			if (message.sequence < 0) break;
+		}
+		::_exit(0);
+	}
+
+	constexpr int Count = 20000;
+	auto sender = Coroutine::Run("shm-sender", [&] {
+		Coroutine::ShmChannel<Message> out(ping);
+		for (int i = 0; i < Count; i++) out.Send({ i, 0.5 * i });
+		out.Send({ -1, 0 });
+	});
+	auto receiver = Coroutine::Run("shm-receiver", [&] {
+		Coroutine::ShmChannel<Message> in(pong);
+		bool inOrder = true;
+		for (int i = 0; i < Count; i++) {
+			Message message = in.Receive();
+			inOrder = inOrder && message.sequence == i && message.payload == i;
+		}
+		return inOrder && in.Receive().sequence == -1;
+	});
+	sender->Await();
+	CHECK(receiver->GetReturnValue());
+	int status = 0;
+	CHECK(::waitpid(child, &status, 0) == child);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// an empty ring reports nothing, a full one refuses
+	Coroutine::ShmChannel<Message> local(ping);
+	CHECK(local.Capacity() == 64);
+	CHECK(!local.TryReceive().has_value());
+	for (size_t i = 0; i < local.Capacity(); i++) CHECK(local.TrySend({ static_cast<int>(i), 0 }));
+	CHECK(!local.TrySend({ 0, 0 }));
+	CHECK(local.TryReceive()->sequence == 0);
+	Coroutine::ShmChannel<Message>::Unlink(ping);
+	Coroutine::ShmChannel<Message>::Unlink(pong);
+#endif
+}
+
+//----------------------- Actor -----------------------
+// Destroying an actor drops its unhandled messages and waits for a running handler, which never
+// runs again afterwards; activations coming and going leave the registry walkable.
+static void TestActorTeardown() {
+	std::atomic<long> sum{ 0 };
+	{
+		std::vector<std::unique_ptr<Coroutine::Actor<int>>> actors;
+		for (int i = 0; i < 1000; i++)
+			actors.push_back(std::make_unique<Coroutine::Actor<int>>([&](int& v) { sum += v; }, Coroutine::ActorConfig{ .batch = 16, .name = "sum" }));
+		std::atomic<bool> dumping{ true };
+		auto dumper = Coroutine::Run("dumper", [&] {
+			while (dumping) {
+				std::ostringstream out;
+				Coroutine::DumpCoroutines(out);
+				Coroutine::Yield();
+			}
+		});
+		std::vector<std::thread> producers;
+		for (int t = 0; t < 4; t++)
+			producers.emplace_back([&] {
+				for (int round = 0; round < 20; round++)
+					for (auto& actor : actors) CHECK(actor->Send(1));
+			});
+		for (auto& producer : producers) producer.join();
+		auto deadline = Clock::now() + 30s;
+		while (sum.load() != 1000L * 80 && Clock::now() < deadline) std::this_thread::yield();
+		dumping = false;
+		dumper->Await();
+	}
+	CHECK(sum.load() == 1000L * 80);
+
+	// one message at a time, in the order sent, even when the handler parks
+	{
+		int last = -1;
+		bool inOrder = true;
+		std::atomic<int> inside{ 0 }, handled{ 0 };
+		Coroutine::Actor<int> actor([&](int& v) {
+			if (inside++ != 0) inOrder = false;
+			if (v != last + 1) inOrder = false;
+			last = v;
+			if (v % 100 == 0) Coroutine::Syscall::SleepFor(std::chrono::microseconds(50));
+			inside--;
+			handled++;
+		}, Coroutine::ActorConfig{ .batch = 8 });
+		auto producer = Coroutine::Run("producer", [&] { for (int i = 0; i < 5000; i++) actor.Send(i); });
+		producer->Await();
+		auto deadline = Clock::now() + 30s;
+		while (handled.load() != 5000 && Clock::now() < deadline) std::this_thread::yield();
+		CHECK(handled == 5000);
+		CHECK(inOrder);
+	}
+
+	// destroyed with a backlog and a handler parked mid-message, from a thread and from a coroutine
+	for (bool fromCoroutine : { false, true }) {
+		std::atomic<int> handled{ 0 }, inside{ 0 };
+		std::atomic<bool> destroyed{ false }, afterDestroy{ false };
+		auto actor = std::make_unique<Coroutine::Actor<int>>([&](int&) {
+			if (destroyed) afterDestroy = true;
+			inside++;
+			Coroutine::Syscall::SleepFor(std::chrono::microseconds(200));
+			inside--;
+			handled++;
+		});
+		for (int i = 0; i < 1000; i++) CHECK(actor->Send(i));
+		std::this_thread::sleep_for(2ms);
+		if (fromCoroutine) Coroutine::Run("destroy", [&] { actor.reset(); })->Await();
+		else actor.reset();
+		destroyed = true;
+		CHECK(inside == 0);
+		CHECK(handled < 1000);
+		std::this_thread::sleep_for(5ms);
+		CHECK(!afterDestroy);
+	}
+}
+
+//----------------------- Inline children -----------------------
+// On a single Proc a child awaited right after its spawn has not been started, so the awaiter runs
+// it on its own fiber. The child still gets FiberLocals of its own and may park, and nests.
+static void TestInlineChildren() {
+	Coroutine::RuntimeConfig config;
+	config.workers = 1;
+	Coroutine::Runtime runtime(config);
+	static Coroutine::FiberLocal<int> owner;
+	auto parent = Coroutine::Run(runtime, "parent", [&] {
+		*owner = -1;
+		int sum = 0;
+		for (int i = 0; i < 100; i++) {
+			auto child = Coroutine::Run(runtime, "child", [i] {
+				CHECK(*owner == 0);
+				*owner = i;
+				if (i % 10 == 0) Coroutine::Syscall::SleepFor(std::chrono::microseconds(100));
+				if (i % 25 == 0) {
+					auto grandchild = Coroutine::Run("grandchild", [] { return *owner + 1; });
+					CHECK(grandchild->GetReturnValue() == 1);
+				}
+				return *owner * 2;
+			});
+			sum += child->GetReturnValue();
+		}
+		CHECK(*owner == -1);
+		return sum;
+	});
+	CHECK(parent->GetReturnValue() == 99 * 100);
+	auto deadline = Clock::now() + 10s;
+	while (runtime.GetStats().tasksCompleted < 1 + 100 + 4 && Clock::now() < deadline) std::this_thread::sleep_for(1ms);
+	auto stats = runtime.GetStats();
+	CHECK(stats.tasksInlined == 100 + 4);
+	CHECK(stats.tasksCompleted == 1 + 100 + 4);
+}
+
+//----------------------- Single-threaded runtime -----------------------
+static void TestSingleThreaded() {
+	Coroutine::RuntimeConfig config;
+	config.singleThreaded = true;
+	config.workers = 4;
+	Coroutine::Runtime runtime(config);
+
+	auto ping = std::make_shared<Coroutine::LocalChannel<int>>(1);
+	auto pong = std::make_shared<Coroutine::LocalChannel<int>>(1);
+	auto ponger = Coroutine::Run(runtime, "ponger", [=] {
+		while (true) {
+			int v = ping->Receive();
+			pong->Send(v);
+			if (v < 0) break;
+		}
+	});
+	auto pinger = Coroutine::Run(runtime, "pinger", [=] {
+		long sum = 0;
+		for (int i = 0; i < 10000; i++) {
+			ping->Send(i);
+			sum += pong->Receive();
+		}
+		ping->Send(-1);
+		pong->Receive();
+		return sum;
+	});
+	CHECK(pinger->GetReturnValue() == 9999L * 10000 / 2);
+	ponger->Await();
+
+	// every coroutine runs on the same thread
+	std::mutex idsMutex;
+	std::vector<std::thread::id> ids;
+	std::atomic<int> slept{ 0 };
+	auto sleepers = Coroutine::RunMany(runtime, "sleeper", [&](int i) {
+		{
+			std::lock_guard lock(idsMutex);
+			ids.push_back(std::this_thread::get_id());
+		}
+		Coroutine::Syscall::SleepFor(std::chrono::milliseconds(i % 5));
+		slept++;
+		Coroutine::Yield();
+	}, std::views::iota(0, 100));
+	sleepers->Await();
+	CHECK(slept == 100);
+	CHECK(std::ranges::all_of(ids, [&](std::thread::id id) { return id == ids.front(); }));
+	CHECK(runtime.GetStats().workers == 1);
+
+	// fed from a thread outside the runtime through a locking channel
+	Coroutine::Channel<int> channel;
+	auto receiver = channel.GetReceiver();
+	auto total = Coroutine::Run(runtime, "receiver", [receiver] {
+		int sum = 0;
+		for (int i = 0; i < 1000; i++) sum += receiver->Receive();
+		return sum;
+	});
+	std::thread feeder([&] { for (int i = 0; i < 1000; i++) channel.Send(1); });
+	feeder.join();
+	CHECK(total->GetReturnValue() == 1000);
+	delete receiver;
+
+	// children awaited from a coroutine
+	auto parent = Coroutine::Run(runtime, "parent", [&] {
+		int sum = 0;
+		for (int i = 0; i < 100; i++) {
+			auto child = Coroutine::Run(runtime, "child", [] { return 1; });
+			sum += child->GetReturnValue();
+		}
+		return sum;
+	});
+	CHECK(parent->GetReturnValue() == 100);
+
+	// a thread outside the runtime must not block on a LocalChannel
+	bool threw = false;
+	try {
+		Coroutine::LocalChannel<int> local;
+		local.Receive();
+	}
+	catch (const std::logic_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+//----------------------- Arena -----------------------
+static void TestArena() {
+	CHECK(Coroutine::Arena() == std::pmr::get_default_resource());
+
+	Coroutine::RuntimeConfig config;
+	config.workers = 1;
+	config.arenaPageSize = 4096;
+	config.arenaCachedPages = 4;
+	Coroutine::Runtime runtime(config);
+
+	// aligned, oversized and growing allocations all stay intact across parks
+	auto filled = Coroutine::Run(runtime, "arena", [] {
+		std::pmr::memory_resource* arena = Coroutine::Arena();
+		CHECK(arena != std::pmr::get_default_resource());
+		std::pmr::vector<std::pmr::string> words(arena);
+		for (int i = 0; i < 1000; i++) words.emplace_back(std::format("word number {}", i));
+		void* aligned = arena->allocate(100, 64);
+		CHECK(reinterpret_cast<uintptr_t>(aligned) % 64 == 0);
+		auto* big = static_cast<unsigned char*>(arena->allocate(64 * 1024, 16));
+		std::memset(big, 0xAB, 64 * 1024);
+		Coroutine::Syscall::SleepFor(1ms);
+		Coroutine::Yield();
+		bool intact = std::ranges::all_of(std::span(big, 64 * 1024), [](unsigned char b) { return b == 0xAB; });
+		for (int i = 0; i < 1000; i++) intact = intact && std::string_view(words[i]) == std::format("word number {}", i);
+		return intact;
+	});
+	CHECK(filled->GetReturnValue());
+
+	// a completed coroutine's pages go back to its Proc's cache for the next one
+	auto firstAddress = [&] {
+		return Coroutine::Run(runtime, "first-allocation", [] {
+			return reinterpret_cast<uintptr_t>(Coroutine::Arena()->allocate(32, 8));
+		})->GetReturnValue();
+	};
+	uintptr_t first = firstAddress();
+	CHECK(firstAddress() == first);
+
+	CoroutineScheduler::ArenaPageCache cache(4096, 1);
+	CoroutineScheduler::ArenaPage* page = cache.Acquire(100);
+	page->next = nullptr;
+	cache.Release(page);
+	CHECK(cache.Acquire(100) == page);
+	// an oversized block gets a size of its own and goes back to the heap, the page to the cache
+	page->next = cache.Acquire(8192);
+	CHECK(page->next->size == 8192);
+	page->next->next = nullptr;
+	cache.Release(page);
+	page = cache.Acquire(100);
+	CHECK(page->size == 4096);
+	page->next = nullptr;
+	cache.Release(page);
+}
+
+//----------------------- Stack arena -----------------------
+static Fiber::FiberHandle stackArenaThread = nullptr;
+static Fiber::FiberHandle stackArenaFiber = nullptr;
+static int stackArenaRuns = 0;
+
+static void StackArenaFiberMain(void*) {
+	volatile char frame[1024];
+	frame[0] = 1;
+	stackArenaRuns += frame[0];
+	// never resumed, DeleteFiber drops it
+	Fiber::SwitchToFiber(stackArenaFiber, stackArenaThread);
+}
+
+static void TestStackArena() {
+#if defined(__linux__)
+	constexpr uint32_t StackSize = 16 * 1024;
+	CoroutineScheduler::StackArena* arena = CoroutineScheduler::StackArena::Create(StackSize);
+	CHECK(arena != nullptr);
+	stackArenaThread = Fiber::CreateFiberFromThread();
+	std::vector<Fiber::FiberHandle> fibers;
+	std::vector<void*> stacks;
+	std::vector<uintptr_t> colors;
+	for (int i = 0; i < 200; i++) {
+		Fiber::FiberHandle fiber = arena->CreateFiber(StackArenaFiberMain);
+		CHECK(fiber != nullptr);
+		stackArenaFiber = fiber;
+		Fiber::SwitchToFiber(stackArenaThread, fiber);
+		fibers.push_back(fiber);
+		stacks.push_back(fiber->stack_ptr);
+		// where the stack top falls within its 4 KiB page, which picks the L1 sets its hot frames use
+		if (i < static_cast<int>(CoroutineScheduler::StackArena::Colors))
+			colors.push_back((reinterpret_cast<uintptr_t>(fiber->stack_ptr) + StackSize) % 4096);
+	}
+	CHECK(stackArenaRuns == 200);
+	// 200 stacks of 16 KiB do not fit one 2 MiB region
+	size_t regions = arena->Regions();
+	CHECK(regions >= 2);
+	// neighbouring stacks do not share their tops' cache sets
+	std::ranges::sort(colors);
+	CHECK(std::ranges::adjacent_find(colors) == colors.end());
+
+	// stacks come back to the arena and are handed out again, without mapping more
+	for (Fiber::FiberHandle fiber : fibers) Fiber::DeleteFiber(fiber);
+	std::ranges::sort(stacks);
+	for (int i = 0; i < 200; i++) {
+		Fiber::FiberHandle fiber = arena->CreateFiber(StackArenaFiberMain);
+		CHECK(std::ranges::binary_search(stacks, fiber->stack_ptr));
+		Fiber::DeleteFiber(fiber);
+	}
+	CHECK(arena->Regions() == regions);
+	arena->Retire();
+	Fiber::DeleteFiber(stackArenaThread);
+
+	// coroutines on arena stacks, painted for the dump
+	Coroutine::RuntimeConfig config;
+	config.workers = 2;
+	config.stackSize = StackSize;
+	config.stackArena = true;
+	config.stackAccounting = true;
+	Coroutine::Runtime runtime(config);
+	auto channel = std::make_shared<CoroutineScheduler::Channel::SimpleChannel<int>>(1);
+	auto waiter = Coroutine::Run(runtime, "arena-waiter", [channel] { return channel->Receive(); });
+	auto yielders = Coroutine::RunMany(runtime, "yielder", [](int i) {
+		for (int step = 0; step < 10; step++) Coroutine::Yield();
+		return i;
+	}, std::views::iota(0, 2000));
+	CHECK(yielders->GetReturnValues().size() == 2000);
+	std::ostringstream dump;
+	runtime.DumpCoroutines(dump);
+	CHECK(dump.str().find("\tstack high-water: 0 /") == std::string::npos);
+	CHECK(dump.str().find("\tstack high-water: ") != std::string::npos);
+	channel->Send(5);
+	CHECK(waiter->GetReturnValue() == 5);
+#endif
+}
+
+//----------------------- MappedFileReader -----------------------
+static void TestMappedFileReader() {
+#if defined(__linux__)
+	auto path = (std::filesystem::temp_directory_path() / "CoroutineSchedulerTests-reader.txt").string();
+	auto write = [&](const std::string& contents) {
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out << contents;
+	};
+	auto split = [](const std::string& contents, char delimiter) {
+		std::vector<std::string> records;
+		size_t begin = 0;
+		while (begin < contents.size()) {
+			size_t end = contents.find(delimiter, begin);
+			if (end == std::string::npos) end = contents.size();
+			records.push_back(contents.substr(begin, end - begin));
+			begin = end + 1;
+		}
+		return records;
+	};
+	auto read = [&](const Coroutine::MappedFileReaderConfig& config) {
+		Coroutine::MappedFileReader reader(path, config);
+		std::vector<std::string> records;
+		for (std::string_view record : reader) records.emplace_back(record);
+		CHECK(reader.Offset() == reader.Size());
+		return records;
+	};
+
+	// the delimiter at every position around the 16 and 32 byte vector widths, and none at all,
+	// with and without a trailing one
+	for (size_t length = 0; length <= 70; length++) {
+		for (size_t at = 0; at <= length; at++) {
+			std::string contents(length, 'x');
+			if (at < length) contents[at] = '\n';
+			write(contents);
+			CHECK(read({}) == split(contents, '\n'));
+		}
+	}
+
+	// empty records, another delimiter, and a last record without one
+	write(",,a,bb,,ccc");
+	CHECK(read({ .delimiter = ',' }) == std::vector<std::string>({ "", "", "a", "bb", "", "ccc" }));
+	write("");
+	CHECK(read({}).empty());
+
+	// a few MB through windows of one page, the default and one that covers everything
+	std::string big;
+	for (int i = 0; big.size() < 6 * 1024 * 1024; i++) big += std::string(i % 300, static_cast<char>('a' + i % 26)) + "\n";
+	write(big);
+	auto expected = split(big, '\n');
+	for (size_t window : { size_t(4096), size_t(4 * 1024 * 1024), SIZE_MAX })
+		CHECK(read({ .prefetchWindow = window }) == expected);
+	// destroyed half way, with prefetches still queued
+	for (int i = 0; i < 20; i++) {
+		Coroutine::MappedFileReader reader(path, { .prefetchWindow = 4096 });
+		for (int record = 0; record < 5000; record++) reader.Next();
+	}
+
+	// fed into a channel from a coroutine
+	auto channel = std::make_shared<CoroutineScheduler::Channel::SimpleChannel<std::string_view>>(16);
+	auto reader = std::make_shared<Coroutine::MappedFileReader>(path);
+	auto sender = Coroutine::Run("reader", [=] {
+		size_t sent = reader->SendTo(*channel);
+		channel->Send(std::string_view());
+		return sent;
+	});
+	size_t received = 0;
+	while (channel->Receive().data() != nullptr) received++;
+	CHECK(sender->GetReturnValue() == expected.size());
+	CHECK(received == expected.size());
+	std::filesystem::remove(path);
+
+	bool threw = false;
+	try {
+		Coroutine::MappedFileReader missing(path);
+	}
+	catch (const std::system_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+#endif
+}
+
+//----------------------- Priorities and deadlines -----------------------
+// Everything is queued while the spawner holds the only Proc, so the pick order is the run queue's.
+static void TestPriorityAndDeadline() {
+	Coroutine::RuntimeConfig config;
+	config.workers = 1;
+	Coroutine::Runtime runtime(config);
+
+	std::vector<std::string> order;
+	auto spawner = Coroutine::Run(runtime, "spawner", [&] {
+		Coroutine::Channel<int> done;
+		std::vector<std::shared_ptr<void>> handles;
+		auto spawn = [&](const Coroutine::RunOptions& options, std::string label) {
+			handles.push_back(Coroutine::Run(runtime, options, "queued", [&order, &done, label] {
+				order.push_back(label);
+				done.Send(1);
+			}));
+		};
+		Coroutine::RunOptions background, interactive;
+		background.priority = Coroutine::Priority::PriorityBackground;
+		interactive.priority = Coroutine::Priority::PriorityInteractive;
+		for (int i = 0; i < 16; i++) spawn(background, "b");
+		for (int i = 0; i < 16; i++) spawn(interactive, "i");
+		auto now = Clock::now();
+		for (int i = 8; i > 0; i--) {
+			Coroutine::RunOptions withDeadline;
+			withDeadline.deadline = now + std::chrono::milliseconds(i);
+			spawn(withDeadline, std::format("d{}", i));
+		}
+		for (int i = 0; i < 40; i++) done.Receive();
+	});
+	spawner->Await();
+	CHECK(order.size() == 40);
+
+	// by weight interactive gets 8 picks to background's 1
+	auto lastInteractive = std::ranges::find(order.rbegin(), order.rend(), std::string("i")).base();
+	CHECK(std::count(order.begin(), lastInteractive, std::string("b")) <= 4);
+
+	// earliest deadline first
+	std::vector<std::string> deadlines;
+	std::ranges::copy_if(order, std::back_inserter(deadlines), [](const std::string& label) { return label[0] == 'd'; });
+	CHECK(deadlines == std::vector<std::string>({ "d1", "d2", "d3", "d4", "d5", "d6", "d7", "d8" }));
+}
+
+struct TestCase {
+	const char* name;
+	void (*run)();
+};
+
+static const TestCase tests[] = {
+	{ "await_timeout_race", TestAwaitTimeoutRace },
+	{ "await_timer_completion_race", TestAwaitTimerCompletionRace },
+	{ "await_cancel", TestAwaitCancel },
+	{ "channel_timeouts", TestChannelTimeouts },
+	{ "channel_cancellation", TestChannelCancellation },
+	{ "trace_export", TestTraceExport },
+	{ "stats", TestStats },
+	{ "dump_coroutines", TestDumpCoroutines },
+	{ "generator", TestGenerator },
+	{ "pipeline_ordering", TestPipelineOrdering },
+	{ "pipeline_backpressure", TestPipelineBackpressure },
+	{ "pipeline_trace_names", TestPipelineTraceNames },
+	{ "run_many", TestRunMany },
+	{ "fiber_local", TestFiberLocal },
+	{ "proc_local", TestProcLocal },
+	{ "shm_channel", TestShmChannel },
+	{ "actor_teardown", TestActorTeardown },
+	{ "inline_children", TestInlineChildren },
+	{ "single_threaded", TestSingleThreaded },
+	{ "arena", TestArena },
+	{ "stack_arena", TestStackArena },
+	{ "mapped_file_reader", TestMappedFileReader },
+	{ "priority_and_deadline", TestPriorityAndDeadline },
+};
+
+int main(int argc, char** argv) {
+	if (argc > 2) {
+		std::cerr << "usage: CoroutineSchedulerTests [<test>]\n";
+		return 1;
+	}
+	bool found = false;
+	for (const TestCase& test : tests) {
+		if (argc == 2 && std::strcmp(argv[1], test.name) != 0)
+			continue;
+		found = true;
+		test.run();
+		std::cout << std::format("{}: ok\n", test.name);
+	}
+	if (!found) {
+		std::cerr << std::format("no test named {}\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
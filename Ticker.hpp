@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+#include "CoroutineScheduler.hpp"
+#include "Channel.hpp"
+#include "Timer.hpp"
+
+namespace CoroutineScheduler
+{
+	// Ticks every period over a one-slot channel. The schedule is fixed when the ticker is (re)started,
+	// so the work between ticks and the wake-up latency do not make it drift, and a tick the receiver
+	// is not ready for is dropped instead of queued. The timer entry is embedded and moved in place on
+	// every tick, ticking never allocates. Must not outlive its runtime.
+	class Ticker {
+	public:
+		using Clock = std::chrono::steady_clock;
+
+	private:
+		Runtime& runtime;
+		TimerEntry entry;
+		Channel::SimpleChannel<Clock::time_point> ticks{ 1 };
+
+		// runs on a Proc with the timer lock held, so it must not block
+		static void Fire(TimerEntry& entry) {
+			static_cast<Ticker*>(entry.context)->ticks.TrySend(Clock::now());
+		}
+
+	public:
+		explicit Ticker(std::chrono::nanoseconds period, Runtime& runtime = Runtime::Current()) : runtime(runtime) {
+			this->entry.fire = Fire;
+			this->entry.context = this;
+			Reset(period);
+		}
+		Ticker(const Ticker&) = delete;
+		Ticker& operator=(const Ticker&) = delete;
+		~Ticker() { Stop(); }
+
+		// Restarts the schedule from now, dropping a tick that was not received yet.
+		void Reset(std::chrono::nanoseconds period) {
+			uint64_t periodNs = static_cast<uint64_t>(std::max<int64_t>(1, period.count()));
+			auto& timers = this->runtime.GetSleepSyscall();
+			timers.Cancel(this->entry);
+			this->ticks.TryReceive();
+			timers.Schedule(this->entry, Stats::NowNs() + periodNs, periodNs);
+		}
+
+		void Stop() {
+			this->runtime.GetSleepSyscall().Cancel(this->entry);
+			this->ticks.TryReceive();
+		}
+
+		// Parks until the next tick and returns when it fired.
+		Clock::time_point Wait() { return this->ticks.Receive(); }
+		Channel::SimpleChannel<Clock::time_point>& GetChannel() { return this->ticks; }
+	};
+
+	// Delivers one tick at a deadline, then can be reset for another. Like Ticker it is rescheduled in
+	// place and Stop and Reset drop a tick that was not received yet.
+	class Timer {
+	public:
+		using Clock = std::chrono::steady_clock;
+
+	private:
+		Runtime& runtime;
+		TimerEntry entry;
+		Channel::SimpleChannel<Clock::time_point> ticks{ 1 };
+
+		static void Fire(TimerEntry& entry) {
+			static_cast<Timer*>(entry.context)->ticks.TrySend(Clock::now());
+		}
+
+	public:
+		explicit Timer(Clock::time_point deadline, Runtime& runtime = Runtime::Current()) : runtime(runtime) {
+			this->entry.fire = Fire;
+			this->entry.context = this;
+			ResetAt(deadline);
+		}
+		explicit Timer(std::chrono::nanoseconds delay, Runtime& runtime = Runtime::Current())
+			: Timer(Clock::now() + std::chrono::duration_cast<Clock::duration>(delay), runtime) {}
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+		~Timer() { Stop(); }
+
+		// Both return whether the timer was still pending, i.e. had not fired or been stopped.
+		bool ResetAt(Clock::time_point deadline) {
+			auto& timers = this->runtime.GetSleepSyscall();
+			bool pending = timers.Cancel(this->entry);
+			this->ticks.TryReceive();
+			timers.Schedule(this->entry, Stats::ToNs(deadline));
+			return pending;
+		}
+		bool Reset(std::chrono::nanoseconds delay) {
+			return ResetAt(Clock::now() + std::chrono::duration_cast<Clock::duration>(delay));
+		}
+
+		// true when the tick was prevented
+		bool Stop() {
+			bool pending = this->runtime.GetSleepSyscall().Cancel(this->entry);
+			this->ticks.TryReceive();
+			return pending;
+		}
+
+		// Parks until the timer fires and returns when it did.
+		Clock::time_point Wait() { return this->ticks.Receive(); }
+		Channel::SimpleChannel<Clock::time_point>& GetChannel() { return this->ticks; }
+	};
+}
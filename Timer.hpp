@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace CoroutineScheduler
+{
+	// A pending timeout, embedded in whatever owns it (a task, a ticker) so scheduling one never
+	// allocates. The heap index lets the owner cancel or move it in place in O(log n).
+	struct TimerEntry {
+		static constexpr size_t NotQueued = SIZE_MAX;
+
+		// Stats::NowNs nanoseconds
+		uint64_t deadline = 0;
+		// 0 for a one-shot entry, otherwise it stays queued and moves ahead by whole periods when it fires
+		uint64_t period = 0;
+		size_t heapIndex = NotQueued;
+		// run by the timer with its lock held, so the owner cannot go away underneath it
+		void (*fire)(TimerEntry& entry) = nullptr;
+		void* context = nullptr;
+
+		bool Queued() const { return this->heapIndex != NotQueued; }
+	};
+
+	// Binary min-heap of entries ordered by deadline. Not thread-safe.
+	class TimerHeap {
+		std::vector<TimerEntry*> heap;
+
+		void Place(size_t index, TimerEntry* entry) {
+			this->heap[index] = entry;
+			entry->heapIndex = index;
+		}
+		void SiftUp(size_t index) {
+			TimerEntry* entry = this->heap[index];
+			while (index > 0) {
+				size_t parent = (index - 1) / 2;
+				if (this->heap[parent]->deadline <= entry->deadline) break;
+				Place(index, this->heap[parent]);
+				index = parent;
+			}
+			Place(index, entry);
+		}
+		void SiftDown(size_t index) {
+			TimerEntry* entry = this->heap[index];
+			size_t size = this->heap.size();
+			while (true) {
+				size_t child = index * 2 + 1;
+				if (child >= size) break;
+				if (child + 1 < size && this->heap[child + 1]->deadline < this->heap[child]->deadline) child++;
+				if (entry->deadline <= this->heap[child]->deadline) break;
+				Place(index, this->heap[child]);
+				index = child;
+			}
+			Place(index, entry);
+		}
+
+	public:
+		void Reserve(size_t capacity) { this->heap.reserve(capacity); }
+
+		// Queues the entry, or moves it when it is already queued.
+		void Schedule(TimerEntry& entry, uint64_t deadline) {
+			if (entry.Queued()) {
+				bool earlier = deadline < entry.deadline;
+				entry.deadline = deadline;
+				if (earlier) SiftUp(entry.heapIndex);
+				else SiftDown(entry.heapIndex);
+				return;
+			}
+			entry.deadline = deadline;
+			this->heap.push_back(&entry);
+			SiftUp(this->heap.size() - 1);
+		}
+
+		// Returns false when the entry was not queued, e.g. because it already fired.
+		bool Cancel(TimerEntry& entry) {
+			if (!entry.Queued()) return false;
+			size_t index = entry.heapIndex;
+			entry.heapIndex = TimerEntry::NotQueued;
+			TimerEntry* last = this->heap.back();
+			this->heap.pop_back();
+			if (last != &entry) {
+				Place(index, last);
+				SiftUp(index);
+				SiftDown(last->heapIndex);
+			}
+			return true;
+		}
+
+		TimerEntry* Top() const { return this->heap.empty() ? nullptr : this->heap.front(); }
+		TimerEntry* Pop() {
+			TimerEntry* top = this->heap.front();
+			Cancel(*top);
+			return top;
+		}
+		bool Empty() const { return this->heap.empty(); }
+		size_t Size() const { return this->heap.size(); }
+	};
+}
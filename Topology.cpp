@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <format>
+#include <tuple>
+
+#include "Topology.hpp"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN64)
+#include <windows.h>
+#endif
+
+namespace CoroutineScheduler
+{
+namespace Topology
+{
+	static bool ReadFile(const std::filesystem::path& path, std::string& out) {
+		std::ifstream in(path);
+		if (!in.is_open()) return false;
+		std::getline(in, out);
+		return true;
+	}
+
+	static int ReadInt(const std::filesystem::path& path, int fallback) {
+		std::string text;
+		if (!ReadFile(path, text)) return fallback;
+		try {
+			return std::stoi(text);
+		}
+		catch (const std::exception&) {
+			return fallback;
+		}
+	}
+
+	// Parses the kernel's cpu list format, e.g. "0-3,8,10-11".
+	static std::vector<int> ParseCpuList(const std::string& text) {
+		std::vector<int> cpus;
+		size_t pos = 0;
+		while (pos < text.size()) {
+			size_t end = text.find(',', pos);
+			if (end == std::string::npos) end = text.size();
+			std::string range = text.substr(pos, end - pos);
+			pos = end + 1;
+			if (range.empty() || range == "\n") continue;
+			try {
+				size_t dash = range.find('-');
+				int first = std::stoi(range.substr(0, dash));
+				int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+				for (int c = first; c <= last; c++) cpus.push_back(c);
+			}
+			catch (const std::exception&) {
+				return {};
+			}
+		}
+		return cpus;
+	}
+
+	CpuTopology CpuTopology::Discover(const std::string& sysfsRoot) {
+		namespace fs = std::filesystem;
+		CpuTopology topology;
+#if defined(__linux__)
+		std::string online;
+		if (!ReadFile(fs::path(sysfsRoot) / "online", online))
+			return topology;
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		bool haveMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+		for (int id : ParseCpuList(online)) {
+			fs::path dir = fs::path(sysfsRoot) / std::format("cpu{}", id);
+			Cpu cpu;
+			cpu.id = id;
+			cpu.usable = !haveMask || (id < CPU_SETSIZE && CPU_ISSET(id, &allowed));
+			cpu.core = ReadInt(dir / "topology" / "core_id", id);
+			cpu.package = ReadInt(dir / "topology" / "physical_package_id", 0);
+
+			std::string siblings;
+			if (ReadFile(dir / "topology" / "thread_siblings_list", siblings)) {
+				auto list = ParseCpuList(siblings);
+				auto it = std::find(list.begin(), list.end(), id);
+				if (it != list.end()) cpu.smtIndex = static_cast<int>(it - list.begin());
+			}
+
+			// the node shows up as a "nodeN" link in the cpu directory
+			std::error_code ec;
+			for (auto& entry : fs::directory_iterator(dir, ec)) {
+				auto name = entry.path().filename().string();
+				if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::isdigit(static_cast<unsigned char>(name[4]))) {
+					cpu.node = std::stoi(name.substr(4));
+					break;
+				}
+			}
+
+			int llcLevel = -1;
+			for (auto& entry : fs::directory_iterator(dir / "cache", ec)) {
+				if (entry.path().filename().string().compare(0, 5, "index") != 0) continue;
+				int level = ReadInt(entry.path() / "level", -1);
+				std::string shared;
+				if (level <= llcLevel || !ReadFile(entry.path() / "shared_cpu_list", shared)) continue;
+				auto list = ParseCpuList(shared);
+				if (list.empty()) continue;
+				llcLevel = level;
+				cpu.llc = *std::min_element(list.begin(), list.end());
+			}
+			topology.cpus.push_back(cpu);
+		}
+#endif
+		return topology;
+	}
+
+	const CpuTopology& CpuTopology::Get() {
+		static const CpuTopology topology = Discover();
+		return topology;
+	}
+
+	const Cpu* CpuTopology::Find(int cpuId) const {
+		for (auto& cpu : this->cpus) {
+			if (cpu.id == cpuId) return &cpu;
+		}
+		return nullptr;
+	}
+
+	Distance CpuTopology::DistanceBetween(int cpuA, int cpuB) const {
+		if (cpuA == cpuB) return Distance::DistanceSame;
+		const Cpu* a = Find(cpuA);
+		const Cpu* b = Find(cpuB);
+		if (a == nullptr || b == nullptr) return Distance::DistanceRemote;
+		if (a->package == b->package && a->core == b->core) return Distance::DistanceSmtSibling;
+		if (a->llc >= 0 && a->llc == b->llc) return Distance::DistanceSharedCache;
+		if (a->node == b->node) return Distance::DistanceSameNode;
+		return Distance::DistanceRemote;
+	}
+
+	std::vector<int> CpuTopology::PlaceWorkers(unsigned int count, const std::vector<int>& allowed) const {
+		std::vector<Cpu> candidates;
+		for (auto& cpu : this->cpus) {
+			if (!cpu.usable) continue;
+			if (allowed.empty() || std::find(allowed.begin(), allowed.end(), cpu.id) != allowed.end())
+				candidates.push_back(cpu);
+		}
+		std::vector<int> order;
+		if (candidates.empty()) {
+			// nothing known about these CPUs, take them as given
+			order = allowed;
+		}
+		else {
+			std::sort(candidates.begin(), candidates.end(), [](const Cpu& a, const Cpu& b) {
+				return std::tie(a.node, a.smtIndex, a.llc, a.package, a.core, a.id) < std::tie(b.node, b.smtIndex, b.llc, b.package, b.core, b.id);
+				});
+			for (auto& cpu : candidates) order.push_back(cpu.id);
+		}
+		std::vector<int> placement;
+		if (order.empty()) return placement;
+		for (unsigned int i = 0; i < count; i++)
+			placement.push_back(order[i % order.size()]);
+		return placement;
+	}
+
+	bool PinCurrentThread(int cpuId) {
+		if (cpuId < 0) return false;
+#if defined(__linux__)
+		if (cpuId >= CPU_SETSIZE) return false;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpuId, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN64)
+		if (cpuId >= 64) return false;
+		return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpuId) != 0;
+#else
+		return false;
+#endif
+	}
+}
+}
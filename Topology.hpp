@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace CoroutineScheduler
+{
+namespace Topology
+{
+	struct Cpu {
+		int id = -1;
+		int core = -1;
+		int package = -1;
+		int node = 0;
+		// lowest cpu sharing the last level cache, identifies the cache
+		int llc = -1;
+		// position among the SMT siblings of its core, 0 for the first hardware thread
+		int smtIndex = 0;
+		// inside the process affinity mask
+		bool usable = true;
+	};
+
+	// How far apart two CPUs are for the purpose of sharing work, smaller is closer.
+	enum Distance {
+		DistanceSame,
+		DistanceSmtSibling,
+		DistanceSharedCache,
+		DistanceSameNode,
+		DistanceRemote
+	};
+
+	class CpuTopology {
+	public:
+		// online CPUs, ordered by id
+		std::vector<Cpu> cpus;
+
+		// Reads the CPU, cache and NUMA layout from sysfs. Empty where sysfs is unavailable.
+		static CpuTopology Discover(const std::string& sysfsRoot = "/sys/devices/system/cpu");
+		// Discovered once per process.
+		static const CpuTopology& Get();
+
+		const Cpu* Find(int cpuId) const;
+		Distance DistanceBetween(int cpuA, int cpuB) const;
+		// Picks 'count' usable CPUs out of 'allowed' (every CPU when empty) for the Procs: one hardware thread
+		// per core first, filling a NUMA node before moving to the next. Wraps when there are more Procs than CPUs.
+		std::vector<int> PlaceWorkers(unsigned int count, const std::vector<int>& allowed) const;
+	};
+
+	// Pins the calling thread to one CPU. Returns false where pinning is unsupported or refused.
+	bool PinCurrentThread(int cpuId);
+}
+}
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Trace.hpp"
+
+namespace CoroutineScheduler
+{
+namespace Trace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct ThreadTrack {
+		Ring* ring = nullptr;
+		uint64_t generation = 0;
+		bool named = false;
+		unsigned int trackId = 0;
+		std::string name;
+	};
+	static thread_local ThreadTrack threadTrack;
+
+	static const char* ParkReasonName(uint64_t reason) {
+		switch (reason) {
+		case ParkReason::ParkChannel: return "channel";
+		case ParkReason::ParkSleep: return "sleep";
+		case ParkReason::ParkDependentTask: return "dependent task";
+		case ParkReason::ParkYield: return "yield";
+		default: return "unknown";
+		}
+	}
+
+	static std::string EscapeJson(const char* str) {
+		std::string out;
+		for (const char* c = (str != nullptr ? str : ""); *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') out.push_back('\\');
+			if (static_cast<unsigned char>(*c) < 0x20) continue;
+			out.push_back(*c);
+		}
+		return out;
+	}
+
+	//----------------------- Ring -----------------------
+	Ring::Ring(size_t capacity, std::string name, unsigned int track)
+		: slots(std::make_unique<Slot[]>(capacity)), mask(capacity - 1), head(0), trackName(std::move(name)), trackId(track) {}
+
+	bool Ring::Read(uint64_t index, Event& out) const {
+		const Slot& s = this->slots[index & this->mask];
+		uint64_t complete = 2 * index + 2;
+		if (s.sequence.load(std::memory_order_acquire) != complete)
+			return false;
+		out.timestamp = s.timestamp.load(std::memory_order_relaxed);
+		out.taskId = s.taskId.load(std::memory_order_relaxed);
+		out.arg = s.arg.load(std::memory_order_relaxed);
+		out.taskName = s.taskName.load(std::memory_order_relaxed);
+		out.type = s.type.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return s.sequence.load(std::memory_order_relaxed) == complete;
+	}
+	//----------------------------------------------------
+
+	void SetCurrentTrack(unsigned int trackId, std::string name) {
+		threadTrack.named = true;
+		threadTrack.trackId = trackId;
+		threadTrack.name = std::move(name);
+		threadTrack.ring = nullptr;
+	}
+
+	const char* InternName(std::string_view name) {
+		static std::mutex mtx;
+		// leaked, so names stay valid for exports run by other static destructors
+		static auto* names = new std::unordered_set<std::string>();
+		std::lock_guard lock(mtx);
+		return names->emplace(name).first->c_str();
+	}
+
+	//----------------------- Tracer -----------------------
+	Tracer& Tracer::GetInstance() {
+		static Tracer tracer;
+		return tracer;
+	}
+
+	void Tracer::Start(size_t eventsPerTrack) {
+		// round up to a power of two so the ring index is a mask
+		size_t cap = 1;
+		while (cap < eventsPerTrack) cap <<= 1;
+		std::lock_guard lock(this->mtx);
+		// rings may still be written by threads that have not noticed the new generation yet,
+		// so they are kept alive rather than freed.
+		for (auto& r : this->rings) this->retiredRings.emplace_back(std::move(r));
+		this->rings.clear();
+		this->capacity = cap;
+		this->generation.fetch_add(1, std::memory_order_release);
+		enabled.store(true, std::memory_order_release);
+	}
+
+	void Tracer::Stop() {
+		enabled.store(false, std::memory_order_release);
+	}
+
+	Ring* Tracer::AcquireRing() {
+		std::lock_guard lock(this->mtx);
+		if (!threadTrack.named) {
+			std::stringstream _ss;
+			_ss << std::this_thread::get_id();
+			threadTrack.named = true;
+			threadTrack.trackId = this->nextExternalTrack++;
+			threadTrack.name = std::format("External {}", _ss.str());
+		}
+		this->rings.emplace_back(std::make_unique<Ring>(this->capacity, threadTrack.name, threadTrack.trackId));
+		threadTrack.generation = this->generation.load(std::memory_order_acquire);
+		return this->rings.back().get();
+	}
+
+	void Tracer::RecordSlow(EventType type, const ITask* task, uint64_t arg) {
+		if (threadTrack.ring == nullptr || threadTrack.generation != this->generation.load(std::memory_order_relaxed))
+			threadTrack.ring = AcquireRing();
+		uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+		threadTrack.ring->Push(type, task, arg, now);
+	}
+
+	void Tracer::ExportChromeTrace(const std::string& path) {
+		struct TrackEvent {
+			Event event;
+			unsigned int trackId;
+		};
+		std::vector<TrackEvent> all;
+		std::vector<std::pair<unsigned int, std::string>> tracks;
+		{
+			std::lock_guard lock(this->mtx);
+			for (auto& ring : this->rings) {
+				uint64_t head = ring->head.load(std::memory_order_acquire);
+				uint64_t count = std::min<uint64_t>(head, ring->mask + 1);
+				for (uint64_t i = head - count; i < head; i++) {
+					TrackEvent copy{ {}, ring->trackId };
+					// slots the owner overwrote while they were copied are dropped
+					if (ring->Read(i, copy.event))
+						all.push_back(copy);
+				}
+				tracks.emplace_back(ring->trackId, ring->trackName);
+			}
+		}
+		std::stable_sort(all.begin(), all.end(), [](const TrackEvent& a, const TrackEvent& b) {
+			return a.event.timestamp < b.event.timestamp;
+			});
+
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) {
+			throw std::runtime_error(std::format("Failed to open trace file {}", path));
+		}
+
+		uint64_t base = all.empty() ? 0 : all.front().event.timestamp;
+		auto ts = [base](uint64_t t) { return static_cast<double>(t - base) / 1000.0; };
+		bool first = true;
+		auto emit = [&out, &first](const std::string& json) {
+			out << (first ? "\n" : ",\n") << json;
+			first = false;
+		};
+
+		out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		for (auto& [trackId, name] : tracks) {
+			emit(std::format(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"{}"}}}})", trackId, EscapeJson(name.c_str())));
+			emit(std::format(R"({{"name":"thread_sort_index","ph":"M","pid":1,"tid":{},"args":{{"sort_index":{}}}}})", trackId, trackId));
+		}
+
+		// open run slice per track, open async wait span and pending wake flow per task
+		std::unordered_map<unsigned int, Event> running;
+		std::unordered_map<uint64_t, std::string> waiting;
+		std::unordered_map<uint64_t, uint64_t> pendingFlow;
+		uint64_t nextFlowId = 1;
+
+		auto beginWait = [&](const Event& e, unsigned int trackId, std::string name) {
+			emit(std::format(R"({{"name":"{}","cat":"wait","ph":"b","id":{},"pid":1,"tid":{},"ts":{:.3f},"args":{{"task":"{}"}}}})",
+				name, e.taskId, trackId, ts(e.timestamp), EscapeJson(e.taskName)));
+			waiting[e.taskId] = std::move(name);
+		};
+		auto endWait = [&](const Event& e, unsigned int trackId) {
+			auto it = waiting.find(e.taskId);
+			if (it == waiting.end()) return;
+			emit(std::format(R"({{"name":"{}","cat":"wait","ph":"e","id":{},"pid":1,"tid":{},"ts":{:.3f}}})",
+				it->second, e.taskId, trackId, ts(e.timestamp)));
+			waiting.erase(it);
+		};
+
+		for (auto& [e, trackId] : all) {
+			switch (e.type) {
+			case EventType::EventSpawn:
+			case EventType::EventRunnable: {
+				const char* what = e.type == EventType::EventSpawn ? "spawn" : "wake";
+				emit(std::format(R"({{"name":"{} {}","cat":"sched","ph":"i","s":"t","pid":1,"tid":{},"ts":{:.3f},"args":{{"task":{},"by":{}}}}})",
+					what, EscapeJson(e.taskName), trackId, ts(e.timestamp), e.taskId, e.arg));
+				uint64_t flowId = nextFlowId++;
+				emit(std::format(R"({{"name":"{}","cat":"flow","ph":"s","id":{},"pid":1,"tid":{},"ts":{:.3f}}})",
+					what, flowId, trackId, ts(e.timestamp)));
+				pendingFlow[e.taskId] = flowId;
+				endWait(e, trackId);
+				beginWait(e, trackId, "queued");
+				break;
+			}
+			case EventType::EventRunStart: {
+				endWait(e, trackId);
+				running[trackId] = e;
+				auto it = pendingFlow.find(e.taskId);
+				if (it != pendingFlow.end()) {
+					emit(std::format(R"({{"name":"wake","cat":"flow","ph":"f","bp":"e","id":{},"pid":1,"tid":{},"ts":{:.3f}}})",
+						it->second, trackId, ts(e.timestamp)));
+					pendingFlow.erase(it);
+				}
+				break;
+			}
+			case EventType::EventPark:
+			case EventType::EventComplete: {
+				auto it = running.find(trackId);
+				if (it != running.end() && it->second.taskId == e.taskId) {
+					const Event& start = it->second;
+					std::string endedBy = e.type == EventType::EventComplete ? "complete" : std::format("park: {}", ParkReasonName(e.arg));
+					emit(std::format(R"({{"name":"{}","cat":"run","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f},"args":{{"task":{},"end":"{}"}}}})",
+						EscapeJson(start.taskName), trackId, ts(start.timestamp), (e.timestamp - start.timestamp) / 1000.0, e.taskId, endedBy));
+					running.erase(it);
+				}
+				if (e.type == EventType::EventPark)
+					beginWait(e, trackId, std::format("parked: {}", ParkReasonName(e.arg)));
+				break;
+			}
+			}
+		}
+		out << "\n]}\n";
+	}
+	//------------------------------------------------------
+}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Task.hpp"
+
+namespace CoroutineScheduler
+{
+namespace Trace
+{
+	enum EventType : uint8_t {
+		EventSpawn,
+		EventRunnable,
+		EventRunStart,
+		EventPark,
+		EventComplete
+	};
+
+	// For EventSpawn/EventRunnable 'arg' is the id of the task that caused it (0 when it came from
+	// outside any task, e.g. a timer or a thread outside the runtime), for EventPark it is the ParkReason.
+	struct Event {
+		uint64_t timestamp;
+		uint64_t taskId;
+		uint64_t arg;
+		const char* taskName;
+		EventType type;
+	};
+
+	// One ring entry under a seqlock, so the exporter can copy it while the owner overwrites it.
+	struct Slot {
+		// 2 * index + 1 while event 'index' is being written, 2 * index + 2 once it is complete
+		std::atomic<uint64_t> sequence{ 0 };
+		std::atomic<uint64_t> timestamp{ 0 };
+		std::atomic<uint64_t> taskId{ 0 };
+		std::atomic<uint64_t> arg{ 0 };
+		std::atomic<const char*> taskName{ nullptr };
+		std::atomic<EventType> type{ EventType::EventSpawn };
+	};
+
+	// Single-writer ring, owned by the thread that records into it. Old events are overwritten.
+	struct Ring {
+		std::unique_ptr<Slot[]> slots;
+		size_t mask;
+		std::atomic<uint64_t> head;
+		std::string trackName;
+		unsigned int trackId;
+
+		Ring(size_t capacity, std::string name, unsigned int track);
+		inline void Push(EventType type, const ITask* task, uint64_t arg, uint64_t timestamp) {
+			uint64_t idx = head.load(std::memory_order_relaxed);
+			Slot& s = slots[idx & mask];
+			s.sequence.store(2 * idx + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			s.timestamp.store(timestamp, std::memory_order_relaxed);
+			s.taskId.store(task->id, std::memory_order_relaxed);
+			s.arg.store(arg, std::memory_order_relaxed);
+			s.taskName.store(task->GetTaskName(), std::memory_order_relaxed);
+			s.type.store(type, std::memory_order_relaxed);
+			s.sequence.store(2 * idx + 2, std::memory_order_release);
+			head.store(idx + 1, std::memory_order_release);
+		}
+
+		// Copies event 'index'. False when the writer was overwriting it during the copy or has
+		// already lapped it.
+		bool Read(uint64_t index, Event& out) const;
+	};
+
+	class Tracer {
+		std::mutex mtx;
+		std::vector<std::unique_ptr<Ring>> rings;
+		std::vector<std::unique_ptr<Ring>> retiredRings;
+		size_t capacity = 0;
+		std::atomic<uint64_t> generation{ 0 };
+		// Proc tracks are numbered per runtime below this, see Proc::ThreadMainLoop
+		unsigned int nextExternalTrack = 1 << 20;
+
+		Ring* AcquireRing();
+	public:
+		static inline std::atomic<bool> enabled{ false };
+
+		void Start(size_t eventsPerTrack);
+		void Stop();
+		void ExportChromeTrace(const std::string& path);
+		void RecordSlow(EventType type, const ITask* task, uint64_t arg);
+
+		static Tracer& GetInstance();
+	};
+
+	// Names the calling thread's track. Proc threads call this once at startup, every other
+	// thread gets an "External" track on its first event.
+	void SetCurrentTrack(unsigned int trackId, std::string name);
+
+	// A copy of 'name' that is never freed, for task names built at runtime: events keep the name
+	// pointer and only read it when exported. Equal names share one copy.
+	const char* InternName(std::string_view name);
+
+	inline void Record(EventType type, const ITask* task, uint64_t arg = 0) {
+		if (!Tracer::enabled.load(std::memory_order_relaxed) || task == nullptr)
+			return;
+		Tracer::GetInstance().RecordSlow(type, task, arg);
+	}
+}
+}
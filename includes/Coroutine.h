@@ -1,25 +1,164 @@
 #pragma once
 
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <vector>
 #include "../CoroutineScheduler.hpp"
+#include "../Actor.hpp"
 #include "../Channel.hpp"
+#include "../ShmChannel.hpp"
+#include "../MappedFileReader.hpp"
+#include "../Ticker.hpp"
+#include "../Generator.hpp"
+#include "../Pipeline.hpp"
+#include "../TaskBatch.hpp"
+#include "../ProcLocal.hpp"
 #include "../Syscalls.hpp"
+#include "../Trace.hpp"
 
 namespace Coroutine {
 
+	using Runtime = CoroutineScheduler::Runtime;
+	using RuntimeConfig = CoroutineScheduler::RuntimeConfig;
+	using Priority = CoroutineScheduler::TaskPriority;
+	using TaskGroup = CoroutineScheduler::TaskGroup;
+	using TaskGroupConfig = CoroutineScheduler::TaskGroupConfig;
+	using CancelledError = CoroutineScheduler::CancelledError;
+	using Ticker = CoroutineScheduler::Ticker;
+	using Timer = CoroutineScheduler::Timer;
+	template<typename T>
+	using Generator = CoroutineScheduler::Generator<T>;
+	// A channel for the coroutines of one single-threaded runtime (RuntimeConfig::singleThreaded)
+	// that takes no lock. Threads outside the runtime must not block on it.
+	template<typename T>
+	using LocalChannel = CoroutineScheduler::Channel::SimpleChannel<T, CoroutineScheduler::Channel::NoLock>;
+#if defined(__linux__)
+	template<typename T>
+	using ShmChannel = CoroutineScheduler::Channel::ShmChannel<T>;
+	using MappedFileReader = CoroutineScheduler::MappedFileReader;
+	using MappedFileReaderConfig = CoroutineScheduler::MappedFileReaderConfig;
+#endif
+	template<typename T>
+	using FiberLocal = CoroutineScheduler::FiberLocal<T>;
+	template<typename T>
+	using ProcLocal = CoroutineScheduler::ProcLocal<T>;
+	template<typename Msg>
+	using Actor = CoroutineScheduler::Actor<Msg>;
+	using ActorConfig = CoroutineScheduler::ActorConfig;
+	template<typename Source>
+	using Pipeline = CoroutineScheduler::Pipeline<Source>;
+	template<typename Source, typename Current = Source>
+	using PipelineBuilder = CoroutineScheduler::PipelineBuilder<Source, Current>;
+	using PipelineStageConfig = CoroutineScheduler::PipelineStageConfig;
+	using PipelineStageStats = CoroutineScheduler::PipelineStageStats;
+
+	// Cancels every coroutine spawned with it (and, by default, their children). Parked ones are woken
+	// and their blocking call throws CancelledError; copies share the same state.
+	class CancellationToken {
+		std::shared_ptr<CoroutineScheduler::CancellationState> state;
+	public:
+		CancellationToken() : state(std::make_shared<CoroutineScheduler::CancellationState>()) {}
+		void Cancel() { state->Cancel(); }
+		bool IsCancelled() const { return state->IsCancelled(); }
+		const std::shared_ptr<CoroutineScheduler::CancellationState>& GetState() const { return state; }
+	};
+
+	struct RunOptions {
+		Priority priority = Priority::PriorityNormal;
+		// tasks with a deadline are run earliest deadline first, ahead of the priority classes by
+		// RuntimeConfig::priorityWeights; the default time point means no deadline
+		std::chrono::steady_clock::time_point deadline{};
+		// CPU time is charged to this group, see Runtime::CreateTaskGroup; nullptr for the runtime's default group
+		CoroutineScheduler::TaskGroup* group = nullptr;
+		// when unset the coroutine shares the spawning coroutine's token, if any
+		std::optional<CancellationToken> cancellation;
+
+		// Throws std::invalid_argument when group was created by another runtime than the one spawning.
+		void Validate(const CoroutineScheduler::Runtime& runtime) const {
+			if (this->group != nullptr && this->group->runtimeId != runtime.GetId())
+				throw std::invalid_argument("task group " + this->group->name + " belongs to another runtime");
+		}
+	};
+
+	// The calling coroutine's arena for std::pmr containers and allocators: allocation bumps a pointer
+	// into pages from the Proc's cache, nothing is freed one by one, and every page is released at once
+	// when the coroutine completes, so nothing allocated from it may outlive the coroutine. Outside
+	// coroutines this is std::pmr::get_default_resource().
+	inline std::pmr::memory_resource* Arena() {
+		return CoroutineScheduler::CurrentArena();
+	}
+
+	// True when the calling coroutine's token was cancelled, for long computations between blocking calls.
+	inline bool IsCancelled() {
+		auto task = CoroutineScheduler::Runtime::Current().GetCurrentContextTask();
+		return task != nullptr && task->IsCancelled();
+	}
+
+	inline void ThrowIfCancelled() {
+		if (IsCancelled()) throw CancelledError();
+	}
+
+#ifdef Yield
+#undef Yield // windows.h defines an empty Yield() macro
+#endif
+	// Gives up the Proc: the coroutine goes to the back of its run queue and resumes once its turn comes.
+	// Outside a coroutine it yields the thread. Throws CancelledError when the coroutine was cancelled.
+	inline void Yield() {
+		CoroutineScheduler::Runtime::Current().YieldCurrentTask();
+	}
+
 	namespace Syscall
 	{
+		// Parks the coroutine until the deadline, exact to the runtime's timer resolution; see
+		// RuntimeConfig::timerSpin for shorter sleeps than parking allows. Throws CancelledError when cancelled.
+		inline void SleepUntil(std::chrono::steady_clock::time_point deadline) {
+			CoroutineScheduler::Runtime::Current().SleepUntil(CoroutineScheduler::Stats::ToNs(deadline));
+		}
+
+		template<typename Rep, typename Period>
+		void SleepFor(std::chrono::duration<Rep, Period> duration) {
+			SleepUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration));
+		}
+
 		inline void Sleep(int milliSec) {
-			auto& cs = CoroutineScheduler::Runtime::GetInstance();
-			auto task = cs.GetCurrentContextTask();
-			if (task != nullptr) {
-				CoroutineScheduler::Syscall::Sleep::GetInstance().AddSleep(milliSec, task);
-				cs.PreemptCurrentTask();
-			}
-			else std::this_thread::sleep_for(std::chrono::milliseconds(milliSec));
+			SleepFor(std::chrono::milliseconds(milliSec));
 		}
 	}
 
+	namespace Trace
+	{
+		// Starts recording scheduler events into per-Proc rings of 'eventsPerProc' entries (rounded up
+		// to a power of two). Restarting discards previously recorded events.
+		inline void Start(size_t eventsPerProc = 1 << 16) {
+			CoroutineScheduler::Trace::Tracer::GetInstance().Start(eventsPerProc);
+		}
+		inline void Stop() {
+			CoroutineScheduler::Trace::Tracer::GetInstance().Stop();
+		}
+		// Writes the recorded events as Chrome trace JSON, loadable in chrome://tracing and ui.perfetto.dev.
+		inline void ExportChromeTrace(const std::string& path) {
+			CoroutineScheduler::Trace::Tracer::GetInstance().ExportChromeTrace(path);
+		}
+		// A never-freed copy of a name built at runtime, for use as a task name: traces keep names by
+		// pointer, see CoroutineScheduler::ITask::GetTaskName.
+		inline const char* InternName(std::string_view name) {
+			return CoroutineScheduler::Trace::InternName(name);
+		}
+	}
+
+	// Snapshot of the scheduler counters, see CoroutineScheduler::Stats::RuntimeStats::ToPrometheus for export.
+	inline CoroutineScheduler::Stats::RuntimeStats GetStats(CoroutineScheduler::Runtime& runtime = CoroutineScheduler::Runtime::Current()) {
+		return runtime.GetStats();
+	}
+
+	// Prints every live coroutine with its state, park reason, stack high-water mark and, when parked, a backtrace.
+	inline void DumpCoroutines(std::ostream& out = std::cout) {
+		CoroutineScheduler::Runtime::Current().DumpCoroutines(out);
+	}
+
 	template<typename T>
 	class Channel {
 		std::shared_ptr<CoroutineScheduler::Channel::SimpleChannel<T>> chan;
@@ -32,11 +171,25 @@ namespace Coroutine {
 			return chan->IsCompleted();
 		}*/
 		void Send(T val) {
-			chan->Send(val);
+			chan->Send(std::move(val));
+		}
+		bool SendUntil(T val, std::chrono::steady_clock::time_point deadline) {
+			return chan->SendUntil(std::move(val), deadline);
+		}
+		template<typename Rep, typename Period>
+		bool SendFor(T val, std::chrono::duration<Rep, Period> timeout) {
+			return chan->SendFor(std::move(val), timeout);
 		}
 		T Receive() {
 			return chan->Receive();
 		}
+		std::optional<T> ReceiveUntil(std::chrono::steady_clock::time_point deadline) {
+			return chan->ReceiveUntil(deadline);
+		}
+		template<typename Rep, typename Period>
+		std::optional<T> ReceiveFor(std::chrono::duration<Rep, Period> timeout) {
+			return chan->ReceiveFor(timeout);
+		}
 
 		class Sender {
 			std::shared_ptr<CoroutineScheduler::Channel::SimpleChannel<T>> chan;
@@ -46,7 +199,14 @@ namespace Coroutine {
 				chan->MarkComplete();
 			}*/
 			void Send(T val) {
-				chan->Send(val);
+				chan->Send(std::move(val));
+			}
+			bool SendUntil(T val, std::chrono::steady_clock::time_point deadline) {
+				return chan->SendUntil(std::move(val), deadline);
+			}
+			template<typename Rep, typename Period>
+			bool SendFor(T val, std::chrono::duration<Rep, Period> timeout) {
+				return chan->SendFor(std::move(val), timeout);
 			}
 			friend class Channel<T>;
 		};
@@ -61,6 +221,13 @@ namespace Coroutine {
 			T Receive() {
 				return chan->Receive();
 			}
+			std::optional<T> ReceiveUntil(std::chrono::steady_clock::time_point deadline) {
+				return chan->ReceiveUntil(deadline);
+			}
+			template<typename Rep, typename Period>
+			std::optional<T> ReceiveFor(std::chrono::duration<Rep, Period> timeout) {
+				return chan->ReceiveFor(timeout);
+			}
 			friend class Channel<T>;
 		};
 
@@ -78,11 +245,25 @@ namespace Coroutine {
 	public:
 		BufferedChannel(unsigned int bufferSize) : chan(std::make_shared<CoroutineScheduler::Channel::SimpleChannel<T>>(bufferSize)) { }
 		void Send(T val) {
-			chan->Send(val);
+			chan->Send(std::move(val));
+		}
+		bool SendUntil(T val, std::chrono::steady_clock::time_point deadline) {
+			return chan->SendUntil(std::move(val), deadline);
+		}
+		template<typename Rep, typename Period>
+		bool SendFor(T val, std::chrono::duration<Rep, Period> timeout) {
+			return chan->SendFor(std::move(val), timeout);
 		}
 		T Receive() {
 			return chan->Receive();
 		}
+		std::optional<T> ReceiveUntil(std::chrono::steady_clock::time_point deadline) {
+			return chan->ReceiveUntil(deadline);
+		}
+		template<typename Rep, typename Period>
+		std::optional<T> ReceiveFor(std::chrono::duration<Rep, Period> timeout) {
+			return chan->ReceiveFor(timeout);
+		}
 
 		class Sender {
 			std::shared_ptr<CoroutineScheduler::Channel::SimpleChannel<T>> chan;
@@ -92,7 +273,14 @@ namespace Coroutine {
 				chan->MarkComplete();
 			}
 			void Send(T val) {
-				chan->Send(val);
+				chan->Send(std::move(val));
+			}
+			bool SendUntil(T val, std::chrono::steady_clock::time_point deadline) {
+				return chan->SendUntil(std::move(val), deadline);
+			}
+			template<typename Rep, typename Period>
+			bool SendFor(T val, std::chrono::duration<Rep, Period> timeout) {
+				return chan->SendFor(std::move(val), timeout);
 			}
 			friend class BufferedChannel<T>;
 		};
@@ -107,6 +295,13 @@ namespace Coroutine {
 			T Receive() {
 				return chan->Receive();
 			}
+			std::optional<T> ReceiveUntil(std::chrono::steady_clock::time_point deadline) {
+				return chan->ReceiveUntil(deadline);
+			}
+			template<typename Rep, typename Period>
+			std::optional<T> ReceiveFor(std::chrono::duration<Rep, Period> timeout) {
+				return chan->ReceiveFor(timeout);
+			}
 			friend class BufferedChannel<T>;
 		};
 
@@ -124,9 +319,12 @@ namespace Coroutine {
 	public:
 		ResultState(CoroutineScheduler::ITask* t) : task(t) {}
 
+		// Joins the coroutine, except that a cancelled caller leaves it running and only drops its handle.
 		~ResultState() {
-			CoroutineScheduler::Runtime::GetInstance().PreemptForDependentTask(*task);
-			task->Await();
+			try {
+				CoroutineScheduler::Runtime::Current().AwaitTask(*task);
+			}
+			catch (const CancelledError&) {}
 			if (!task->MarkForDeletion()) {
 				delete task;
 			}
@@ -134,28 +332,172 @@ namespace Coroutine {
 		}
 
 		void Await() {
-			CoroutineScheduler::Runtime::GetInstance().PreemptForDependentTask(*task);
-			task->Await();
+			CoroutineScheduler::Runtime::Current().AwaitTask(*task);
 		}
 
+		// false when the coroutine was still running at the deadline
+		bool AwaitUntil(std::chrono::steady_clock::time_point deadline) {
+			return CoroutineScheduler::Runtime::Current().AwaitTask(*task, CoroutineScheduler::Stats::ToNs(deadline));
+		}
+
+		template<typename Rep, typename Period>
+		bool AwaitFor(std::chrono::duration<Rep, Period> timeout) {
+			return AwaitUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+		}
+
+		// Whether the coroutine ended by cancellation. Awaits it first.
+		bool IsCancelled() {
+			Await();
+			return static_cast<CoroutineScheduler::Task<F, A...>*>(task)->WasCancelled();
+		}
+
+		// Throws CancelledError when the coroutine was cancelled before it produced a value.
 		R GetReturnValue() {
+			Await();
 			CoroutineScheduler::TaskWithReturnValue<R, F, A...>* derived = static_cast<CoroutineScheduler::TaskWithReturnValue<R, F, A...>*>(task);
-			return *(derived->GetReturnValue());
+			auto value = derived->GetReturnValue();
+			if (value == nullptr) throw CancelledError();
+			return *value;
+		}
+	};
+
+	// Handle of the coroutines spawned by one RunMany. Destroying it joins them, except that a cancelled
+	// caller only drops its reference, like ResultState.
+	template<typename F, typename Item>
+	class BatchState {
+		using Batch = CoroutineScheduler::TaskBatch<F, Item>;
+		Batch* batch;
+	public:
+		using Result = typename Batch::Result;
+
+		BatchState(Batch* b) : batch(b) {}
+		BatchState(const BatchState&) = delete;
+		BatchState& operator=(const BatchState&) = delete;
+
+		~BatchState() {
+			try {
+				batch->Join();
+			}
+			catch (const CancelledError&) {}
+			batch->Release();
+			batch = nullptr;
+		}
+
+		size_t Size() const { return batch->Size(); }
+
+		// One wait for all of them, however many there are.
+		void Await() { batch->Join(); }
+
+		// false when some were still running at the deadline
+		bool AwaitUntil(std::chrono::steady_clock::time_point deadline) { return batch->JoinUntil(deadline); }
+
+		template<typename Rep, typename Period>
+		bool AwaitFor(std::chrono::duration<Rep, Period> timeout) {
+			return AwaitUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+		}
+
+		// How many ended by cancellation. Awaits them first.
+		size_t CancelledCount() {
+			Await();
+			return batch->CancelledCount();
+		}
+
+		// In the order of the range. Throws CancelledError when any was cancelled before it produced a value.
+		std::vector<Result> GetReturnValues() requires (!std::is_void_v<Result>) {
+			Await();
+			std::vector<Result> values;
+			values.reserve(batch->Size());
+			for (auto& slot : batch->Results()) {
+				if (!slot.has_value()) throw CancelledError();
+				values.push_back(*slot);
+			}
+			return values;
 		}
 	};
 
+	// Spawns func(item) for every item of the range, copied into its coroutine. The coroutines are
+	// allocated in one block and queued under one lock, with the idle Procs they need woken at once, and
+	// the returned handle joins all of them with a single wait. Options apply to every coroutine.
+	template<typename F, std::ranges::forward_range Range>
+	auto RunMany(CoroutineScheduler::Runtime& runtime, const RunOptions& options, const char* const taskName, F&& func, Range&& range) {
+		using Item = std::ranges::range_value_t<Range>;
+		using Batch = CoroutineScheduler::TaskBatch<std::decay_t<F>, Item>;
+		options.Validate(runtime);
+		size_t count = static_cast<size_t>(std::ranges::distance(range));
+		auto* batch = new Batch(taskName, std::forward<F>(func), std::forward<Range>(range), count);
+
+		std::shared_ptr<CoroutineScheduler::CancellationState> cancellation;
+		if (options.cancellation.has_value())
+			cancellation = options.cancellation->GetState();
+		else if (auto parent = runtime.GetCurrentContextTask(); parent != nullptr)
+			cancellation = parent->cancellation;
+		uint64_t deadline = options.deadline != std::chrono::steady_clock::time_point{} ? CoroutineScheduler::Stats::ToNs(options.deadline) : 0;
+
+		for (size_t i = 0; i < count; i++) {
+			CoroutineScheduler::ITask& task = (*batch)[i];
+			task.priority = options.priority;
+			task.group = options.group;
+			task.cancellation = cancellation;
+			task.deadline = deadline;
+		}
+		runtime.AddTasks(batch->Tasks(), count);
+
+		return std::make_shared<BatchState<std::decay_t<F>, Item>>(batch);
+	}
+
+	template<typename F, std::ranges::forward_range Range>
+	auto RunMany(CoroutineScheduler::Runtime& runtime, const char* const taskName, F&& func, Range&& range) {
+		return RunMany(runtime, RunOptions{}, taskName, std::forward<F>(func), std::forward<Range>(range));
+	}
+
+	template<typename F, std::ranges::forward_range Range>
+	auto RunMany(const RunOptions& options, const char* const taskName, F&& func, Range&& range) {
+		return RunMany(CoroutineScheduler::Runtime::Current(), options, taskName, std::forward<F>(func), std::forward<Range>(range));
+	}
+
+	template<typename F, std::ranges::forward_range Range>
+	auto RunMany(const char* const taskName, F&& func, Range&& range) {
+		return RunMany(CoroutineScheduler::Runtime::Current(), RunOptions{}, taskName, std::forward<F>(func), std::forward<Range>(range));
+	}
+
+	// Spawns the coroutine on the given runtime, starting the runtime's Procs on first use.
 	template<typename F, typename... A>
-	auto Run(const char* const taskName, F&& func, A&&... args) {
+	auto Run(CoroutineScheduler::Runtime& runtime, const RunOptions& options, const char* const taskName, F&& func, A&&... args) {
 		using ReturnType = std::invoke_result_t<F, A...>;
+		options.Validate(runtime);
 
 		CoroutineScheduler::ITask* task = nullptr;
 		if constexpr (std::is_void_v<ReturnType>)
 			task = new CoroutineScheduler::Task<F, A...>(taskName, std::forward<F>(func), std::forward<A>(args)...);
 		else
 			task = new CoroutineScheduler::TaskWithReturnValue<ReturnType, F, A...>(taskName, std::forward<F>(func), std::forward<A>(args)...);
+		task->priority = options.priority;
+		task->group = options.group;
+		if (options.cancellation.has_value())
+			task->cancellation = options.cancellation->GetState();
+		else if (auto parent = runtime.GetCurrentContextTask(); parent != nullptr)
+			task->cancellation = parent->cancellation;
+		if (options.deadline != std::chrono::steady_clock::time_point{})
+			task->deadline = CoroutineScheduler::Stats::ToNs(options.deadline);
 
-		CoroutineScheduler::Runtime::GetInstance().AddTask(task);
+		runtime.AddTask(task);
 
 		return std::move(std::make_shared<ResultState<ReturnType, F, A...>>(task));
 	}
+
+	template<typename F, typename... A>
+	auto Run(CoroutineScheduler::Runtime& runtime, const char* const taskName, F&& func, A&&... args) {
+		return Run(runtime, RunOptions{}, taskName, std::forward<F>(func), std::forward<A>(args)...);
+	}
+
+	// Spawns the coroutine on the calling coroutine's runtime, or on the default runtime outside of one.
+	template<typename F, typename... A>
+	auto Run(const RunOptions& options, const char* const taskName, F&& func, A&&... args) {
+		return Run(CoroutineScheduler::Runtime::Current(), options, taskName, std::forward<F>(func), std::forward<A>(args)...);
+	}
+
+	template<typename F, typename... A>
+	auto Run(const char* const taskName, F&& func, A&&... args) {
+		return Run(CoroutineScheduler::Runtime::Current(), RunOptions{}, taskName, std::forward<F>(func), std::forward<A>(args)...);
+	}
 }